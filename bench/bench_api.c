@@ -0,0 +1,150 @@
+/* bench/bench_api.c
+ * Call overhead of the library API against the menu's stdin path.
+ *
+ * Both paths run the same operation mix on a book seeded with POSITIONS
+ * holdings: buy 1 share, update its price, sell 1 share, read metrics.
+ * The stdin path feeds the equivalent menu script to the portfolio
+ * program (output to /dev/null) in a scratch directory; its start-up and
+ * exit are timed separately with an empty script and subtracted.
+ *
+ * Usage: bench_api [PORTFOLIO_PROGRAM [POSITIONS [OPS]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "portfolio.h"
+
+#define OPS_PER_ROUND 4
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void symbol_of(int i, char *out) {
+    snprintf(out, PF_SYMBOL_LEN, "S%06d", i);
+}
+
+static double run_api(int positions, long rounds) {
+    Portfolio pf;
+    pf_metrics m;
+    char sym[PF_SYMBOL_LEN];
+    double sink = 0.0;
+
+    pf_init(&pf);
+    for (int i = 0; i < positions; ++i) {
+        symbol_of(i, sym);
+        pf_buy(&pf, sym, 1000, 10.0, NULL, NULL);
+    }
+    double t0 = now_sec();
+    for (long r = 0; r < rounds; ++r) {
+        symbol_of((int)(r % positions), sym);
+        pf_buy(&pf, sym, 1, 10.5, NULL, NULL);
+        pf_update_price(&pf, sym, 11.0);
+        pf_sell(&pf, sym, 1, 11.0, NULL);
+        pf_get_metrics(&pf, &m);
+        sink += m.market_value;
+    }
+    double t = now_sec() - t0;
+    if (sink < 0.0) puts("");
+    pf_free(&pf);
+    return t;
+}
+
+/* run prog in dir with stdin from script; returns wall seconds or -1 */
+static double run_cli(const char *prog, const char *dir, const char *script) {
+    double t0 = now_sec();
+    pid_t pid = fork();
+    if (pid < 0) return -1.0;
+    if (pid == 0) {
+        int in = open(script, O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if (in < 0 || out < 0 || chdir(dir) != 0) _exit(127);
+        dup2(in, 0);
+        dup2(out, 1);
+        execl(prog, prog, (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1.0;
+    return now_sec() - t0;
+}
+
+static int write_book(const char *dir, int positions) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/portfolio.txt", dir);
+    FILE *f = fopen(path, "w");
+    if (!f) return 0;
+    char sym[PF_SYMBOL_LEN];
+    for (int i = 0; i < positions; ++i) {
+        symbol_of(i, sym);
+        fprintf(f, "%s 1000 10 10 USD\n", sym);
+    }
+    return fclose(f) == 0;
+}
+
+static int write_script(const char *path, int positions, long rounds) {
+    FILE *f = fopen(path, "w");
+    if (!f) return 0;
+    char sym[PF_SYMBOL_LEN];
+    for (long r = 0; r < rounds; ++r) {
+        symbol_of((int)(r % positions), sym);
+        fprintf(f, "2\n%s\n1\n10.5\n4\n%s\n11\n3\n%s\n1\n11\n5\n", sym, sym, sym);
+    }
+    fprintf(f, "0\n");
+    return fclose(f) == 0;
+}
+
+int main(int argc, char **argv) {
+    const char *prog = argc > 1 ? argv[1] : "build/portfolio";
+    int positions = argc > 2 ? atoi(argv[2]) : 1000;
+    long ops = argc > 3 ? atol(argv[3]) : 200000;
+    if (positions < 1 || ops < OPS_PER_ROUND) {
+        fprintf(stderr, "usage: %s [PORTFOLIO_PROGRAM [POSITIONS [OPS]]]\n", argv[0]);
+        return 1;
+    }
+    long rounds = ops / OPS_PER_ROUND;
+    ops = rounds * OPS_PER_ROUND;
+
+    char absprog[4096];
+    if (prog[0] != '/' && getcwd(absprog, sizeof(absprog))) {
+        size_t n = strlen(absprog);
+        snprintf(absprog + n, sizeof(absprog) - n, "/%s", prog);
+        prog = absprog;
+    }
+
+    printf("%d positions, %ld ops (buy, update, sell, metrics)\n", positions, ops);
+    double t_api = run_api(positions, rounds);
+    printf("API   : %10.3f s  %10.1f ns/op  %12.0f ops/s\n", t_api, t_api * 1e9 / ops, ops / t_api);
+
+    char dir[] = "/tmp/pf_bench_XXXXXX";
+    if (!mkdtemp(dir)) { perror("mkdtemp"); return 1; }
+    char idle[600], script[600], book[600];
+    snprintf(idle, sizeof(idle), "%s/idle.in", dir);
+    snprintf(script, sizeof(script), "%s/ops.in", dir);
+    snprintf(book, sizeof(book), "%s/portfolio.txt", dir);
+
+    double t_idle = -1.0, t_cli = -1.0;
+    if (write_book(dir, positions) && write_script(idle, positions, 0)) t_idle = run_cli(prog, dir, idle);
+    if (write_book(dir, positions) && write_script(script, positions, rounds)) t_cli = run_cli(prog, dir, script);
+    if (t_idle < 0.0 || t_cli < 0.0) {
+        fprintf(stderr, "could not run %s\n", prog);
+    } else {
+        double t = t_cli - t_idle;
+        printf("stdin : %10.3f s  %10.1f ns/op  %12.0f ops/s  (start-up + exit %.3f s excluded)\n",
+               t, t * 1e9 / ops, ops / t, t_idle);
+        printf("stdin path costs %.1fx the API per operation\n", t / t_api);
+    }
+    unlink(idle);
+    unlink(script);
+    unlink(book);
+    rmdir(dir);
+    return 0;
+}
@@ -0,0 +1,113 @@
+/* bench/bench_feed.c
+ * Throughput and latency of the shared-memory price feed.
+ *
+ * A forked producer publishes TICKS random-walk prices over POSITIONS
+ * symbols as fast as the ring allows; this process polls them into a
+ * book. Reports ticks/sec, mean publish-to-apply latency and percentiles
+ * of the oldest tick's latency in each polled batch.
+ *
+ * Usage: bench_feed [POSITIONS [TICKS [SLOTS]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "portfolio.h"
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void producer(pf_feed *f, char (*syms)[PF_SYMBOL_LEN], int n, long ticks) {
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    for (long t = 0; t < ticks; ++t) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        int i = (int)(x % (uint64_t)n);
+        double price = 100.0 + (double)(x >> 52) / 64.0;
+        while (!pf_feed_publish(f, syms[i], price)) sched_yield();
+    }
+}
+
+int main(int argc, char **argv) {
+    int positions = argc > 1 ? atoi(argv[1]) : 10000;
+    long ticks = argc > 2 ? atol(argv[2]) : 20000000;
+    int slots = argc > 3 ? atoi(argv[3]) : 65536;
+    if (positions < 1 || ticks < 1 || slots < 2) {
+        fprintf(stderr, "usage: %s [POSITIONS [TICKS [SLOTS]]]\n", argv[0]);
+        return 1;
+    }
+
+    Portfolio book;
+    pf_init(&book);
+    char (*syms)[PF_SYMBOL_LEN] = malloc((size_t)positions * PF_SYMBOL_LEN);
+    if (!syms) return 1;
+    for (int i = 0; i < positions; ++i) {
+        snprintf(syms[i], PF_SYMBOL_LEN, "F%07d", i);
+        pf_buy(&book, syms[i], 100, 100.0, NULL, NULL);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "/pf_bench_feed_%d", (int)getpid());
+    pf_feed *feed;
+    if (pf_feed_create(name, slots, &feed) != PF_OK) { perror("pf_feed_create"); return 1; }
+
+    pid_t pid = fork();
+    if (pid < 0) { perror("fork"); return 1; }
+    if (pid == 0) {
+        producer(feed, syms, positions, ticks);
+        _exit(0);
+    }
+
+    size_t cap = 1 << 20, nb = 0;
+    double *lag = malloc(cap * sizeof(double));
+    double lag_sum = 0.0, t_first = 0.0;
+    long got = 0, applied = 0, empty = 0;
+    pf_feed_batch b;
+    while (got < ticks && lag) {
+        if (pf_feed_poll(feed, &book, 0, &b) == 0) { ++empty; sched_yield(); continue; }
+        if (got == 0) t_first = now_sec();
+        got += b.ticks;
+        applied += b.applied;
+        lag_sum += b.lag_sum_ns;
+        if (nb == cap) {
+            double *grown = realloc(lag, 2 * cap * sizeof(double));
+            if (!grown) break;
+            lag = grown;
+            cap *= 2;
+        }
+        lag[nb++] = b.lag_max_ns;
+    }
+    double dt = now_sec() - t_first;
+    waitpid(pid, NULL, 0);
+
+    pf_metrics m;
+    pf_get_metrics(&book, &m);
+    printf("%d positions, %ld ticks, %d slots\n", positions, got, slots);
+    printf("throughput: %.2f M ticks/s (%ld applied, %zu batches, mean %.0f ticks/batch, %ld empty polls)\n",
+           got / dt / 1e6, applied, nb, nb ? (double)got / nb : 0.0, empty);
+    printf("latency   : mean %.1f us per tick\n", got ? lag_sum / got / 1e3 : 0.0);
+    if (nb) {
+        qsort(lag, nb, sizeof(double), cmp_double);
+        printf("oldest tick per batch, us: p50 %.1f  p99 %.1f  max %.1f\n",
+               lag[nb / 2] / 1e3, lag[(size_t)(nb * 0.99)] / 1e3, lag[nb - 1] / 1e3);
+    }
+    printf("market value after feed: %.2f\n", m.market_value);
+    free(lag);
+    free(syms);
+    pf_feed_close(feed);
+    pf_free(&book);
+    return 0;
+}
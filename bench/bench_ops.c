@@ -0,0 +1,473 @@
+/* bench/bench_ops.c
+ * Microbenchmarks for every hot book operation, at book sizes from 100
+ * to 10M positions.
+ *
+ * Each operation repeats in growing batches until it has run for at
+ * least --min-time seconds, then reports ns/op and ops/sec. Operations
+ * over the whole book (bulk update, metrics, view, save, load) also
+ * report positions per op. Queries pick random held symbols. --latency N
+ * turns on the library's per-operation histograms, timing one call in N,
+ * so running with and without it gives their cost. --counters prints the
+ * hardware counters per operation after each size (timings then include
+ * the counter reads).
+ *
+ * Usage: bench_ops [--sizes N,N,...] [--min-time SEC] [--json FILE|-] [--dir DIR] [--latency N]
+ *                  [--counters]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "portfolio.h"
+
+#define MAX_SIZES 16
+#define NQUERY 4096
+#define MAX_RESULTS 256
+
+typedef struct {
+    const char *op;
+    long positions;
+    long iters;
+    double ns_per_op;
+    double ops_per_sec;
+    long items_per_op;
+} Result;
+
+typedef struct {
+    Portfolio pf;
+    long n;
+    char (*query)[PF_SYMBOL_LEN];   /* NQUERY random held symbols */
+    int *qidx;                      /* and their positions */
+    char path[512];
+} Bench;
+
+static Result results[MAX_RESULTS];
+static int nresults;
+static double min_time = 0.2;
+static int latency;     /* --latency: time one call in this many, 0 = off */
+static int counters;    /* --counters */
+static FILE *report;    /* the text table; stderr when JSON goes to stdout */
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t rng_next(uint64_t *s) {
+    uint64_t z = (*s += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void symbol_of(long i, char *out) {
+    snprintf(out, PF_SYMBOL_LEN, "P%09ld", i);
+}
+
+/* ---------- Operations: run iters times, return seconds ---------- */
+
+typedef double (*op_fn)(Bench *b, long iters);
+
+static volatile long sink;
+
+static double op_find(Bench *b, long iters) {
+    long acc = 0;
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i) acc += pf_find(&b->pf, b->query[i % NQUERY]);
+    double t = now_sec() - t0;
+    sink = acc;
+    return t;
+}
+
+static double op_buy_existing(Bench *b, long iters) {
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i) pf_buy(&b->pf, b->query[i % NQUERY], 1, 101.0, NULL, NULL);
+    return now_sec() - t0;
+}
+
+/* new symbols append; the book is cut back after every few, untimed,
+ * so it never grows by more than 1/16 */
+static double op_buy_new(Bench *b, long iters) {
+    char sym[PF_SYMBOL_LEN];
+    int base = b->pf.count;
+    long batch = b->n / 16 < NQUERY ? (b->n / 16 ? b->n / 16 : 1) : NQUERY;
+    double t = 0.0;
+    for (long done = 0; done < iters;) {
+        long k = iters - done < batch ? iters - done : batch;
+        double t0 = now_sec();
+        for (long i = 0; i < k; ++i) {
+            symbol_of(b->n + i, sym);
+            pf_buy(&b->pf, sym, 1, 101.0, NULL, NULL);
+        }
+        t += now_sec() - t0;
+        b->pf.count = base;
+        pf_holdings_changed(&b->pf);
+        done += k;
+    }
+    return t;
+}
+
+static double op_sell_partial(Bench *b, long iters) {
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i) pf_sell(&b->pf, b->query[i % NQUERY], 1, 99.0, NULL);
+    return now_sec() - t0;
+}
+
+/* sell whole, distinct positions (removal shifts the tail), then
+ * re-append them untimed */
+static double op_sell_full(Bench *b, long iters) {
+    long batch = b->n / 4 < NQUERY ? (b->n / 4 ? b->n / 4 : 1) : NQUERY;
+    uint64_t seed = 42;
+    double t = 0.0;
+    for (long done = 0; done < iters;) {
+        long k = iters - done < batch ? iters - done : batch;
+        Stock *gone = malloc((size_t)k * sizeof(Stock));
+        if (!gone) break;
+        long start = (long)(rng_next(&seed) % (uint64_t)b->pf.count), stride = b->pf.count / k;
+        for (long i = 0; i < k; ++i) gone[i] = b->pf.items[(start + i * stride) % b->pf.count];
+        double t0 = now_sec();
+        for (long i = 0; i < k; ++i) pf_sell(&b->pf, gone[i].symbol, gone[i].qty, 99.0, NULL);
+        t += now_sec() - t0;
+        for (long i = 0; i < k; ++i)
+            pf_add_shares(&b->pf, -1, gone[i].symbol, gone[i].qty, gone[i].buy_price, 0);
+        free(gone);
+        done += k;
+    }
+    return t;
+}
+
+static double op_update_single(Bench *b, long iters) {
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i) pf_update_price(&b->pf, b->query[i % NQUERY], 100.0 + (double)(i & 63));
+    return now_sec() - t0;
+}
+
+/* the same with the sorted views kept up to date (built untimed) */
+static double op_update_sorted(Bench *b, long iters) {
+    if (pf_view_enable(&b->pf) != PF_OK) return 0.0;
+    double t = op_update_single(b, iters);
+    pf_view_disable(&b->pf);
+    return t;
+}
+
+/* one op = a price for every position, as in "update ALL" */
+static double op_update_bulk(Bench *b, long iters) {
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i)
+        for (int j = 0; j < b->pf.count; ++j) pf_set_price(&b->pf, j, 100.0 + (double)((i + j) & 63));
+    return now_sec() - t0;
+}
+
+/* after a price change, so the per-currency sums are recomputed */
+static double op_metrics(Bench *b, long iters) {
+    pf_metrics m;
+    double acc = 0.0;
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i) {
+        pf_holdings_changed(&b->pf);
+        pf_get_metrics(&b->pf, &m);
+        acc += m.market_value;
+    }
+    double t = now_sec() - t0;
+    sink = (long)acc;
+    return t;
+}
+
+static double op_metrics_cached(Bench *b, long iters) {
+    pf_metrics m;
+    double acc = 0.0;
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i) {
+        pf_get_metrics(&b->pf, &m);
+        acc += m.market_value;
+    }
+    double t = now_sec() - t0;
+    sink = (long)acc;
+    return t;
+}
+
+static double op_view(Bench *b, long iters) {
+    FILE *out = fopen("/dev/null", "w");
+    if (!out) return 0.0;
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i) pf_write_view(&b->pf, out);
+    fflush(out);
+    double t = now_sec() - t0;
+    fclose(out);
+    return t;
+}
+
+/* "top 20 losers" from views already built */
+static double op_view_top20(Bench *b, long iters) {
+    int idx[20], got = 0;
+    long acc = 0;
+    if (pf_view_enable(&b->pf) != PF_OK) return 0.0;
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i) {
+        pf_view_range(&b->pf, PF_VIEW_PL, 0, 0, 20, idx, &got);
+        if (got) acc += idx[got - 1];
+    }
+    double t = now_sec() - t0;
+    pf_view_disable(&b->pf);
+    sink = acc;
+    return t;
+}
+
+/* "P0001234*": the ten positions sharing a random symbol's prefix */
+static double op_search_prefix(Bench *b, long iters) {
+    int idx[16], matched = 0;
+    char pat[PF_SYMBOL_LEN + 1];
+    long acc = 0;
+    if (pf_view_enable(&b->pf) != PF_OK) return 0.0;
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i) {
+        snprintf(pat, sizeof(pat), "%.9s*", b->query[i % NQUERY]);
+        pf_search(&b->pf, pat, idx, 16, &matched);
+        acc += matched;
+    }
+    double t = now_sec() - t0;
+    pf_view_disable(&b->pf);
+    sink = acc;
+    return t;
+}
+
+static double op_save(Bench *b, long iters) {
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i) pf_save(&b->pf, b->path);
+    return now_sec() - t0;
+}
+
+static double op_save_data(Bench *b, long iters) {
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i) pf_save_durable(&b->pf, b->path, PF_SYNC_DATA);
+    return now_sec() - t0;
+}
+
+static double op_save_rename(Bench *b, long iters) {
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i) pf_save_durable(&b->pf, b->path, PF_SYNC_NONE);
+    return now_sec() - t0;
+}
+
+/* per request, eight requests to each group commit */
+static double op_save_group8(Bench *b, long iters) {
+    unsigned long ticket;
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i) {
+        pf_commit_request(&b->pf, b->path, &ticket);
+        if ((i & 7) == 7 || i == iters - 1) pf_commit_poll(&b->pf, 0, NULL, NULL);
+    }
+    return now_sec() - t0;
+}
+
+static double op_load(Bench *b, long iters) {
+    Portfolio tmp;
+    pf_init(&tmp);
+    pf_save(&b->pf, b->path);
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i) pf_load(&tmp, b->path, NULL, NULL);
+    double t = now_sec() - t0;
+    pf_free(&tmp);
+    return t;
+}
+
+static double op_save_z(Bench *b, long iters) {
+    b->pf.compress = 1;
+    double t = op_save(b, iters);
+    b->pf.compress = 0;
+    return t;
+}
+
+static double op_load_z(Bench *b, long iters) {
+    b->pf.compress = 1;
+    double t = op_load(b, iters);
+    b->pf.compress = 0;
+    return t;
+}
+
+/* ten price changes, then a delta save of just those rows (base untimed) */
+static double op_save_delta(Bench *b, long iters) {
+    pf_save_delta(&b->pf, b->path, NULL);
+    double t0 = now_sec();
+    for (long i = 0; i < iters; ++i) {
+        for (int k = 0; k < 10; ++k)
+            pf_set_price(&b->pf, b->qidx[(i * 10 + k) % NQUERY], 100.0 + (double)(i & 63));
+        pf_save_delta(&b->pf, b->path, NULL);
+    }
+    double t = now_sec() - t0;
+    pf_bgsave_wait(&b->pf);     /* a merge may still be running */
+    pf_delta_stats ds;
+    pf_delta_get(&b->pf, &ds);
+    char name[600];
+    for (int k = 1; k <= ds.last; ++k) {
+        snprintf(name, sizeof(name), "%s.d%d", b->path, k);
+        unlink(name);
+    }
+    return t;
+}
+
+typedef struct {
+    const char *name;
+    op_fn fn;
+    int whole_book;     /* one op touches every position */
+} Op;
+
+static const Op ops[] = {
+    { "find",            op_find,           0 },
+    { "buy_existing",    op_buy_existing,   0 },
+    { "buy_new",         op_buy_new,        0 },
+    { "sell_partial",    op_sell_partial,   0 },
+    { "sell_full",       op_sell_full,      0 },
+    { "update_single",   op_update_single,  0 },
+    { "update_sorted",   op_update_sorted,  0 },
+    { "update_bulk",     op_update_bulk,    1 },
+    { "metrics",         op_metrics,        1 },
+    { "metrics_cached",  op_metrics_cached, 0 },
+    { "view",            op_view,           1 },
+    { "view_top20",      op_view_top20,     0 },
+    { "search_prefix",   op_search_prefix,  0 },
+    { "save",            op_save,           1 },
+    { "save_data",       op_save_data,      1 },
+    { "save_rename",     op_save_rename,    1 },
+    { "save_group8",     op_save_group8,    1 },
+    { "save_delta",      op_save_delta,     0 },
+    { "load",            op_load,           1 },
+    { "save_z",          op_save_z,         1 },
+    { "load_z",          op_load_z,         1 },
+};
+
+/* ---------- Driver ---------- */
+
+static int setup(Bench *b, long n, const char *dir) {
+    char sym[PF_SYMBOL_LEN];
+    uint64_t seed = 7;
+    memset(b, 0, sizeof(*b));
+    pf_init(&b->pf);
+    if (latency && pf_latency_enable(&b->pf, latency) != PF_OK) return 0;
+    if (counters && pf_counters_enable(&b->pf) != PF_OK) {
+        fprintf(stderr, "hardware counters unavailable\n");
+        return 0;
+    }
+    b->n = n;
+    if (pf_reserve(&b->pf, (int)n + NQUERY) != PF_OK) return 0;
+    for (long i = 0; i < n; ++i) {
+        symbol_of(i, sym);
+        pf_add_shares(&b->pf, -1, sym, 1000000, 100.0, 0);
+    }
+    b->query = malloc(NQUERY * sizeof(*b->query));
+    b->qidx = malloc(NQUERY * sizeof(int));
+    if (!b->query || !b->qidx) return 0;
+    for (int q = 0; q < NQUERY; ++q) {
+        b->qidx[q] = (int)(rng_next(&seed) % (uint64_t)n);
+        symbol_of(b->qidx[q], b->query[q]);
+    }
+    snprintf(b->path, sizeof(b->path), "%s/bench_ops_%d.txt", dir, (int)getpid());
+    return 1;
+}
+
+static void teardown(Bench *b) {
+    unlink(b->path);
+    free(b->query);
+    free(b->qidx);
+    pf_free(&b->pf);
+}
+
+static void run_op(Bench *b, const Op *op) {
+    long iters = 1;
+    double t = op->fn(b, 1);    /* warm-up, also sizes the first batch */
+    while (t < min_time) {
+        long next = t > 0.0 ? (long)(iters * (min_time * 1.2 / t)) : iters * 10;
+        if (next > iters * 100) next = iters * 100;
+        if (next <= iters) next = iters * 2;
+        iters = next;
+        t = op->fn(b, iters);
+    }
+    if (nresults == MAX_RESULTS) return;
+    Result *r = &results[nresults++];
+    r->op = op->name;
+    r->positions = b->n;
+    r->iters = iters;
+    r->ns_per_op = t * 1e9 / iters;
+    r->ops_per_sec = iters / t;
+    r->items_per_op = op->whole_book ? b->n : 1;
+    fprintf(report, "%10ld  %-15s %12ld %14.1f %14.1f", b->n, op->name, iters, r->ns_per_op, r->ops_per_sec);
+    if (op->whole_book) fprintf(report, " %12.0f pos/s", r->ops_per_sec * b->n);
+    fprintf(report, "\n");
+    fflush(report);
+}
+
+static void write_json(FILE *f) {
+    fprintf(f, "{\n  \"benchmark\": \"portfolio-ops\",\n  \"timestamp\": %ld,\n", (long)time(NULL));
+#ifdef __VERSION__
+    fprintf(f, "  \"compiler\": \"%s\",\n", __VERSION__);
+#endif
+    fprintf(f, "  \"min_time_sec\": %g,\n  \"latency_every\": %d,\n  \"results\": [\n", min_time, latency);
+    for (int i = 0; i < nresults; ++i) {
+        const Result *r = &results[i];
+        fprintf(f, "    {\"op\": \"%s\", \"positions\": %ld, \"iters\": %ld, \"ns_per_op\": %.3f, "
+                   "\"ops_per_sec\": %.3f, \"items_per_op\": %ld}%s\n",
+                r->op, r->positions, r->iters, r->ns_per_op, r->ops_per_sec, r->items_per_op,
+                i + 1 < nresults ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+int main(int argc, char **argv) {
+    long sizes[MAX_SIZES] = { 100, 1000, 10000, 100000, 1000000, 10000000 };
+    int nsizes = 6;
+    const char *json = NULL, *dir = "/tmp";
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            nsizes = 0;
+            for (char *p = argv[++i]; *p && nsizes < MAX_SIZES;) {
+                char *end;
+                long v = strtol(p, &end, 10);
+                if (end == p || v < 1 || v > 100000000) { fprintf(stderr, "bad size list\n"); return 1; }
+                sizes[nsizes++] = v;
+                p = *end == ',' ? end + 1 : end;
+            }
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            min_time = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json = argv[++i];
+        } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+            latency = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--counters") == 0) {
+            counters = 1;
+        } else {
+            fprintf(stderr, "usage: %s [--sizes N,N,...] [--min-time SEC] [--json FILE|-] [--dir DIR]\n"
+                            "       [--latency N] [--counters]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    report = json && strcmp(json, "-") == 0 ? stderr : stdout;
+    fprintf(report, "%10s  %-15s %12s %14s %14s\n", "positions", "op", "iters", "ns/op", "ops/s");
+    for (int s = 0; s < nsizes; ++s) {
+        Bench b;
+        if (!setup(&b, sizes[s], dir)) {
+            fprintf(report, "%10ld  skipped: out of memory\n", sizes[s]);
+            teardown(&b);
+            continue;
+        }
+        for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); ++o) run_op(&b, &ops[o]);
+        if (counters) pf_counters_write(&b.pf, report);
+        teardown(&b);
+    }
+
+    if (json) {
+        FILE *f = strcmp(json, "-") == 0 ? stdout : fopen(json, "w");
+        if (!f) { perror(json); return 1; }
+        write_json(f);
+        if (f != stdout) fclose(f);
+    }
+    return 0;
+}
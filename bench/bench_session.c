@@ -0,0 +1,228 @@
+/* bench/bench_session.c
+ * End-to-end session benchmark: runs the real menu program on a command
+ * stream and reports start-up (including load_file), commands/sec
+ * through menu(), and exit (including the auto-save).
+ *
+ * The stream is either a recorded session (portfolio --record FILE) or a
+ * synthetic mix of buys, sells, price updates, metrics and views. Every
+ * run starts from the same generated portfolio.txt in a scratch
+ * directory (or a copy of --book, e.g. from pf_gen); the median of RUNS runs is reported, as text and as JSON
+ * with a fixed schema so results can be compared release over release.
+ *
+ * Usage: bench_session [--prog PATH] [--script FILE | --commands N]
+ *                      [--positions N | --book FILE] [--runs N] [--seed N] [--json FILE|-]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#define SCHEMA_VERSION 1
+#define MAX_RUNS 101
+
+typedef struct {
+    double wall, startup, loop, exit_sec, cps;
+    long commands;
+} Run;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t rng_next(uint64_t *s) {
+    uint64_t z = (*s += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int write_book(const char *path, long positions) {
+    FILE *f = fopen(path, "w");
+    if (!f) return 0;
+    for (long i = 0; i < positions; ++i) fprintf(f, "S%07ld 1000 100 100 USD\n", i);
+    return fclose(f) == 0;
+}
+
+/* copies FROM to PATH; returns the number of positions (lines), -1 on error */
+static long copy_book(const char *path, const char *from) {
+    FILE *in = fopen(from, "r"), *out = in ? fopen(path, "w") : NULL;
+    char buf[1 << 16];
+    size_t n;
+    long lines = 0;
+    int ok = out != NULL;
+    while (ok && (n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        for (size_t i = 0; i < n; ++i) lines += buf[i] == '\n';
+        ok = fwrite(buf, 1, n, out) == n;
+    }
+    if (in) fclose(in);
+    if (out) ok = (fclose(out) == 0) && ok;
+    return ok ? lines : -1;
+}
+
+/* Mix: 30% buy (1 in 10 a new symbol), 20% sell 1 share, 30% single
+ * price update, 19% metrics, 1% view. Returns the number of commands. */
+static long write_synthetic(const char *path, long commands, long positions, uint64_t seed) {
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    long fresh = positions;
+    for (long c = 0; c < commands; ++c) {
+        uint64_t r = rng_next(&seed);
+        int kind = (int)(r % 100);
+        long sym = positions ? (long)((r >> 8) % (uint64_t)positions) : 0;
+        double px = 90.0 + (double)((r >> 40) % 2000) / 100.0;
+        if (kind < 30 || positions == 0) {
+            if (positions == 0 || (r >> 32) % 10 == 0) sym = fresh++;
+            fprintf(f, "2\nS%07ld\n%d\n%.2f\n", sym, 1 + (int)((r >> 20) % 50), px);
+        } else if (kind < 50) {
+            fprintf(f, "3\nS%07ld\n1\n%.2f\n", sym, px);
+        } else if (kind < 80) {
+            fprintf(f, "4\nS%07ld\n%.2f\n", sym, px);
+        } else if (kind < 99) {
+            fprintf(f, "5\n");
+        } else {
+            fprintf(f, "1\n");
+        }
+    }
+    fprintf(f, "0\n");
+    return fclose(f) == 0 ? commands : -1;
+}
+
+/* "key": value lines written by portfolio --stats */
+static int read_stats(const char *path, Run *r) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    char line[512];
+    int found = 0;
+    while (fgets(line, sizeof(line), f)) {
+        found += sscanf(line, " \"startup_sec\": %lf", &r->startup);
+        found += sscanf(line, " \"loop_sec\": %lf", &r->loop);
+        found += sscanf(line, " \"exit_sec\": %lf", &r->exit_sec);
+        found += sscanf(line, " \"commands\": %ld", &r->commands);
+        found += sscanf(line, " \"commands_per_sec\": %lf", &r->cps);
+    }
+    fclose(f);
+    return found == 5;
+}
+
+static int run_once(const char *prog, const char *dir, const char *script, Run *r) {
+    char stats[600];
+    snprintf(stats, sizeof(stats), "%s/stats.json", dir);
+    unlink(stats);
+    double t0 = now_sec();
+    pid_t pid = fork();
+    if (pid < 0) return 0;
+    if (pid == 0) {
+        int in = open(script, O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if (in < 0 || out < 0 || chdir(dir) != 0) _exit(127);
+        dup2(in, 0);
+        dup2(out, 1);
+        execl(prog, prog, "--stats", stats, (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return 0;
+    r->wall = now_sec() - t0;
+    return read_stats(stats, r);
+}
+
+static double median_of(const Run *runs, int n, size_t off) {
+    double v[MAX_RUNS];
+    for (int i = 0; i < n; ++i) v[i] = *(const double *)((const char *)&runs[i] + off);
+    qsort(v, (size_t)n, sizeof(double), cmp_double);
+    return v[n / 2];
+}
+
+int main(int argc, char **argv) {
+    const char *prog = "build/portfolio", *script_in = NULL, *book_in = NULL, *json = NULL;
+    long commands = 20000, positions = 10000;
+    int runs = 5;
+    uint64_t seed = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i], *v = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!v) goto usage;
+        if (strcmp(a, "--prog") == 0) prog = v;
+        else if (strcmp(a, "--script") == 0) script_in = v;
+        else if (strcmp(a, "--commands") == 0) commands = atol(v);
+        else if (strcmp(a, "--positions") == 0) positions = atol(v);
+        else if (strcmp(a, "--book") == 0) book_in = v;
+        else if (strcmp(a, "--runs") == 0) runs = atoi(v);
+        else if (strcmp(a, "--seed") == 0) seed = strtoull(v, NULL, 10);
+        else if (strcmp(a, "--json") == 0) json = v;
+        else goto usage;
+        ++i;
+    }
+    if (commands < 1 || positions < 0 || runs < 1 || runs > MAX_RUNS) goto usage;
+
+    char absprog[4096];
+    if (prog[0] != '/' && getcwd(absprog, sizeof(absprog))) {
+        size_t n = strlen(absprog);
+        snprintf(absprog + n, sizeof(absprog) - n, "/%s", prog);
+        prog = absprog;
+    }
+    char dir[] = "/tmp/pf_session_XXXXXX";
+    if (!mkdtemp(dir)) { perror("mkdtemp"); return 1; }
+    char book[600], script[600], stats[600], fx[600];
+    snprintf(book, sizeof(book), "%s/portfolio.txt", dir);
+    snprintf(script, sizeof(script), "%s/session.in", dir);
+    snprintf(stats, sizeof(stats), "%s/stats.json", dir);
+    snprintf(fx, sizeof(fx), "%s/fx.txt", dir);
+    const char *input = script_in ? script_in : script;
+    if (!script_in && write_synthetic(script, commands, positions, seed) < 0) { perror(script); return 1; }
+
+    FILE *report = json && strcmp(json, "-") == 0 ? stderr : stdout;
+    Run r[MAX_RUNS];
+    int ok = 1;
+    for (int i = 0; i < runs && ok; ++i) {
+        if (book_in) ok = (positions = copy_book(book, book_in)) >= 0;
+        else ok = write_book(book, positions);
+        ok = ok && run_once(prog, dir, input, &r[i]);
+        if (ok) fprintf(report, "run %d: startup %.2f ms, %ld commands at %.0f/s, exit %.2f ms, wall %.1f ms\n",
+                        i + 1, r[i].startup * 1e3, r[i].commands, r[i].cps, r[i].exit_sec * 1e3, r[i].wall * 1e3);
+    }
+    unlink(book); unlink(script); unlink(stats); unlink(fx);
+    rmdir(dir);
+    if (!ok) { fprintf(stderr, "session failed: %s\n", prog); return 1; }
+
+    double startup = median_of(r, runs, offsetof(Run, startup));
+    double loop = median_of(r, runs, offsetof(Run, loop));
+    double exit_sec = median_of(r, runs, offsetof(Run, exit_sec));
+    double cps = median_of(r, runs, offsetof(Run, cps));
+    double wall = median_of(r, runs, offsetof(Run, wall));
+    fprintf(report, "median of %d: startup %.2f ms, %.0f commands/s, exit %.2f ms, wall %.1f ms\n",
+            runs, startup * 1e3, cps, exit_sec * 1e3, wall * 1e3);
+
+    if (json) {
+        FILE *f = strcmp(json, "-") == 0 ? stdout : fopen(json, "w");
+        if (!f) { perror(json); return 1; }
+        fprintf(f, "{\n  \"benchmark\": \"portfolio-session\",\n  \"schema\": %d,\n", SCHEMA_VERSION);
+        fprintf(f, "  \"timestamp\": %ld,\n", (long)time(NULL));
+        fprintf(f, "  \"workload\": {\"script\": \"%s\", \"commands\": %ld, \"positions\": %ld, \"seed\": %llu},\n",
+                script_in ? script_in : "synthetic", r[0].commands, positions, (unsigned long long)seed);
+        fprintf(f, "  \"runs\": %d,\n", runs);
+        fprintf(f, "  \"median\": {\"startup_ms\": %.4f, \"loop_sec\": %.6f, \"commands_per_sec\": %.1f, "
+                   "\"exit_ms\": %.4f, \"wall_ms\": %.4f}\n}\n",
+                startup * 1e3, loop, cps, exit_sec * 1e3, wall * 1e3);
+        if (f != stdout) fclose(f);
+    }
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [--prog PATH] [--script FILE | --commands N] [--positions N | --book FILE] "
+                    "[--runs N] [--seed N] [--json FILE|-]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,399 @@
+/* bench/pf_gen.c
+ * Deterministic synthetic workload generator for load tests.
+ *
+ * Produces a starting book (portfolio.txt format) and a stream of buys,
+ * sells and price updates as a menu script, daemon requests or feed
+ * ticks. The same seed and options give byte-identical output for any
+ * thread count.
+ *
+ * - Symbol popularity is Zipf(s), drawn in O(1) from an alias table over
+ *   a seeded shuffle of the symbols.
+ * - Prices follow a geometric Brownian motion per symbol, sampled at the
+ *   exact event times. The stream is cut into fixed chunks. Each
+ *   symbol's walk is first drawn at chunk boundaries, with counter-based
+ *   draws so any chunk can be computed alone. Inside a chunk, a Brownian
+ *   bridge fills in between those points, so threads never wait on each
+ *   other.
+ * - Chunks are generated in parallel and written in order.
+ *
+ * Usage: pf_gen [--seed N] [--symbols N] [--events N] [--zipf S]
+ *               [--buy F] [--sell F] [--days D] [--format menu|server|ticks]
+ *               [--out FILE|-] [--book FILE] [--threads N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define SYMBOL_LEN 16
+#define MAX_THREADS 64
+#define MIN_CHUNK (1L << 16)
+#define MAX_CHUNK (1L << 22)
+#define EVENT_BYTES 48              /* upper bound of one formatted event */
+#define MEMORY_BUDGET (512L << 20)  /* buffers + per-thread walk state */
+#define BOOK_QTY 1000000
+#define TRADING_DAYS 252
+
+enum { FMT_MENU, FMT_SERVER, FMT_TICKS };
+
+typedef struct {
+    uint64_t seed;
+    long nsym;
+    long long nevents;
+    double zipf, buy, sell, days;
+    int format;
+    long chunk;                     /* events per chunk */
+    char (*sym)[SYMBOL_LEN];
+    uint8_t *symlen;
+    double *x0;                     /* log price at the start */
+    double *sig;                    /* log-price volatility per chunk of events */
+    double *prob;                   /* alias table over popularity ranks */
+    uint32_t *alias;
+    uint32_t *rank_sym;             /* popularity rank -> symbol */
+} Gen;
+
+typedef struct {
+    const Gen *g;
+    long long c;                    /* chunk index */
+    const double *xa, *xb;          /* log prices at the chunk's start and end */
+    double *u, *x;                  /* bridge state per symbol */
+    long long *seen;                /* chunk that last touched the symbol, +1 */
+    char *buf;
+    size_t len;
+} ChunkJob;
+
+typedef struct {
+    const Gen *g;
+    long long c0;
+    int nchunk;
+    double *xs;                     /* (nchunk + 1) x nsym, row 0 filled */
+    long s0, s1;
+} WalkJob;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* splitmix64 */
+static uint64_t rng_next(uint64_t *s) {
+    uint64_t z = (*s += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double unit(uint64_t r) { return ((double)(r >> 11) + 0.5) * (1.0 / 9007199254740992.0); }
+
+static double gauss(uint64_t *s) {
+    double a = unit(rng_next(s)), b = unit(rng_next(s));
+    return sqrt(-2.0 * log(a)) * cos(6.283185307179586 * b);
+}
+
+/* ---------- Set-up: symbols, prices, popularity ---------- */
+
+static int build(Gen *g) {
+    long n = g->nsym;
+    uint64_t s = g->seed ^ 0x51A7E5EEDULL;
+    g->sym = malloc((size_t)n * SYMBOL_LEN);
+    g->symlen = malloc((size_t)n);
+    g->x0 = malloc((size_t)n * sizeof(double));
+    g->sig = malloc((size_t)n * sizeof(double));
+    g->prob = malloc((size_t)n * sizeof(double));
+    g->alias = malloc((size_t)n * sizeof(uint32_t));
+    g->rank_sym = malloc((size_t)n * sizeof(uint32_t));
+    uint32_t *small = malloc((size_t)n * sizeof(uint32_t)), *large = malloc((size_t)n * sizeof(uint32_t));
+    if (!g->sym || !g->symlen || !g->x0 || !g->sig || !g->prob || !g->alias || !g->rank_sym ||
+        !small || !large) {
+        free(small); free(large);
+        return 0;
+    }
+
+    /* tickers: shortest all-letter names, at least three letters; "ALL"
+     * is skipped since the menu's price update reads it as every position */
+    int len = 3;
+    for (double cap = 26.0 * 26 * 26; cap < n + 1; cap *= 26) ++len;
+    double chunk_years = g->days / TRADING_DAYS * (double)g->chunk / (double)g->nevents;
+    for (long i = 0, code = 0; i < n; ++i, ++code) {
+        do {
+            long v = code;
+            for (int k = len - 1; k >= 0; --k) { g->sym[i][k] = (char)('A' + v % 26); v /= 26; }
+            g->sym[i][len] = '\0';
+        } while (strcmp(g->sym[i], "ALL") == 0 && ++code);
+        g->symlen[i] = (uint8_t)len;
+        g->x0[i] = log(5.0) + unit(rng_next(&s)) * log(100.0);          /* 5 .. 500 */
+        g->sig[i] = (0.15 + 0.45 * unit(rng_next(&s))) * sqrt(chunk_years);  /* 15-60%/yr */
+    }
+
+    /* popularity ranks land on a seeded shuffle of the symbols */
+    for (long i = 0; i < n; ++i) g->rank_sym[i] = (uint32_t)i;
+    for (long i = n - 1; i > 0; --i) {
+        long j = (long)(rng_next(&s) % (uint64_t)(i + 1));
+        uint32_t t = g->rank_sym[i]; g->rank_sym[i] = g->rank_sym[j]; g->rank_sym[j] = t;
+    }
+
+    /* Vose alias table for P(rank k) ~ 1 / (k + 1)^s */
+    double total = 0.0;
+    for (long k = 0; k < n; ++k) total += pow((double)(k + 1), -g->zipf);
+    long ns = 0, nl = 0;
+    for (long k = 0; k < n; ++k) {
+        g->prob[k] = pow((double)(k + 1), -g->zipf) * n / total;
+        if (g->prob[k] < 1.0) small[ns++] = (uint32_t)k; else large[nl++] = (uint32_t)k;
+    }
+    while (ns && nl) {
+        uint32_t a = small[--ns], b = large[nl - 1];
+        g->alias[a] = b;
+        g->prob[b] -= 1.0 - g->prob[a];
+        if (g->prob[b] < 1.0) { --nl; small[ns++] = b; }
+    }
+    while (nl) g->prob[large[--nl]] = 1.0;
+    while (ns) g->prob[small[--ns]] = 1.0;
+    free(small);
+    free(large);
+    return 1;
+}
+
+static int write_book(const Gen *g, const char *fname) {
+    FILE *f = fopen(fname, "w");
+    if (!f) return 0;
+    for (long i = 0; i < g->nsym; ++i) {
+        double p = exp(g->x0[i]);
+        fprintf(f, "%s %d %.2f %.2f USD\n", g->sym[i], BOOK_QTY, p, p);
+    }
+    return fclose(f) == 0;
+}
+
+/* ---------- Chunk boundaries: counter-based coarse walk ---------- */
+
+static void *walk_range(void *p) {
+    WalkJob *w = p;
+    const Gen *g = w->g;
+    for (long s = w->s0; s < w->s1; ++s) {
+        for (int j = 0; j < w->nchunk; ++j) {
+            uint64_t st = g->seed ^ ((uint64_t)s * 0xD1B54A32D192ED03ULL) ^
+                          ((uint64_t)(w->c0 + j) * 0x8CB92BA72F3D8DD7ULL);
+            double sg = g->sig[s];
+            w->xs[(size_t)(j + 1) * g->nsym + s] = w->xs[(size_t)j * g->nsym + s] - 0.5 * sg * sg + sg * gauss(&st);
+        }
+    }
+    return NULL;
+}
+
+/* ---------- Events ---------- */
+
+static char *put_u64(char *p, uint64_t v) {
+    char tmp[20];
+    int n = 0;
+    do { tmp[n++] = (char)('0' + v % 10); v /= 10; } while (v);
+    while (n) *p++ = tmp[--n];
+    return p;
+}
+
+static char *put_price(char *p, double px) {
+    if (!(px < 1e9)) px = 1e9;
+    uint64_t c = (uint64_t)(px * 100.0 + 0.5);
+    if (c == 0) c = 1;
+    p = put_u64(p, c / 100);
+    *p++ = '.';
+    *p++ = (char)('0' + (c / 10) % 10);
+    *p++ = (char)('0' + c % 10);
+    return p;
+}
+
+static char *put_sym(char *p, const Gen *g, uint32_t s) {
+    memcpy(p, g->sym[s], g->symlen[s]);
+    return p + g->symlen[s];
+}
+
+static void *gen_chunk(void *arg) {
+    ChunkJob *j = arg;
+    const Gen *g = j->g;
+    long long first = j->c * g->chunk;
+    long n = (long)(g->nevents - first < g->chunk ? g->nevents - first : g->chunk);
+    uint64_t st = g->seed ^ 0xC4E6D1E5ULL ^ ((uint64_t)j->c * 0x9E3779B97F4A7C15ULL);
+    double buy_cut = g->buy, sell_cut = g->buy + g->sell;
+    char *p = j->buf;
+
+    for (long k = 0; k < n; ++k) {
+        uint64_t r = rng_next(&st);
+        uint32_t rank = (uint32_t)(((r >> 32) * (uint64_t)g->nsym) >> 32);
+        if (unit(r << 21) >= g->prob[rank]) rank = g->alias[rank];
+        uint32_t s = g->rank_sym[rank];
+
+        /* bridge from the symbol's last sample toward the chunk's end */
+        double u = (double)(k + 1) / (double)g->chunk;
+        if (j->seen[s] != j->c + 1) { j->seen[s] = j->c + 1; j->u[s] = 0.0; j->x[s] = j->xa[s]; }
+        double u0 = j->u[s], x0 = j->x[s], rest = 1.0 - u0;
+        double mean = x0 + (u - u0) / rest * (j->xb[s] - x0);
+        double var = g->sig[s] * g->sig[s] * (u - u0) * (1.0 - u) / rest;
+        double x = mean + (var > 0.0 ? sqrt(var) * gauss(&st) : 0.0);
+        j->u[s] = u;
+        j->x[s] = x;
+        double px = exp(x);
+
+        double kind = unit(rng_next(&st));
+        int qty = 1 + (int)exp(unit(r << 42) * 6.2);     /* 1 .. ~500, log-uniform */
+        if (g->format == FMT_TICKS) {
+            p = put_sym(p, g, s); *p++ = ' '; p = put_price(p, px); *p++ = '\n';
+        } else if (kind < sell_cut) {
+            int is_buy = kind < buy_cut;
+            if (g->format == FMT_MENU) {
+                *p++ = is_buy ? '2' : '3'; *p++ = '\n';
+                p = put_sym(p, g, s); *p++ = '\n';
+                p = put_u64(p, (uint64_t)qty); *p++ = '\n';
+            } else {
+                memcpy(p, is_buy ? "BUY " : "SELL ", is_buy ? 4 : 5); p += is_buy ? 4 : 5;
+                p = put_sym(p, g, s); *p++ = ' ';
+                p = put_u64(p, (uint64_t)qty); *p++ = ' ';
+            }
+            p = put_price(p, px); *p++ = '\n';
+        } else if (g->format == FMT_MENU) {
+            *p++ = '4'; *p++ = '\n';
+            p = put_sym(p, g, s); *p++ = '\n';
+            p = put_price(p, px); *p++ = '\n';
+        } else {
+            memcpy(p, "PRICE ", 6); p += 6;
+            p = put_sym(p, g, s); *p++ = ' ';
+            p = put_price(p, px); *p++ = '\n';
+        }
+    }
+    j->len = (size_t)(p - j->buf);
+    return NULL;
+}
+
+/* ---------- Driver ---------- */
+
+static int num_threads(void) {
+    const char *env = getenv("PF_THREADS");
+    long n = env ? strtol(env, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > MAX_THREADS) n = MAX_THREADS;
+    return (int)n;
+}
+
+static void run_all(void *(*fn)(void *), void *jobs, size_t size, int n) {
+    pthread_t tid[MAX_THREADS];
+    int started[MAX_THREADS];
+    for (int i = 1; i < n; ++i)
+        started[i] = pthread_create(&tid[i], NULL, fn, (char *)jobs + i * size) == 0;
+    fn(jobs);
+    for (int i = 1; i < n; ++i) {
+        if (started[i]) pthread_join(tid[i], NULL);
+        else fn((char *)jobs + i * size);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--seed N] [--symbols N] [--events N] [--zipf S] [--buy F] [--sell F]\n"
+                    "       [--days D] [--format menu|server|ticks] [--out FILE|-] [--book FILE] [--threads N]\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    Gen g;
+    memset(&g, 0, sizeof(g));
+    g.seed = 1; g.nsym = 1000; g.nevents = 1000000;
+    g.zipf = 1.1; g.buy = 0.20; g.sell = 0.15; g.days = 1.0;
+    const char *out = "-", *book = NULL;
+    int threads = num_threads();
+
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i], *v = i + 1 < argc ? argv[++i] : NULL;
+        if (!v) { usage(argv[0]); return 1; }
+        if (strcmp(a, "--seed") == 0) g.seed = strtoull(v, NULL, 10);
+        else if (strcmp(a, "--symbols") == 0) g.nsym = atol(v);
+        else if (strcmp(a, "--events") == 0) g.nevents = atoll(v);
+        else if (strcmp(a, "--zipf") == 0) g.zipf = atof(v);
+        else if (strcmp(a, "--buy") == 0) g.buy = atof(v);
+        else if (strcmp(a, "--sell") == 0) g.sell = atof(v);
+        else if (strcmp(a, "--days") == 0) g.days = atof(v);
+        else if (strcmp(a, "--out") == 0) out = v;
+        else if (strcmp(a, "--book") == 0) book = v;
+        else if (strcmp(a, "--threads") == 0) threads = atoi(v);
+        else if (strcmp(a, "--format") == 0) {
+            if (strcmp(v, "menu") == 0) g.format = FMT_MENU;
+            else if (strcmp(v, "server") == 0) g.format = FMT_SERVER;
+            else if (strcmp(v, "ticks") == 0) g.format = FMT_TICKS;
+            else { usage(argv[0]); return 1; }
+        } else { usage(argv[0]); return 1; }
+    }
+    if (g.nsym < 1 || g.nsym > 100000000 || g.nevents < 0 || g.zipf < 0.0 || g.buy < 0.0 ||
+        g.sell < 0.0 || g.buy + g.sell > 1.0 || g.days <= 0.0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+    /* chunk length depends only on the symbol count, so output does not
+     * depend on the thread count */
+    g.chunk = MIN_CHUNK;
+    while (g.chunk < g.nsym && g.chunk < MAX_CHUNK) g.chunk <<= 1;
+    if (g.nevents == 0 && book == NULL) return 0;
+    if (!build(&g)) { fprintf(stderr, "out of memory\n"); return 1; }
+    if (book && !write_book(&g, book)) { perror(book); return 1; }
+
+    long long nchunks = (g.nevents + g.chunk - 1) / g.chunk;
+    size_t per_thread = (size_t)g.chunk * EVENT_BYTES + (size_t)g.nsym * (3 * sizeof(double) + sizeof(long long));
+    int wave = (int)(MEMORY_BUDGET / per_thread);
+    if (wave > threads) wave = threads;
+    if (wave < 1) wave = 1;
+    if (wave > nchunks) wave = (int)(nchunks ? nchunks : 1);
+
+    FILE *f = strcmp(out, "-") == 0 ? stdout : fopen(out, "w");
+    double *xs = malloc((size_t)(wave + 1) * g.nsym * sizeof(double));
+    ChunkJob jobs[MAX_THREADS];
+    WalkJob walks[MAX_THREADS];
+    memset(jobs, 0, sizeof(jobs));
+    int ok = f && xs;
+    for (int t = 0; t < wave && ok; ++t) {
+        jobs[t].u = malloc((size_t)g.nsym * sizeof(double));
+        jobs[t].x = malloc((size_t)g.nsym * sizeof(double));
+        jobs[t].seen = calloc((size_t)g.nsym, sizeof(long long));
+        jobs[t].buf = malloc((size_t)g.chunk * EVENT_BYTES);
+        ok = jobs[t].u && jobs[t].x && jobs[t].seen && jobs[t].buf;
+    }
+    if (!ok) { fprintf(stderr, "out of memory or cannot open %s\n", out); return 1; }
+    memcpy(xs, g.x0, (size_t)g.nsym * sizeof(double));
+
+    double t0 = now_sec();
+    size_t bytes = 0;
+    for (long long c0 = 0; c0 < nchunks && ok; c0 += wave) {
+        int nc = (int)(nchunks - c0 < wave ? nchunks - c0 : wave);
+        int nw = threads < g.nsym ? threads : (int)g.nsym;
+        for (int t = 0; t < nw; ++t) {
+            walks[t] = (WalkJob){ &g, c0, nc, xs, g.nsym * t / nw, g.nsym * (t + 1) / nw };
+        }
+        run_all(walk_range, walks, sizeof(WalkJob), nw);
+        for (int t = 0; t < nc; ++t) {
+            jobs[t].g = &g;
+            jobs[t].c = c0 + t;
+            jobs[t].xa = xs + (size_t)t * g.nsym;
+            jobs[t].xb = xs + (size_t)(t + 1) * g.nsym;
+        }
+        run_all(gen_chunk, jobs, sizeof(ChunkJob), nc);
+        for (int t = 0; t < nc && ok; ++t) {
+            ok = fwrite(jobs[t].buf, 1, jobs[t].len, f) == jobs[t].len;
+            bytes += jobs[t].len;
+        }
+        memcpy(xs, xs + (size_t)nc * g.nsym, (size_t)g.nsym * sizeof(double));
+    }
+    if (g.format == FMT_MENU && ok) ok = fputs("0\n", f) >= 0;
+    if (f != stdout) ok = (fclose(f) == 0) && ok;
+    else fflush(f);
+    double dt = now_sec() - t0;
+
+    fprintf(stderr, "%lld events (%zu bytes) over %ld symbols in %.3f s: %.1f M events/min, %d threads\n",
+            g.nevents, bytes, g.nsym, dt, dt > 0.0 ? g.nevents / dt * 60.0 / 1e6 : 0.0, wave);
+    for (int t = 0; t < wave; ++t) { free(jobs[t].u); free(jobs[t].x); free(jobs[t].seen); free(jobs[t].buf); }
+    free(xs);
+    free(g.sym); free(g.symlen); free(g.x0); free(g.sig); free(g.prob); free(g.alias); free(g.rank_sym);
+    if (!ok) { perror(out); return 1; }
+    return 0;
+}
@@ -0,0 +1,243 @@
+/* bench/pf_loadgen.c
+ * Load generator for portfolio-server.
+ *
+ * Opens CONNECTIONS client sockets and keeps DEPTH pipelined requests in
+ * flight on each for SECONDS, then reports requests/sec and latency
+ * percentiles. Requests mix price updates (70%), buys, sells and metrics
+ * (10% each) over SYMBOLS symbols that are bought up front.
+ *
+ * Usage: pf_loadgen [SOCKET [CONNECTIONS [SECONDS [DEPTH [SYMBOLS]]]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#define MAX_DEPTH 64
+#define REQ_MAX 64
+#define IN_CAP 8192
+#define MAX_EVENTS 512
+
+typedef struct {
+    int fd;
+    uint64_t rng;
+    double sent[MAX_DEPTH];     /* send times of in-flight requests, FIFO */
+    int head, inflight;
+    char in[IN_CAP];
+    size_t in_len;
+    char out[MAX_DEPTH * REQ_MAX];
+    size_t out_len;
+} Client;
+
+typedef struct {
+    double *v;
+    size_t n, cap;
+} Samples;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t rng_next(uint64_t *s) {
+    uint64_t z = (*s += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void sample_add(Samples *s, double x) {
+    if (s->n == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 1 << 20;
+        double *grown = realloc(s->v, cap * sizeof(double));
+        if (!grown) return;
+        s->v = grown;
+        s->cap = cap;
+    }
+    s->v[s->n++] = x;
+}
+
+static int connect_to(const char *path) {
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) { close(fd); return -1; }
+    return fd;
+}
+
+/* one blocking request/response, for setup */
+static int call(int fd, const char *req, char *resp, size_t n) {
+    size_t len = strlen(req), got = 0;
+    if (write(fd, req, len) != (ssize_t)len) return 0;
+    while (got + 1 < n) {
+        ssize_t r = read(fd, resp + got, n - 1 - got);
+        if (r <= 0) return 0;
+        got += (size_t)r;
+        if (resp[got - 1] == '\n') break;
+    }
+    resp[got] = '\0';
+    return strncmp(resp, "OK", 2) == 0;
+}
+
+static void queue_request(Client *c, int nsym, double t) {
+    uint64_t r = rng_next(&c->rng);
+    int sym = (int)((r >> 8) % (uint64_t)nsym);
+    int kind = (int)(r % 10);
+    double price = 50.0 + (double)((r >> 40) % 10000) / 100.0;
+    char *p = c->out + c->out_len;
+    int n;
+    if (kind < 7) n = sprintf(p, "PRICE L%05d %.2f\n", sym, price);
+    else if (kind == 7) n = sprintf(p, "BUY L%05d 1 %.2f\n", sym, price);
+    else if (kind == 8) n = sprintf(p, "SELL L%05d 1 %.2f\n", sym, price);
+    else n = sprintf(p, "METRICS\n");
+    c->out_len += (size_t)n;
+    c->sent[(c->head + c->inflight) % MAX_DEPTH] = t;
+    c->inflight++;
+}
+
+/* returns 0 if the connection failed */
+static int flush(Client *c) {
+    size_t off = 0;
+    while (off < c->out_len) {
+        ssize_t n = write(c->fd, c->out + off, c->out_len - off);
+        if (n > 0) { off += (size_t)n; continue; }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) {
+            /* requests are tiny, so this only happens under extreme load */
+            struct timespec ts = {0, 10000};
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        return 0;
+    }
+    c->out_len = 0;
+    return 1;
+}
+
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "portfolio.sock";
+    int nconn = argc > 2 ? atoi(argv[2]) : 1000;
+    double seconds = argc > 3 ? atof(argv[3]) : 5.0;
+    int depth = argc > 4 ? atoi(argv[4]) : 8;
+    int nsym = argc > 5 ? atoi(argv[5]) : 1000;
+    if (nconn < 1 || seconds <= 0.0 || depth < 1 || depth > MAX_DEPTH || nsym < 1 || nsym > 100000) {
+        fprintf(stderr, "usage: %s [SOCKET [CONNECTIONS [SECONDS [DEPTH<=%d [SYMBOLS]]]]]\n",
+                argv[0], MAX_DEPTH);
+        return 1;
+    }
+    raise_fd_limit();
+
+    /* symbols are held with plenty of shares so sells keep succeeding */
+    int setup = connect_to(path);
+    if (setup < 0) { perror("connect"); return 1; }
+    char req[REQ_MAX], resp[256];
+    for (int s = 0; s < nsym; ++s) {
+        snprintf(req, sizeof(req), "BUY L%05d 1000000 100\n", s);
+        if (!call(setup, req, resp, sizeof(resp))) { fprintf(stderr, "setup failed: %s", resp); return 1; }
+    }
+    close(setup);
+
+    Client *cl = calloc((size_t)nconn, sizeof(Client));
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (!cl || ep < 0) { perror("setup"); return 1; }
+    for (int i = 0; i < nconn; ++i) {
+        cl[i].fd = connect_to(path);
+        if (cl[i].fd < 0) { fprintf(stderr, "connection %d: %s\n", i, strerror(errno)); return 1; }
+        fcntl(cl[i].fd, F_SETFL, O_NONBLOCK);
+        cl[i].rng = 0x5EEDULL + (uint64_t)i;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &cl[i];
+        epoll_ctl(ep, EPOLL_CTL_ADD, cl[i].fd, &ev);
+    }
+
+    Samples lat = {0};
+    long done = 0, errors = 0;
+    double t0 = now_sec(), deadline = t0 + seconds;
+    for (int i = 0; i < nconn; ++i) {
+        for (int d = 0; d < depth; ++d) queue_request(&cl[i], nsym, t0);
+        if (!flush(&cl[i])) { perror("write"); return 1; }
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    double t = t0;
+    int live = nconn;
+    while (live > 0) {
+        int n = epoll_wait(ep, events, MAX_EVENTS, 1000);
+        if (n < 0 && errno != EINTR) break;
+        t = now_sec();
+        for (int e = 0; e < n; ++e) {
+            Client *c = events[e].data.ptr;
+            ssize_t r = read(c->fd, c->in + c->in_len, IN_CAP - c->in_len);
+            if (r <= 0) {
+                if (r < 0 && errno == EAGAIN) continue;
+                fprintf(stderr, "server closed a connection\n");
+                epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+                --live;
+                continue;
+            }
+            c->in_len += (size_t)r;
+            size_t start = 0;
+            char *nl;
+            while ((nl = memchr(c->in + start, '\n', c->in_len - start)) != NULL) {
+                if (c->in[start] != 'O') ++errors;
+                sample_add(&lat, t - c->sent[c->head]);
+                c->head = (c->head + 1) % MAX_DEPTH;
+                c->inflight--;
+                ++done;
+                if (t < deadline) queue_request(c, nsym, t);
+                start = (size_t)(nl - c->in) + 1;
+            }
+            memmove(c->in, c->in + start, c->in_len - start);
+            c->in_len -= start;
+            if (c->out_len && !flush(c)) { perror("write"); return 1; }
+            if (c->inflight == 0) {
+                epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+                --live;
+            }
+        }
+        if (n == 0 && t > deadline + 5.0) break;    /* server stalled */
+    }
+    double elapsed = t - t0;
+
+    printf("%d connections, depth %d, %d symbols, %.2f s\n", nconn, depth, nsym, elapsed);
+    printf("requests  : %ld (%ld errors)\n", done, errors);
+    printf("throughput: %.0f req/s\n", done / elapsed);
+    if (lat.n) {
+        qsort(lat.v, lat.n, sizeof(double), cmp_double);
+        printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+               lat.v[lat.n / 2] * 1e6, lat.v[(size_t)(lat.n * 0.90)] * 1e6,
+               lat.v[(size_t)(lat.n * 0.99)] * 1e6, lat.v[(size_t)(lat.n * 0.999)] * 1e6,
+               lat.v[lat.n - 1] * 1e6);
+    }
+    for (int i = 0; i < nconn; ++i) close(cl[i].fd);
+    free(cl);
+    free(lat.v);
+    return 0;
+}
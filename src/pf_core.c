@@ -0,0 +1,1082 @@
+/* src/pf_core.c
+ * Book, trades, prices, metrics, currencies and snapshot files behind
+ * portfolio.h. No console I/O here: the menu in portfolio.c prints.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#if defined(__linux__) && !defined(PF_NO_COUNTERS)
+#define PF_HAVE_COUNTERS 1
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "portfolio.h"
+#include "pf_internal.h"
+
+#define INITIAL_STOCKS 100
+#define LINE_BUF 128
+#define PATH_BUF 512
+#define LAT_SUB_BITS 5
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((65 - LAT_SUB_BITS) * LAT_SUB)  /* covers all of uint64_t */
+#define LAT_CALIBRATE_NS 2e6
+#define COMMIT_BUSY_US 1000    /* re-poll while a background save holds a commit back */
+
+const char *pf_strerror(pf_status st) {
+    switch (st) {
+        case PF_OK: return "ok";
+        case PF_ERR_INVALID: return "invalid argument";
+        case PF_ERR_NOT_FOUND: return "symbol not found";
+        case PF_ERR_SHARES: return "not enough shares";
+        case PF_ERR_CURRENCY: return "currency mismatch";
+        case PF_ERR_NOMEM: return "out of memory";
+        case PF_ERR_IO: return "file error";
+    }
+    return "unknown error";
+}
+
+/* ---------- Latency: clock and recording ---------- */
+
+/* Counts are in clock ticks (TSC cycles on x86, else nanoseconds) and are
+ * converted at report time at a rate measured once, by pf_latency_enable(). */
+struct pf_latency {
+    uint32_t every, left;   /* time one call in every; left until the next */
+    uint64_t count[PF_OP_COUNT][LAT_BUCKETS];
+    uint64_t n[PF_OP_COUNT], sum[PF_OP_COUNT], max[PF_OP_COUNT];
+    double ns_per_tick;
+};
+
+static double mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static inline uint64_t lat_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (uint64_t)mono_ns();
+#endif
+}
+
+/* values below 2 * LAT_SUB get their own bucket; above, each power of two
+ * is split into LAT_SUB equal buckets */
+static inline int lat_bucket(uint64_t v) {
+    int m = 63 - __builtin_clzll(v | 1);
+    int shift = m > LAT_SUB_BITS ? m - LAT_SUB_BITS : 0;
+    return shift * LAT_SUB + (int)(v >> shift);
+}
+
+static inline void lat_record(struct pf_latency *l, pf_op op, uint64_t t0) {
+    uint64_t d = lat_now() - t0;
+    l->count[op][lat_bucket(d)]++;
+    l->n[op]++;
+    l->sum[op] += d;
+    if (d > l->max[op]) l->max[op] = d;
+}
+
+static inline int lat_sample(struct pf_latency *l) {
+    if (--l->left) return 0;
+    l->left = l->every;
+    return 1;
+}
+
+#ifndef PF_NO_LATENCY
+#define LAT_BEGIN(pf) uint64_t lat_t0 = (pf)->lat && lat_sample((pf)->lat) ? lat_now() : 0
+#define LAT_END(pf, op) do { if (lat_t0) lat_record((pf)->lat, (op), lat_t0); } while (0)
+#else
+#define LAT_BEGIN(pf) do { } while (0)
+#define LAT_END(pf, op) do { } while (0)
+#endif
+
+/* ---------- Hardware counters: group and reads ---------- */
+
+/* One perf_event group per book, counting user-space events of the
+ * thread that enabled it. Events the CPU or VM lacks are left out; the
+ * group is read with one read() before and after each call. */
+struct pf_counters {
+    int fd[PF_CNT_COUNT];       /* -1 when not available */
+    int slot[PF_CNT_COUNT];     /* position in the group read, -1 if absent */
+    int leader, nopen;
+    uint64_t calls[PF_OP_COUNT];
+    uint64_t total[PF_OP_COUNT][PF_CNT_COUNT];
+};
+
+#ifdef PF_HAVE_COUNTERS
+static int counters_read(const struct pf_counters *c, uint64_t *vals) {
+    uint64_t buf[1 + PF_CNT_COUNT];
+    ssize_t want = (ssize_t)((1 + c->nopen) * sizeof(uint64_t));
+    if (read(c->leader, buf, sizeof(buf)) != want) return 0;
+    memcpy(vals, buf + 1, (size_t)c->nopen * sizeof(uint64_t));
+    return 1;
+}
+
+static void counters_add(struct pf_counters *c, pf_op op, const uint64_t *before) {
+    uint64_t after[PF_CNT_COUNT];
+    if (!counters_read(c, after)) return;
+    c->calls[op]++;
+    for (int e = 0; e < PF_CNT_COUNT; ++e)
+        if (c->slot[e] >= 0) c->total[op][e] += after[c->slot[e]] - before[c->slot[e]];
+}
+
+#define CNT_BEGIN(pf) uint64_t cnt_before[PF_CNT_COUNT]; \
+    int cnt_on = (pf)->counters && counters_read((pf)->counters, cnt_before)
+#define CNT_END(pf, op) do { if (cnt_on) counters_add((pf)->counters, (op), cnt_before); } while (0)
+#else
+#define CNT_BEGIN(pf) do { } while (0)
+#define CNT_END(pf, op) do { } while (0)
+#endif
+
+static void commit_free(Portfolio *pf);     /* group commit, with the files */
+
+/* trace span per operation */
+static const struct { const char *name, *cat; } op_span[PF_OP_COUNT] = {
+    [PF_OP_BUY] = { "pf_buy", "update" },
+    [PF_OP_SELL] = { "pf_sell", "update" },
+    [PF_OP_UPDATE] = { "pf_update_price", "update" },
+    [PF_OP_METRICS] = { "pf_get_metrics", "compute" },
+    [PF_OP_VIEW] = { "pf_write_view", "render" },
+    [PF_OP_SAVE] = { "pf_save", "io" },
+    [PF_OP_SAVE_DATA] = { "pf_save_data", "io" },
+    [PF_OP_SAVE_RENAME] = { "pf_save_rename", "io" },
+    [PF_OP_COMMIT] = { "pf_commit", "io" },
+    [PF_OP_SAVE_DELTA] = { "pf_save_delta", "io" },
+    [PF_OP_LOAD] = { "pf_load", "io" },
+    [PF_OP_FIND] = { "pf_find", "lookup" },
+};
+
+/* every public operation: counters and trace outside, so their reads
+ * stay out of the latency they bracket */
+#define OP_BEGIN(pf, op) CNT_BEGIN(pf); \
+    if (pf_trace_on) pf_trace_begin(op_span[op].name, op_span[op].cat); \
+    LAT_BEGIN(pf)
+#define OP_END(pf, op) do { \
+        LAT_END(pf, op); \
+        if (pf_trace_on) pf_trace_end(op_span[op].name, op_span[op].cat); \
+        CNT_END(pf, op); \
+    } while (0)
+
+/* ---------- Book ---------- */
+
+void pf_symbol_upper(char *s) {
+    for (; *s; ++s) *s = (char) toupper((unsigned char)*s);
+}
+
+/* make room for n positions */
+pf_status pf_reserve(Portfolio *pf, int n) {
+    if (n <= pf->capacity) return PF_OK;
+    int cap = pf->capacity ? pf->capacity : INITIAL_STOCKS;
+    while (cap < n) cap *= 2;
+    Stock *grown = pf_mem_realloc(PF_MEM_HOLDINGS, pf->items, (size_t)cap * sizeof(Stock));
+    if (!grown) return PF_ERR_NOMEM;
+    pf->items = grown;
+    pf->capacity = cap;
+    return PF_OK;
+}
+
+void pf_cov_free(CovState *c) {
+    pf_mem_free(c->symbols);
+    pf_mem_free(c->mean);
+    pf_mem_free(c->m2);
+    pf_mem_free(c->last);
+    pf_mem_free(c->pos);
+    memset(c, 0, sizeof(*c));
+}
+
+void pf_init(Portfolio *pf) {
+    memset(pf, 0, sizeof(*pf));
+    memcpy(pf->fx.codes[0], "USD", PF_CCY_LEN);
+    pf->fx.rate[0] = 1.0;
+    pf->fx.conv[0] = 1.0;
+    pf->fx.n = 1;
+}
+
+void pf_free(Portfolio *pf) {
+    pf_load_settle(pf);
+    pf_mem_free(pf->items);
+    pf_mem_free(pf->lat);
+    pf_counters_disable(pf);
+    pf_view_disable(pf);
+    pf_bgsave_free(pf);
+    pf_delta_free(pf);
+    commit_free(pf);
+    pf_cov_free(&pf->cov);
+    memset(pf, 0, sizeof(*pf));
+}
+
+/* Find index by symbol (stored uppercase) */
+static int find_index(const Portfolio *pf, const char *sym) {
+    for (int i = 0; i < pf->count; ++i) {
+        if (strcmp(pf->items[i].symbol, sym) == 0) return i;
+    }
+    return -1;
+}
+
+int pf_find(Portfolio *pf, const char *sym) {
+    pf_load_settle(pf);
+    OP_BEGIN(pf, PF_OP_FIND);
+    int idx = find_index(pf, sym);
+    OP_END(pf, PF_OP_FIND);
+    return idx;
+}
+
+void pf_holdings_changed(Portfolio *pf) {
+    pf_load_settle(pf);
+    pf->fx.agg_valid = 0;
+    if (pf->views) pf_view_invalidate(pf);
+    if (pf->delta) pf_delta_reset(pf);
+}
+
+void pf_row_changed(Portfolio *pf, int idx) {
+    pf_load_settle(pf);
+    pf->fx.agg_valid = 0;
+    if (pf->views) pf_view_updated(pf, idx);
+    if (pf->delta) pf_delta_mark(pf, idx);
+}
+
+static int valid_symbol(const char *sym) {
+    return sym && sym[0] != '\0' && strlen(sym) < PF_SYMBOL_LEN;
+}
+
+static void fill_position(const Portfolio *pf, int idx, pf_position *out) {
+    if (!out) return;
+    memset(out, 0, sizeof(*out));
+    out->index = idx;
+    if (idx < 0) return;
+    out->qty = pf->items[idx].qty;
+    out->buy_price = pf->items[idx].buy_price;
+    out->cur_price = pf->items[idx].cur_price;
+}
+
+/* ---------- Trades & prices ---------- */
+
+/* add q shares at price p to position idx, or append sym as a new
+ * position in currency ccy when idx < 0 */
+int pf_add_shares(Portfolio *pf, int idx, const char *sym, int q, double p, int ccy) {
+    pf_load_settle(pf);
+    pf->fx.agg_valid = 0;
+    if (idx >= 0) {
+        double old_cost = (double)pf->items[idx].qty * pf->items[idx].buy_price;
+        double new_cost = (double)q * p;
+        pf->items[idx].qty += q;
+        pf->items[idx].buy_price = (old_cost + new_cost) / (double)pf->items[idx].qty;
+        pf->items[idx].cur_price = p;
+        if (pf->views) pf_view_updated(pf, idx);
+        if (pf->delta) pf_delta_mark(pf, idx);
+        return idx;
+    }
+    if (pf_reserve(pf, pf->count + 1) != PF_OK) return -1;
+    pf->layout++;
+    snprintf(pf->items[pf->count].symbol, PF_SYMBOL_LEN, "%s", sym);
+    pf->items[pf->count].qty = q;
+    pf->items[pf->count].buy_price = p;
+    pf->items[pf->count].cur_price = p;
+    pf->items[pf->count].ccy = ccy;
+    if (pf->views) pf_view_inserted(pf, pf->count);
+    if (pf->delta) pf_delta_mark(pf, pf->count);
+    return pf->count++;
+}
+
+/* drop zero-quantity positions in one pass, keeping order */
+void pf_compact(Portfolio *pf) {
+    pf_load_settle(pf);
+    int n = 0;
+    for (int i = 0; i < pf->count; ++i)
+        if (pf->items[i].qty != 0) pf->items[n++] = pf->items[i];
+    if (n != pf->count) {
+        pf->layout++;
+        pf_view_invalidate(pf);
+        if (pf->delta) pf_delta_reset(pf);
+    }
+    pf->count = n;
+}
+
+/* take q (<= qty) shares out of position idx at price p */
+int pf_remove_shares(Portfolio *pf, int idx, int q, double p, int keep_empty) {
+    pf_load_settle(pf);
+    pf->fx.agg_valid = 0;
+    pf->items[idx].qty -= q;
+    pf->items[idx].cur_price = p;
+    if (pf->items[idx].qty != 0 || keep_empty) {
+        if (pf->views) pf_view_updated(pf, idx);
+        if (pf->delta) pf_delta_mark(pf, idx);
+        return pf->items[idx].qty == 0;
+    }
+    if (pf->views) pf_view_removed(pf, idx);
+    if (pf->delta) pf_delta_removed(pf, idx);
+    pf->layout++;
+    for (int j = idx; j < pf->count - 1; j++) {
+        pf->items[j] = pf->items[j + 1];
+    }
+    pf->count--;
+    return 1;
+}
+
+static pf_status buy(Portfolio *pf, const char *sym, int qty, double price, const char *ccy,
+                     pf_position *out) {
+    if (!valid_symbol(sym) || qty <= 0 || !(price > 0.0)) return PF_ERR_INVALID;
+    int idx = find_index(pf, sym);
+    int existed = (idx >= 0);
+    if (existed && qty > INT_MAX - pf->items[idx].qty) return PF_ERR_INVALID;  /* the total must fit */
+    int c = existed ? pf->items[idx].ccy : 0;
+    if (ccy && *ccy) {
+        int id = pf_ccy_id(pf, ccy);
+        if (id < 0) return PF_ERR_INVALID;
+        if (existed && id != c) return PF_ERR_CURRENCY;
+        c = id;
+    }
+    idx = pf_add_shares(pf, idx, sym, qty, price, c);
+    if (idx < 0) return PF_ERR_NOMEM;
+    fill_position(pf, idx, out);
+    if (out) out->created = !existed;
+    return PF_OK;
+}
+
+static pf_status sell(Portfolio *pf, const char *sym, int qty, double price, pf_position *out) {
+    if (!valid_symbol(sym) || qty <= 0 || !(price >= 0.0)) return PF_ERR_INVALID;
+    int idx = find_index(pf, sym);
+    if (idx < 0) return PF_ERR_NOT_FOUND;
+    if (qty > pf->items[idx].qty) return PF_ERR_SHARES;
+    int removed = pf_remove_shares(pf, idx, qty, price, 0);
+    fill_position(pf, removed ? -1 : idx, out);
+    if (out) {
+        out->removed = removed;
+        if (removed) out->cur_price = price;
+    }
+    return PF_OK;
+}
+
+static pf_status set_price(Portfolio *pf, int idx, double price) {
+    if (idx < 0 || idx >= pf->count) return PF_ERR_NOT_FOUND;
+    if (!(price > 0.0)) return PF_ERR_INVALID;
+    pf->items[idx].cur_price = price;
+    pf_row_changed(pf, idx);
+    return PF_OK;
+}
+
+pf_status pf_buy(Portfolio *pf, const char *sym, int qty, double price, const char *ccy,
+                 pf_position *out) {
+    pf_load_settle(pf);
+    OP_BEGIN(pf, PF_OP_BUY);
+    pf_status st = buy(pf, sym, qty, price, ccy, out);
+    OP_END(pf, PF_OP_BUY);
+    return st;
+}
+
+pf_status pf_sell(Portfolio *pf, const char *sym, int qty, double price, pf_position *out) {
+    pf_load_settle(pf);
+    OP_BEGIN(pf, PF_OP_SELL);
+    pf_status st = sell(pf, sym, qty, price, out);
+    OP_END(pf, PF_OP_SELL);
+    return st;
+}
+
+pf_status pf_set_price(Portfolio *pf, int idx, double price) {
+    pf_load_settle(pf);
+    OP_BEGIN(pf, PF_OP_UPDATE);
+    pf_status st = set_price(pf, idx, price);
+    OP_END(pf, PF_OP_UPDATE);
+    return st;
+}
+
+pf_status pf_update_price(Portfolio *pf, const char *sym, double price) {
+    pf_load_settle(pf);
+    OP_BEGIN(pf, PF_OP_UPDATE);
+    pf_status st = valid_symbol(sym) ? set_price(pf, find_index(pf, sym), price) : PF_ERR_INVALID;
+    OP_END(pf, PF_OP_UPDATE);
+    return st;
+}
+
+pf_status pf_get_metrics(Portfolio *pf, pf_metrics *out) {
+    if (!out) return PF_ERR_INVALID;
+    pf_load_settle(pf);
+    OP_BEGIN(pf, PF_OP_METRICS);
+    memset(out, 0, sizeof(*out));
+    pf_fx_aggregate(pf);
+    for (int c = 0; c < pf->fx.n; ++c) {
+        out->cost += pf->fx.cost[c] * pf->fx.conv[c];
+        out->market_value += pf->fx.mv[c] * pf->fx.conv[c];
+    }
+    out->unrealized = out->market_value - out->cost;
+    out->return_pct = (out->cost == 0.0) ? 0.0 : (out->unrealized / out->cost) * 100.0;
+    out->positions = pf->count;
+    OP_END(pf, PF_OP_METRICS);
+    return PF_OK;
+}
+
+/* ---------- Currencies ---------- */
+
+static void fx_refresh(Portfolio *pf) {
+    for (int c = 0; c < pf->fx.n; ++c) pf->fx.conv[c] = pf->fx.rate[c] / pf->fx.rate[pf->fx.base];
+}
+
+static int ccy_find(const Portfolio *pf, const char *code) {
+    for (int c = 0; c < pf->fx.n; ++c)
+        if (strcmp(pf->fx.codes[c], code) == 0) return c;
+    return -1;
+}
+
+/* id for a 3-letter code (case-insensitive), registering it at rate 1 if
+ * new; -1 if the code is malformed or the table is full */
+int pf_ccy_id(Portfolio *pf, const char *code) {
+    char up[PF_CCY_LEN];
+    if (strlen(code) != 3) return -1;
+    for (int i = 0; i < 3; ++i) {
+        if (!isalpha((unsigned char)code[i])) return -1;
+        up[i] = (char)toupper((unsigned char)code[i]);
+    }
+    up[3] = '\0';
+    int c = ccy_find(pf, up);
+    if (c >= 0 || pf->fx.n == PF_MAX_CCY) return c;
+    memcpy(pf->fx.codes[pf->fx.n], up, PF_CCY_LEN);
+    pf->fx.rate[pf->fx.n] = 1.0;
+    pf->fx.conv[pf->fx.n] = pf->fx.rate[pf->fx.n] / pf->fx.rate[pf->fx.base];
+    return pf->fx.n++;
+}
+
+pf_status pf_set_rate(Portfolio *pf, const char *code, double rate) {
+    if (!(rate > 0.0)) return PF_ERR_INVALID;
+    int c = pf_ccy_id(pf, code);
+    if (c < 0) return PF_ERR_INVALID;
+    pf->fx.rate[c] = rate;
+    pf_view_invalidate(pf);     /* market values and P/L are in the base currency */
+    if (c == pf->fx.base) {
+        fx_refresh(pf); /* every conversion is relative to the base */
+    } else {
+        /* only positions in c move: the cached buckets stay valid */
+        pf->fx.conv[c] = pf->fx.rate[c] / pf->fx.rate[pf->fx.base];
+    }
+    return PF_OK;
+}
+
+pf_status pf_set_base(Portfolio *pf, const char *code) {
+    int c = pf_ccy_id(pf, code);
+    if (c < 0) return PF_ERR_INVALID;
+    pf->fx.base = c;
+    fx_refresh(pf);
+    pf_view_invalidate(pf);
+    return PF_OK;
+}
+
+/* bucket holdings by currency: one pass, no conversion per row */
+void pf_fx_aggregate(Portfolio *pf) {
+    pf_load_settle(pf);
+    if (pf->fx.agg_valid) return;
+    for (int c = 0; c < pf->fx.n; ++c) { pf->fx.cost[c] = 0.0; pf->fx.mv[c] = 0.0; pf->fx.npos[c] = 0; }
+    for (int i = 0; i < pf->count; ++i) {
+        int c = pf->items[i].ccy;
+        pf->fx.cost[c] += pf->items[i].buy_price * pf->items[i].qty;
+        pf->fx.mv[c] += pf->items[i].cur_price * pf->items[i].qty;
+        pf->fx.npos[c]++;
+    }
+    pf->fx.agg_valid = 1;
+}
+
+/* ---------- Files ---------- */
+
+static void write_view_header(FILE *out) {
+    fprintf(out, "%-10s %-4s %-6s %-10s %-10s %-12s %-8s\n",
+            "Symbol", "Ccy", "Qty", "Buy", "Cur", "Mkt Value", "P/L%");
+}
+
+static void write_view_row(const Portfolio *pf, int i, FILE *out) {
+    double mv = pf->items[i].cur_price * pf->items[i].qty;
+    double cost = pf->items[i].buy_price * pf->items[i].qty;
+    double pl_pct = (cost == 0.0) ? 0.0 : ((mv - cost) / cost) * 100.0;
+    fprintf(out, "%-10s %-4s %-6d %-10.2f %-10.2f %-12.2f %-7.2f%%\n",
+            pf->items[i].symbol,
+            pf->fx.codes[pf->items[i].ccy],
+            pf->items[i].qty,
+            pf->items[i].buy_price,
+            pf->items[i].cur_price,
+            mv * pf->fx.conv[pf->items[i].ccy],
+            pl_pct);
+}
+
+/* holdings table: prices in the holding's currency, market value in base */
+pf_status pf_write_view(Portfolio *pf, FILE *out) {
+    pf_load_settle(pf);
+    OP_BEGIN(pf, PF_OP_VIEW);
+    write_view_header(out);
+    for (int i = 0; i < pf->count; ++i) write_view_row(pf, i, out);
+    if (pf->fx.n > 1) fprintf(out, "Market values in %s.\n", pf->fx.codes[pf->fx.base]);
+    OP_END(pf, PF_OP_VIEW);
+    return ferror(out) ? PF_ERR_IO : PF_OK;
+}
+
+/* rows in chunks, so a whole-book page needs no book-sized buffer */
+pf_status pf_write_view_sorted(Portfolio *pf, pf_view v, int desc, int first, int n, FILE *out) {
+    int idx[256], got = 0;
+    pf_status st = PF_OK;
+    pf_load_settle(pf);
+    OP_BEGIN(pf, PF_OP_VIEW);
+    write_view_header(out);
+    while (n > 0) {
+        st = pf_view_range(pf, v, desc, first, n < 256 ? n : 256, idx, &got);
+        if (st != PF_OK || got == 0) break;
+        for (int j = 0; j < got; ++j) write_view_row(pf, idx[j], out);
+        first += got;
+        n -= got;
+    }
+    if (pf->fx.n > 1) fprintf(out, "Market values in %s.\n", pf->fx.codes[pf->fx.base]);
+    OP_END(pf, PF_OP_VIEW);
+    if (st != PF_OK) return st;
+    return ferror(out) ? PF_ERR_IO : PF_OK;
+}
+
+pf_status pf_write_view_matching(Portfolio *pf, const char *pattern, FILE *out) {
+    int matched = 0;
+    pf_load_settle(pf);
+    int *idx = pf_mem_alloc(PF_MEM_BUFFERS, (size_t)(pf->count ? pf->count : 1) * sizeof(int));
+    if (!idx) return PF_ERR_NOMEM;
+    OP_BEGIN(pf, PF_OP_VIEW);
+    pf_status st = pf_search(pf, pattern, idx, pf->count, &matched);
+    if (st == PF_OK) {
+        write_view_header(out);
+        for (int j = 0; j < matched; ++j) write_view_row(pf, idx[j], out);
+        if (pf->fx.n > 1) fprintf(out, "Market values in %s.\n", pf->fx.codes[pf->fx.base]);
+    }
+    OP_END(pf, PF_OP_VIEW);
+    pf_mem_free(idx);
+    if (st != PF_OK) return st;
+    return ferror(out) ? PF_ERR_IO : PF_OK;
+}
+
+/* PATH.tmp beside PATH, so the rename stays within one file system */
+FILE *pf_open_temp(const char *path, char *tmp, size_t n) {
+    if (snprintf(tmp, n, "%s.tmp", path) >= (int)n) return NULL;
+    return fopen(tmp, "w");
+}
+
+static int sync_dir(const char *path) {
+    char dir[PATH_BUF];
+    const char *slash = strrchr(path, '/');
+    if (!slash) snprintf(dir, sizeof(dir), ".");
+    else if (slash == path) snprintf(dir, sizeof(dir), "/");
+    else snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return -1;
+    int r = fsync(fd);
+    close(fd);
+    return r;
+}
+
+/* flush and sync the temp file as the level asks, rename it over PATH,
+ * and for PF_SYNC_FULL make the rename itself durable */
+pf_status pf_replace_file(FILE *f, pf_status st, const char *tmp, const char *path, pf_sync level) {
+    if (fflush(f) != 0 || ferror(f)) st = PF_ERR_IO;
+    if (st == PF_OK && level >= PF_SYNC_DATA && fdatasync(fileno(f)) != 0) st = PF_ERR_IO;
+    if (fclose(f) != 0) st = PF_ERR_IO;
+    if (st == PF_OK && rename(tmp, path) != 0) st = PF_ERR_IO;
+    if (st != PF_OK) {
+        unlink(tmp);
+        return st;
+    }
+    return level >= PF_SYNC_FULL && sync_dir(path) != 0 ? PF_ERR_IO : PF_OK;
+}
+
+/* a whole save, header (may be NULL) on the first line; *progress (may
+ * be NULL) counts the rows for pf_persist.c's background saves */
+pf_status pf_save_file(const Portfolio *pf, const char *path, pf_sync level, volatile long *progress,
+                       const char *header) {
+    char tmp[PATH_BUF + 8];
+    FILE *f = pf_open_temp(path, tmp, sizeof(tmp));
+    if (!f) return PF_ERR_IO;
+    if (pf->compress) {
+        struct pf_zwriter *z = pf_zwriter_open(f, header, pf->fx.codes, pf->fx.n);
+        for (int i = 0; z && i < pf->count; ++i) {
+            pf_zwriter_row(z, &pf->items[i], 0);
+            if (progress && (i & 4095) == 4095) *progress = i + 1;
+        }
+        if (progress) *progress = pf->count;
+        pf_status st = !z ? PF_ERR_NOMEM : pf_zwriter_close(z) == 0 ? PF_OK : PF_ERR_IO;
+        return pf_replace_file(f, st, tmp, path, level);
+    }
+    if (header) fputs(header, f);
+    for (int i = 0; i < pf->count; ++i) {
+        fprintf(f, "%s %d %.10g %.10g %s\n",
+                pf->items[i].symbol,
+                pf->items[i].qty,
+                pf->items[i].buy_price,
+                pf->items[i].cur_price,
+                pf->fx.codes[pf->items[i].ccy]);
+        if (progress && (i & 4095) == 4095) *progress = i + 1;
+    }
+    if (progress) *progress = pf->count;
+    return pf_replace_file(f, PF_OK, tmp, path, level);
+}
+
+static pf_status save(Portfolio *pf, const char *path, pf_sync level) {
+    pf_load_settle(pf);
+    if (pf->bgsave) pf_bgsave_wait(pf);    /* or its rename could land after this save */
+    if (pf->delta) pf_delta_overwritten(pf, path);
+    return pf_save_file(pf, path, level, NULL, NULL);
+}
+
+/* one row of a file: 1 loaded, 0 skipped for its currency, -1 out of memory */
+static int load_row(Portfolio *pf, const char *sym, int q, double bp, double cp, const char *code) {
+    int ccy = code[0] ? pf_ccy_id(pf, code) : 0;   /* 4-column files predate currencies */
+    if (ccy < 0) return 0;
+    if (pf_reserve(pf, pf->count + 1) != PF_OK) return -1;
+    Stock *s = &pf->items[pf->count++];
+    snprintf(s->symbol, PF_SYMBOL_LEN, "%s", sym);
+    pf_symbol_upper(s->symbol);
+    s->qty = q;
+    s->buy_price = bp;
+    s->cur_price = cp;
+    s->ccy = ccy;
+    return 1;
+}
+
+static pf_status load_text(Portfolio *pf, FILE *f, int *nload, int *nskip, unsigned long *chain_id,
+                           int *chain_seq) {
+    char line[LINE_BUF];
+    char sym[PF_SYMBOL_LEN];
+    int q;
+    char code[8];
+    double bp, cp;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        code[0] = '\0';
+        if (line[0] == '#') {   /* the base of a delta chain */
+            if (*nload == 0) sscanf(line, "#PF base %lu %d", chain_id, chain_seq);
+            continue;
+        }
+        if (sscanf(line, "%15s %d %lf %lf %7s", sym, &q, &bp, &cp, code) < 4) continue;
+        int r = load_row(pf, sym, q, bp, cp, code);
+        if (r < 0) return PF_ERR_NOMEM;
+        if (r) ++*nload;
+        else ++*nskip;
+    }
+    return PF_OK;
+}
+
+/* after the "PFZ1" magic */
+static pf_status load_compressed(Portfolio *pf, FILE *f, int *nload, int *nskip, unsigned long *chain_id,
+                                 int *chain_seq) {
+    char header[LINE_BUF];
+    struct pf_zreader *z = pf_zreader_open(f, header, sizeof(header));
+    if (!z) return PF_ERR_IO;
+    sscanf(header, "#PF base %lu %d", chain_id, chain_seq);
+    Stock row;
+    const char *code;
+    int removed, r;
+    pf_status st = PF_OK;
+    while ((r = pf_zreader_next(z, &row, &code, &removed)) > 0) {
+        if (removed) continue;
+        r = load_row(pf, row.symbol, row.qty, row.buy_price, row.cur_price, code);
+        if (r < 0) { st = PF_ERR_NOMEM; break; }
+        if (r) ++*nload;
+        else ++*nskip;
+    }
+    if (r < 0 && st == PF_OK) st = PF_ERR_IO;
+    pf_zreader_close(z);
+    return st;
+}
+
+static pf_status load(Portfolio *pf, const char *path, int *loaded, int *skipped) {
+    pf_load_settle(pf);
+    FILE *f = fopen(path, "r");
+    if (!f) return PF_ERR_IO;
+
+    char magic[4];
+    int nload = 0, nskip = 0;
+    unsigned long chain_id = 0;
+    int chain_seq = 0;
+    pf_status st;
+
+    pf->count = 0;
+    pf->layout++;
+    pf_holdings_changed(pf);
+
+    if (fread(magic, 4, 1, f) == 1 && memcmp(magic, "PFZ1", 4) == 0) {
+        st = load_compressed(pf, f, &nload, &nskip, &chain_id, &chain_seq);
+    } else {
+        rewind(f);
+        st = load_text(pf, f, &nload, &nskip, &chain_id, &chain_seq);
+    }
+    fclose(f);
+    if (st == PF_OK && chain_id) {
+        st = pf_delta_replay(pf, path, chain_id, chain_seq, &nskip);
+        nload = pf->count;
+    }
+    if (loaded) *loaded = nload;
+    if (skipped) *skipped = nskip;
+    return st;
+}
+
+pf_status pf_save(Portfolio *pf, const char *path) {
+    return pf_save_durable(pf, path, PF_SYNC_FULL);
+}
+
+pf_status pf_save_durable(Portfolio *pf, const char *path, pf_sync level) {
+    static const pf_op op_of[] = { [PF_SYNC_NONE] = PF_OP_SAVE_RENAME, [PF_SYNC_DATA] = PF_OP_SAVE_DATA,
+                                   [PF_SYNC_FULL] = PF_OP_SAVE };
+    if ((unsigned)level > PF_SYNC_FULL) return PF_ERR_INVALID;
+    pf_op op = op_of[level];
+    OP_BEGIN(pf, op);
+    pf_status st = save(pf, path, level);
+    OP_END(pf, op);
+    return st;
+}
+
+pf_status pf_save_delta(Portfolio *pf, const char *path, int *rows) {
+    OP_BEGIN(pf, PF_OP_SAVE_DELTA);
+    pf_status st = pf_delta_save(pf, path, rows);
+    OP_END(pf, PF_OP_SAVE_DELTA);
+    return st;
+}
+
+pf_status pf_load(Portfolio *pf, const char *path, int *loaded, int *skipped) {
+    OP_BEGIN(pf, PF_OP_LOAD);
+    pf_status st = load(pf, path, loaded, skipped);
+    OP_END(pf, PF_OP_LOAD);
+    return st;
+}
+
+/* pf_persist.c's background loads run pf_load() on the loader thread's
+ * own book: pf gets the time from start to join, and the counts the
+ * loader took for op */
+uint64_t pf_op_start(Portfolio *pf) {
+#ifndef PF_NO_LATENCY
+    return pf->lat && lat_sample(pf->lat) ? lat_now() : 0;
+#else
+    (void)pf;
+    return 0;
+#endif
+}
+
+void pf_op_finish(Portfolio *pf, pf_op op, uint64_t t0, const Portfolio *worker) {
+#ifndef PF_NO_LATENCY
+    if (t0 && pf->lat) lat_record(pf->lat, op, t0);
+#else
+    (void)t0;
+#endif
+    struct pf_counters *c = pf->counters;
+    const struct pf_counters *w = worker->counters;
+    if (!c || !w) return;
+    c->calls[op] += w->calls[op];
+    for (int e = 0; e < PF_CNT_COUNT; ++e)
+        if (c->slot[e] >= 0 && w->slot[e] >= 0) c->total[op][e] += w->total[op][e];
+}
+
+pf_status pf_save_fx(const Portfolio *pf, const char *path) {
+    char tmp[PATH_BUF + 8];
+    FILE *f = pf_open_temp(path, tmp, sizeof(tmp));
+    if (!f) return PF_ERR_IO;
+    for (int c = 0; c < pf->fx.n; ++c) fprintf(f, "%s %.10g\n", pf->fx.codes[c], pf->fx.rate[c]);
+    fprintf(f, "BASE %s\n", pf->fx.codes[pf->fx.base]);
+    return pf_replace_file(f, PF_OK, tmp, path, PF_SYNC_FULL);
+}
+
+pf_status pf_load_fx(Portfolio *pf, const char *path, int *loaded) {
+    FILE *f = fopen(path, "r");
+    if (!f) return PF_ERR_IO;
+    char line[LINE_BUF], code[8], val[32];
+    int n = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "%7s %31s", code, val) != 2 || code[0] == '#') continue;
+        if (strcmp(code, "BASE") == 0 || strcmp(code, "base") == 0) {
+            int c = pf_ccy_id(pf, val);
+            if (c >= 0) pf->fx.base = c;
+            continue;
+        }
+        char *end;
+        double rate = strtod(val, &end);
+        if (end == val || *end != '\0' || !(rate > 0.0)) continue;
+        int c = pf_ccy_id(pf, code);
+        if (c >= 0) { pf->fx.rate[c] = rate; ++n; }
+    }
+    fclose(f);
+    fx_refresh(pf);
+    if (loaded) *loaded = n;
+    return PF_OK;
+}
+
+/* ---------- Group commit ---------- */
+
+struct pf_commit {
+    char path[PATH_BUF];
+    unsigned long issued;       /* last ticket handed out */
+    unsigned long settled;      /* last ticket a save has covered */
+    pf_status last;             /* outcome of the last of those saves */
+    double first_ns;            /* arrival of the oldest waiting request */
+    uint64_t *t0;               /* arrival of each waiting request, in ticks */
+    int n, cap;
+};
+
+static void commit_now(Portfolio *pf, struct pf_commit *c) {
+    c->last = pf_save_durable(pf, c->path, PF_SYNC_FULL);
+#ifndef PF_NO_LATENCY
+    if (pf->lat)
+        for (int i = 0; i < c->n; ++i) lat_record(pf->lat, PF_OP_COMMIT, c->t0[i]);
+#endif
+    c->settled = c->issued;
+    c->n = 0;
+}
+
+static void commit_free(Portfolio *pf) {
+    if (!pf->commit) return;
+    pf_mem_free(pf->commit->t0);
+    pf_mem_free(pf->commit);
+}
+
+pf_status pf_commit_request(Portfolio *pf, const char *path, unsigned long *ticket) {
+    if (!path || strlen(path) >= PATH_BUF || !ticket) return PF_ERR_INVALID;
+    struct pf_commit *c = pf->commit;
+    if (!c) {
+        c = pf_mem_calloc(PF_MEM_BUFFERS, 1, sizeof(*c));
+        if (!c) return PF_ERR_NOMEM;
+        pf->commit = c;
+    }
+    if (c->n == c->cap) {
+        int cap = c->cap ? c->cap * 2 : 16;
+        uint64_t *t0 = pf_mem_realloc(PF_MEM_BUFFERS, c->t0, (size_t)cap * sizeof(*t0));
+        if (!t0) return PF_ERR_NOMEM;
+        c->t0 = t0;
+        c->cap = cap;
+    }
+    if (c->n && strcmp(c->path, path) != 0) commit_now(pf, c);
+    if (c->n == 0) {
+        snprintf(c->path, sizeof(c->path), "%s", path);
+        c->first_ns = mono_ns();
+    }
+    c->t0[c->n++] = lat_now();
+    *ticket = ++c->issued;
+    return PF_OK;
+}
+
+pf_status pf_commit_poll(Portfolio *pf, long window_us, unsigned long *settled, long *wait_us) {
+    struct pf_commit *c = pf->commit;
+    long wait = -1;
+    if (c && c->n) {
+        double left_ns = c->first_ns + window_us * 1e3 - mono_ns();
+        pf_bgsave_stats bs;
+        if (left_ns > 0) wait = (long)(left_ns / 1e3) + 1;
+        else if (pf_bgsave_poll(pf, &bs) == PF_OK && bs.running) wait = COMMIT_BUSY_US;    /* its rename first */
+        else commit_now(pf, c);
+    }
+    if (settled) *settled = c ? c->settled : 0;
+    if (wait_us) *wait_us = wait;
+    return c ? c->last : PF_OK;
+}
+
+/* ---------- Latency: reports ---------- */
+
+#ifndef PF_NO_LATENCY
+/* nanoseconds per tick: the counter against CLOCK_MONOTONIC over
+ * LAT_CALIBRATE_NS. The rate is fixed, so once per enable does. */
+static double lat_calibrate(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    double ns0 = mono_ns(), ns;
+    uint64_t tick0 = lat_now();
+    while ((ns = mono_ns() - ns0) < LAT_CALIBRATE_NS) { }
+    uint64_t ticks = lat_now() - tick0;
+    return ticks ? ns / (double)ticks : 1.0;
+#else
+    return 1.0;     /* lat_now() is in nanoseconds already */
+#endif
+}
+#endif
+
+pf_status pf_latency_enable(Portfolio *pf, int every) {
+#ifdef PF_NO_LATENCY
+    (void)pf;
+    (void)every;
+    return PF_ERR_INVALID;
+#else
+    if (every < 1) return PF_ERR_INVALID;
+    if (!pf->lat) {
+        pf->lat = pf_mem_calloc(PF_MEM_INSTRUMENTATION, 1, sizeof(*pf->lat));
+        if (!pf->lat) return PF_ERR_NOMEM;
+        pf->lat->ns_per_tick = lat_calibrate();
+    }
+    pf->lat->every = (uint32_t)every;
+    pf_latency_reset(pf);
+    return PF_OK;
+#endif
+}
+
+void pf_latency_disable(Portfolio *pf) {
+    pf_mem_free(pf->lat);
+    pf->lat = NULL;
+}
+
+void pf_latency_reset(Portfolio *pf) {
+    if (!pf->lat) return;
+    uint32_t every = pf->lat->every;
+    double ns_per_tick = pf->lat->ns_per_tick;
+    memset(pf->lat, 0, sizeof(*pf->lat));
+    pf->lat->every = pf->lat->left = every;
+    pf->lat->ns_per_tick = ns_per_tick;
+}
+
+const char *pf_op_name(pf_op op) {
+    static const char *names[PF_OP_COUNT] = { "buy", "sell", "update", "metrics", "view", "save",
+                                              "save_data", "save_rename", "commit", "save_delta", "load",
+                                              "find" };
+    return (unsigned)op < PF_OP_COUNT ? names[op] : "?";
+}
+
+/* largest value that lands in bucket b */
+static uint64_t bucket_top(int b) {
+    if (b < 2 * LAT_SUB) return (uint64_t)b;
+    int shift = b / LAT_SUB - 1;
+    uint64_t top = (uint64_t)(b - shift * LAT_SUB);
+    return ((top + 1) << shift) - 1;
+}
+
+static double percentile(const struct pf_latency *l, pf_op op, double q) {
+    uint64_t want = (uint64_t)(q * (double)l->n[op] + 0.5), seen = 0;
+    if (want < 1) want = 1;
+    for (int b = 0; b < LAT_BUCKETS; ++b) {
+        seen += l->count[op][b];
+        if (seen >= want) {
+            uint64_t v = bucket_top(b);
+            return (double)(v < l->max[op] ? v : l->max[op]);
+        }
+    }
+    return (double)l->max[op];
+}
+
+static void fill_stats(const struct pf_latency *l, pf_op op, double scale, pf_latency_stats *out) {
+    memset(out, 0, sizeof(*out));
+    out->count = l->n[op];
+    if (!l->n[op]) return;
+    out->mean_ns = (double)l->sum[op] / (double)l->n[op] * scale;
+    out->p50_ns = percentile(l, op, 0.50) * scale;
+    out->p90_ns = percentile(l, op, 0.90) * scale;
+    out->p99_ns = percentile(l, op, 0.99) * scale;
+    out->p999_ns = percentile(l, op, 0.999) * scale;
+    out->max_ns = (double)l->max[op] * scale;
+}
+
+pf_status pf_latency_get(const Portfolio *pf, pf_op op, pf_latency_stats *out) {
+    if (!pf->lat || !out || (unsigned)op >= PF_OP_COUNT) return PF_ERR_INVALID;
+    fill_stats(pf->lat, op, pf->lat->ns_per_tick, out);
+    return PF_OK;
+}
+
+pf_status pf_latency_write(const Portfolio *pf, FILE *out) {
+    if (!pf->lat) return PF_ERR_INVALID;
+    double scale = pf->lat->ns_per_tick;
+    fprintf(out, "%-8s %10s %10s %10s %10s %10s %10s %10s\n",
+            "Op", "Count", "Mean us", "p50 us", "p90 us", "p99 us", "p99.9 us", "Max us");
+    for (int op = 0; op < PF_OP_COUNT; ++op) {
+        pf_latency_stats st;
+        fill_stats(pf->lat, (pf_op)op, scale, &st);
+        if (!st.count) continue;
+        fprintf(out, "%-8s %10llu %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+                pf_op_name((pf_op)op), st.count, st.mean_ns / 1e3, st.p50_ns / 1e3,
+                st.p90_ns / 1e3, st.p99_ns / 1e3, st.p999_ns / 1e3, st.max_ns / 1e3);
+    }
+    return ferror(out) ? PF_ERR_IO : PF_OK;
+}
+
+/* ---------- Hardware counters: reports ---------- */
+
+const char *pf_counter_name(pf_counter e) {
+    static const char *names[PF_CNT_COUNT] = { "cycles", "instructions", "cache-misses", "branch-misses",
+                                               "task-clock" };
+    return (unsigned)e < PF_CNT_COUNT ? names[e] : "?";
+}
+
+pf_status pf_counters_enable(Portfolio *pf) {
+#ifndef PF_HAVE_COUNTERS
+    (void)pf;
+    return PF_ERR_INVALID;
+#else
+    static const struct { uint32_t type; uint64_t config; } ev[PF_CNT_COUNT] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    };
+    if (pf->counters) return PF_OK;
+    struct pf_counters *c = pf_mem_calloc(PF_MEM_INSTRUMENTATION, 1, sizeof(*c));
+    if (!c) return PF_ERR_NOMEM;
+    c->leader = -1;
+    for (int e = 0; e < PF_CNT_COUNT; ++e) {
+        struct perf_event_attr a;
+        memset(&a, 0, sizeof(a));
+        a.size = sizeof(a);
+        a.type = ev[e].type;
+        a.config = ev[e].config;
+        a.exclude_kernel = 1;
+        a.exclude_hv = 1;
+        a.read_format = PERF_FORMAT_GROUP;
+        c->fd[e] = (int)syscall(SYS_perf_event_open, &a, 0, -1, c->leader, 0);
+        c->slot[e] = c->fd[e] >= 0 ? c->nopen++ : -1;
+        if (c->leader < 0) c->leader = c->fd[e];
+    }
+    if (c->nopen == 0) {
+        pf_mem_free(c);
+        return PF_ERR_IO;
+    }
+    pf->counters = c;
+    return PF_OK;
+#endif
+}
+
+void pf_counters_disable(Portfolio *pf) {
+    struct pf_counters *c = pf->counters;
+    if (!c) return;
+#ifdef PF_HAVE_COUNTERS
+    for (int e = PF_CNT_COUNT - 1; e >= 0; --e)
+        if (c->fd[e] >= 0) close(c->fd[e]);
+#endif
+    pf_mem_free(c);
+    pf->counters = NULL;
+}
+
+void pf_counters_reset(Portfolio *pf) {
+    if (!pf->counters) return;
+    memset(pf->counters->calls, 0, sizeof(pf->counters->calls));
+    memset(pf->counters->total, 0, sizeof(pf->counters->total));
+}
+
+pf_status pf_counters_get(const Portfolio *pf, pf_op op, pf_counter_stats *out) {
+    if (!pf->counters || !out || (unsigned)op >= PF_OP_COUNT) return PF_ERR_INVALID;
+    const struct pf_counters *c = pf->counters;
+    out->calls = c->calls[op];
+    for (int e = 0; e < PF_CNT_COUNT; ++e) {
+        out->available[e] = c->slot[e] >= 0;
+        out->total[e] = c->total[op][e];
+    }
+    return PF_OK;
+}
+
+pf_status pf_counters_write(const Portfolio *pf, FILE *out) {
+    if (!pf->counters) return PF_ERR_INVALID;
+    fprintf(out, "%-8s %10s", "Op", "Calls");
+    for (int e = 0; e < PF_CNT_COUNT; ++e) fprintf(out, " %14s", pf_counter_name((pf_counter)e));
+    fprintf(out, " %6s\n", "IPC");
+    for (int op = 0; op < PF_OP_COUNT; ++op) {
+        pf_counter_stats st;
+        pf_counters_get(pf, (pf_op)op, &st);
+        if (!st.calls) continue;
+        fprintf(out, "%-8s %10llu", pf_op_name((pf_op)op), st.calls);
+        for (int e = 0; e < PF_CNT_COUNT; ++e) {
+            if (st.available[e]) fprintf(out, " %14.1f", (double)st.total[e] / (double)st.calls);
+            else fprintf(out, " %14s", "n/a");
+        }
+        if (st.available[PF_CNT_CYCLES] && st.available[PF_CNT_INSTRUCTIONS] && st.total[PF_CNT_CYCLES])
+            fprintf(out, " %6.2f\n", (double)st.total[PF_CNT_INSTRUCTIONS] / (double)st.total[PF_CNT_CYCLES]);
+        else
+            fprintf(out, " %6s\n", "n/a");
+    }
+    fprintf(out, "Per call; task-clock in ns.\n");
+    return ferror(out) ? PF_ERR_IO : PF_OK;
+}
@@ -0,0 +1,230 @@
+/* src/pf_feed.c
+ * Live price feed: a single-producer/single-consumer tick ring in POSIX
+ * shared memory.
+ *
+ * - head (producer) and tail (consumer) live on separate cache lines;
+ *   each side keeps a private copy of the other's index and re-reads the
+ *   shared one only when the ring looks full or empty.
+ * - The consumer applies a whole batch, then publishes its new tail with
+ *   one release store. No locks and no system calls per tick.
+ * - Ticks name their symbol; the consumer maps it to a position through
+ *   a hash table rebuilt only when the book's layout changes.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "portfolio.h"
+#include "pf_internal.h"
+
+#define FEED_MAGIC 0x50464545444c4931ULL   /* "PFEEDLI1" */
+#define FEED_NAME_LEN 64
+#define CACHE_LINE 64
+
+typedef struct {
+    char symbol[PF_SYMBOL_LEN];
+    double price;
+    uint64_t stamp_ns;      /* CLOCK_MONOTONIC at publish */
+} Tick;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t slots;
+    char pad0[CACHE_LINE - 16];
+    _Atomic uint64_t head;  /* next slot to write */
+    char pad1[CACHE_LINE - 8];
+    _Atomic uint64_t tail;  /* next slot to read */
+    char pad2[CACHE_LINE - 8];
+    Tick ticks[];
+} FeedShm;
+
+struct pf_feed {
+    FeedShm *shm;
+    size_t map_len;
+    uint64_t mask;
+    uint64_t other;         /* producer: cached tail, consumer: cached head */
+    int owner;
+    char name[FEED_NAME_LEN];
+    /* consumer: open-addressing symbol -> position index */
+    int *slot_idx;
+    int nslot;
+    const Portfolio *book;
+    unsigned long layout;
+    int built;
+};
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* shm names need one leading slash */
+static void feed_name(const char *name, char *out) {
+    snprintf(out, FEED_NAME_LEN, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+static pf_status map_feed(pf_feed *f, int fd, size_t len) {
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return PF_ERR_IO;
+    f->shm = p;
+    f->map_len = len;
+    return PF_OK;
+}
+
+pf_status pf_feed_create(const char *name, int slots, pf_feed **out) {
+    if (slots < 2) return PF_ERR_INVALID;
+    uint64_t n = 2;
+    while (n < (uint64_t)slots) n <<= 1;
+    pf_feed *f = pf_mem_calloc(PF_MEM_BUFFERS, 1, sizeof(*f));
+    if (!f) return PF_ERR_NOMEM;
+    feed_name(name, f->name);
+    size_t len = sizeof(FeedShm) + n * sizeof(Tick);
+    shm_unlink(f->name);    /* a stale ring from a crashed run */
+    int fd = shm_open(f->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 || ftruncate(fd, (off_t)len) != 0 || map_feed(f, fd, len) != PF_OK) {
+        if (fd >= 0) { close(fd); shm_unlink(f->name); }
+        pf_mem_free(f);
+        return PF_ERR_IO;
+    }
+    f->shm->slots = n;
+    atomic_store_explicit(&f->shm->head, 0, memory_order_relaxed);
+    atomic_store_explicit(&f->shm->tail, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    f->shm->magic = FEED_MAGIC;
+    f->mask = n - 1;
+    f->owner = 1;
+    *out = f;
+    return PF_OK;
+}
+
+pf_status pf_feed_attach(const char *name, pf_feed **out) {
+    pf_feed *f = pf_mem_calloc(PF_MEM_BUFFERS, 1, sizeof(*f));
+    if (!f) return PF_ERR_NOMEM;
+    feed_name(name, f->name);
+    int fd = shm_open(f->name, O_RDWR, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FeedShm) ||
+        map_feed(f, fd, (size_t)st.st_size) != PF_OK) {
+        if (fd >= 0) close(fd);
+        pf_mem_free(f);
+        return PF_ERR_IO;
+    }
+    if (f->shm->magic != FEED_MAGIC ||
+        sizeof(FeedShm) + f->shm->slots * sizeof(Tick) > f->map_len) {
+        pf_feed_close(f);
+        return PF_ERR_INVALID;
+    }
+    f->mask = f->shm->slots - 1;
+    f->other = atomic_load_explicit(&f->shm->head, memory_order_acquire);
+    *out = f;
+    return PF_OK;
+}
+
+void pf_feed_close(pf_feed *f) {
+    if (!f) return;
+    if (f->shm) munmap(f->shm, f->map_len);
+    if (f->owner) shm_unlink(f->name);
+    pf_mem_free(f->slot_idx);
+    pf_mem_free(f);
+}
+
+int pf_feed_publish(pf_feed *f, const char *sym, double price) {
+    FeedShm *s = f->shm;
+    uint64_t head = atomic_load_explicit(&s->head, memory_order_relaxed);
+    if (head - f->other == s->slots) {
+        f->other = atomic_load_explicit(&s->tail, memory_order_acquire);
+        if (head - f->other == s->slots) return 0;
+    }
+    Tick *t = &s->ticks[head & f->mask];
+    strncpy(t->symbol, sym, PF_SYMBOL_LEN - 1);
+    t->symbol[PF_SYMBOL_LEN - 1] = '\0';
+    t->price = price;
+    t->stamp_ns = mono_ns();
+    atomic_store_explicit(&s->head, head + 1, memory_order_release);
+    return 1;
+}
+
+long pf_feed_pending(const pf_feed *f) {
+    return (long)(atomic_load_explicit(&f->shm->head, memory_order_acquire) -
+                  atomic_load_explicit(&f->shm->tail, memory_order_acquire));
+}
+
+/* ---------- Consumer: symbol lookup ---------- */
+
+static uint32_t sym_hash(const char *s) {
+    uint32_t h = 2166136261u;   /* FNV-1a */
+    for (; *s; ++s) h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+static int build_index(pf_feed *f, const Portfolio *pf) {
+    int n = 16;
+    while (n < pf->count * 2) n <<= 1;
+    if (n != f->nslot) {
+        int *grown = pf_mem_realloc(PF_MEM_INDEX, f->slot_idx, (size_t)n * sizeof(int));
+        if (!grown) return 0;
+        f->slot_idx = grown;
+        f->nslot = n;
+    }
+    for (int i = 0; i < n; ++i) f->slot_idx[i] = -1;
+    for (int i = 0; i < pf->count; ++i) {
+        uint32_t h = sym_hash(pf->items[i].symbol) & (uint32_t)(n - 1);
+        while (f->slot_idx[h] >= 0) h = (h + 1) & (uint32_t)(n - 1);
+        f->slot_idx[h] = i;
+    }
+    f->book = pf;
+    f->layout = pf->layout;
+    f->built = 1;
+    return 1;
+}
+
+static int lookup(const pf_feed *f, const Portfolio *pf, const char *sym) {
+    uint32_t h = sym_hash(sym) & (uint32_t)(f->nslot - 1);
+    for (int i; (i = f->slot_idx[h]) >= 0; h = (h + 1) & (uint32_t)(f->nslot - 1))
+        if (strcmp(pf->items[i].symbol, sym) == 0) return i;
+    return -1;
+}
+
+int pf_feed_poll(pf_feed *f, Portfolio *pf, int max, pf_feed_batch *out) {
+    FeedShm *s = f->shm;
+    pf_load_settle(pf);
+    uint64_t tail = atomic_load_explicit(&s->tail, memory_order_relaxed);
+    if (f->other == tail) f->other = atomic_load_explicit(&s->head, memory_order_acquire);
+    uint64_t avail = f->other - tail;
+    if (max > 0 && avail > (uint64_t)max) avail = (uint64_t)max;
+    if (out) memset(out, 0, sizeof(*out));
+    if (avail == 0) return 0;
+    if ((!f->built || f->book != pf || f->layout != pf->layout) && !build_index(f, pf)) return 0;
+
+    uint64_t now = out ? mono_ns() : 0;
+    int applied = 0;
+    double lag_sum = 0.0;
+    for (uint64_t k = 0; k < avail; ++k) {
+        const Tick *t = &s->ticks[(tail + k) & f->mask];
+        int idx = lookup(f, pf, t->symbol);
+        if (idx >= 0 && t->price > 0.0) {
+            pf->items[idx].cur_price = t->price;
+            pf_row_changed(pf, idx);
+            ++applied;
+        }
+        if (out) lag_sum += (double)(now - t->stamp_ns);
+    }
+    if (out) {
+        out->ticks = (int)avail;
+        out->applied = applied;
+        out->lag_max_ns = (double)(now - s->ticks[tail & f->mask].stamp_ns);
+        out->lag_sum_ns = lag_sum;
+    }
+    atomic_store_explicit(&s->tail, tail + avail, memory_order_release);
+    return (int)avail;
+}
@@ -0,0 +1,142 @@
+/* src/pf_feedhandler.c
+ * Feed handler: publishes prices into the shared-memory ring that
+ * portfolio-server and the menu's "Live prices" consume.
+ *
+ * Usage:
+ *   portfolio-feed NAME [FILE]                      "SYM PRICE" lines from FILE or stdin
+ *   portfolio-feed NAME --walk BOOK [TICKS [RATE]]  random walk on BOOK's symbols
+ *
+ * RATE is ticks/sec (0 = as fast as the consumer drains). A full ring
+ * holds the producer back rather than dropping prices. On exit the
+ * handler waits for the consumer to drain, then removes the ring.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+
+#include "portfolio.h"
+
+#define FEED_SLOTS 65536
+#define LINE_BUF 128
+#define DRAIN_WAIT_SEC 5.0
+
+static volatile sig_atomic_t stop_requested;
+
+static void on_signal(int sig) { (void)sig; stop_requested = 1; }
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t rng_next(uint64_t *s) {
+    uint64_t z = (*s += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* publish, waiting while the ring is full; 0 if interrupted */
+static int publish(pf_feed *f, const char *sym, double price) {
+    while (!pf_feed_publish(f, sym, price)) {
+        if (stop_requested) return 0;
+        sched_yield();
+    }
+    return 1;
+}
+
+static long from_lines(pf_feed *f, FILE *in) {
+    char line[LINE_BUF], sym[PF_SYMBOL_LEN];
+    double price;
+    long n = 0;
+    while (!stop_requested && fgets(line, sizeof(line), in) != NULL) {
+        if (sscanf(line, "%15s %lf", sym, &price) != 2 || price <= 0.0) continue;
+        pf_symbol_upper(sym);
+        if (!publish(f, sym, price)) break;
+        ++n;
+    }
+    return n;
+}
+
+/* multiplicative random walk, about 1% daily-ish moves per tick */
+static long random_walk(pf_feed *f, const Portfolio *book, long ticks, double rate) {
+    int n = book->count;
+    double *px = pf_mem_alloc(PF_MEM_BUFFERS, (size_t)n * sizeof(double));
+    if (!px) return 0;
+    for (int i = 0; i < n; ++i) px[i] = book->items[i].cur_price > 0.0 ? book->items[i].cur_price : 1.0;
+    uint64_t seed = 0xFEEDULL;
+    double t0 = now_sec();
+    long sent = 0;
+    while (!stop_requested && (ticks <= 0 || sent < ticks)) {
+        uint64_t r = rng_next(&seed);
+        int i = (int)(r % (uint64_t)n);
+        double u = (double)(r >> 11) * (1.0 / 9007199254740992.0) - 0.5;
+        px[i] *= exp(0.02 * u);
+        if (!publish(f, book->items[i].symbol, px[i])) break;
+        ++sent;
+        if (rate > 0.0 && (sent & 255) == 0) {
+            double ahead = sent / rate - (now_sec() - t0);
+            if (ahead > 0.0) {
+                struct timespec ts = { (time_t)ahead, (long)((ahead - (time_t)ahead) * 1e9) };
+                nanosleep(&ts, NULL);
+            }
+        }
+    }
+    pf_mem_free(px);
+    return sent;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || (argc > 2 && strcmp(argv[2], "--walk") == 0 && argc < 4)) {
+        fprintf(stderr, "usage: %s NAME [FILE]\n       %s NAME --walk BOOK [TICKS [RATE]]\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    pf_feed *feed;
+    pf_status st = pf_feed_create(argv[1], FEED_SLOTS, &feed);
+    if (st != PF_OK) { fprintf(stderr, "Cannot create feed %s: %s\n", argv[1], pf_strerror(st)); return 1; }
+    fprintf(stderr, "Publishing on %s\n", argv[1]);
+
+    double t0 = now_sec();
+    long sent = 0;
+    if (argc > 2 && strcmp(argv[2], "--walk") == 0) {
+        Portfolio book;
+        pf_init(&book);
+        if (pf_load(&book, argv[3], NULL, NULL) != PF_OK || book.count == 0) {
+            fprintf(stderr, "No symbols in %s\n", argv[3]);
+        } else {
+            sent = random_walk(feed, &book, argc > 4 ? atol(argv[4]) : 0,
+                               argc > 5 ? atof(argv[5]) : 0.0);
+        }
+        pf_free(&book);
+    } else if (argc > 2) {
+        FILE *in = fopen(argv[2], "r");
+        if (!in) { perror(argv[2]); pf_feed_close(feed); return 1; }
+        sent = from_lines(feed, in);
+        fclose(in);
+    } else {
+        sent = from_lines(feed, stdin);
+    }
+    double dt = now_sec() - t0;
+
+    double until = now_sec() + DRAIN_WAIT_SEC;
+    while (!stop_requested && pf_feed_pending(feed) > 0 && now_sec() < until) sched_yield();
+    fprintf(stderr, "Published %ld ticks in %.2f s (%.0f/s), %ld not consumed\n",
+            sent, dt, dt > 0.0 ? sent / dt : 0.0, pf_feed_pending(feed));
+    pf_feed_close(feed);
+    return 0;
+}
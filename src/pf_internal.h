@@ -0,0 +1,72 @@
+/* src/pf_internal.h
+ * Calls between the library's own files. Not part of the API: hidden
+ * from libportfolio.so and free to change along with the files behind
+ * them. One declaration each, so the compiler checks every side.
+ */
+
+#ifndef PF_INTERNAL_H
+#define PF_INTERNAL_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "portfolio.h"
+
+#define PF_HIDDEN __attribute__((visibility("hidden")))
+
+/* ---------- pf_trace.c ---------- */
+
+extern PF_HIDDEN volatile int pf_trace_on;  /* set while a trace runs, for inline checks */
+
+/* ---------- pf_core.c ---------- */
+
+/* pf_save_durable() without the waiting and timing, counting rows into
+ * *progress (may be NULL); header (may be NULL) is the first line */
+PF_HIDDEN pf_status pf_save_file(const Portfolio *pf, const char *path, pf_sync level, volatile long *progress,
+                                 const char *header);
+/* PATH.tmp beside PATH, and its fsync and rename over PATH */
+PF_HIDDEN FILE *pf_open_temp(const char *path, char *tmp, size_t n);
+PF_HIDDEN pf_status pf_replace_file(FILE *f, pf_status st, const char *tmp, const char *path, pf_sync level);
+/* an operation run on another thread's book, timed and counted for pf */
+PF_HIDDEN uint64_t pf_op_start(Portfolio *pf);
+PF_HIDDEN void pf_op_finish(Portfolio *pf, pf_op op, uint64_t t0, const Portfolio *worker);
+
+/* ---------- pf_view.c: keep the sorted views in step with the rows ---------- */
+
+PF_HIDDEN void pf_view_invalidate(Portfolio *pf);
+PF_HIDDEN void pf_view_inserted(Portfolio *pf, int idx);
+PF_HIDDEN void pf_view_updated(Portfolio *pf, int idx);
+PF_HIDDEN void pf_view_removed(Portfolio *pf, int idx);
+
+/* ---------- pf_persist.c: background saves and delta chains ---------- */
+
+PF_HIDDEN void pf_bgsave_free(Portfolio *pf);
+/* first thing in every call that reads or writes rows: join a load
+ * pf_load_start() left running, its status and counts unreported */
+static inline void pf_load_settle(Portfolio *pf) {
+    if (pf->bgload) pf_load_wait(pf, NULL, NULL);
+}
+PF_HIDDEN void pf_delta_mark(Portfolio *pf, int idx);
+PF_HIDDEN void pf_delta_removed(Portfolio *pf, int idx);
+PF_HIDDEN void pf_delta_reset(Portfolio *pf);
+PF_HIDDEN void pf_delta_overwritten(const Portfolio *pf, const char *path);
+PF_HIDDEN pf_status pf_delta_replay(Portfolio *pf, const char *path, unsigned long id, int seq, int *skipped);
+PF_HIDDEN pf_status pf_delta_save(Portfolio *pf, const char *path, int *rows);
+PF_HIDDEN void pf_delta_free(Portfolio *pf);
+
+/* ---------- pf_lz.c: compressed snapshot blocks ---------- */
+
+/* "PFZ1", the header line (may be NULL) and the currency codes rows
+ * index; NULL without memory. Rows after a failed write are dropped and
+ * the failure shows at close (0, or -1). */
+PF_HIDDEN struct pf_zwriter *pf_zwriter_open(FILE *f, const char *header, const char (*codes)[PF_CCY_LEN],
+                                             int ncodes);
+PF_HIDDEN void pf_zwriter_row(struct pf_zwriter *z, const Stock *row, int removed);
+PF_HIDDEN int pf_zwriter_close(struct pf_zwriter *z);
+/* after the magic: the header line into header[n]; next is 1 per row,
+ * 0 at the end, -1 on a corrupt file */
+PF_HIDDEN struct pf_zreader *pf_zreader_open(FILE *f, char *header, size_t n);
+PF_HIDDEN int pf_zreader_next(struct pf_zreader *z, Stock *row, const char **code, int *removed);
+PF_HIDDEN void pf_zreader_close(struct pf_zreader *z);
+
+#endif
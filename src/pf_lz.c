@@ -0,0 +1,413 @@
+/* src/pf_lz.c
+ * Block compression for snapshots and delta files, with no library to
+ * link: an LZ77 coder in the LZ4 mould, and a columnar block layout that
+ * gives it long runs to find.
+ *
+ * - Sequences are a token (literal run, match length), the literals and
+ *   a 16-bit offset; lengths past 15 continue in 255-valued bytes. The
+ *   coder is greedy with one hash probe per position; the decoder is a
+ *   loop of copies, checked against both buffers.
+ * - A compressed file is "PFZ1", the text header line (or nothing), the
+ *   currency codes its rows index into, then blocks of up to
+ *   ZBLOCK_ROWS rows and a zero row count.
+ * - In a block each column is stored whole. Flags and currencies are a
+ *   byte per row; quantities are zigzag varints of the change from the
+ *   row before; buy prices are XORed with the row before and current
+ *   prices with their own buy price, then split into byte planes, so
+ *   the sign, exponent and high mantissa bytes, which rarely change,
+ *   line up as runs; symbols keep the prefix they share with the row
+ *   before and store the rest. Rows stay in book order, unsorted, so
+ *   that pays where neighbours share a stem (share classes, numbered
+ *   series) and costs a byte a row where they do not.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "portfolio.h"
+#include "pf_internal.h"
+
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define ZBLOCK_ROWS 16384
+#define ZROW_MAX (2 + 8 * 2 + 5 + 2 + PF_SYMBOL_LEN)    /* raw bytes per row, at most */
+
+/* ---------- LZ ---------- */
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *put_len(uint8_t *op, size_t len) {
+    for (; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+size_t pf_lz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+/* one sequence; NULL if dst is too small */
+static uint8_t *put_seq(uint8_t *op, const uint8_t *oend, const uint8_t *lit, size_t nlit,
+                        size_t match, size_t offset) {
+    if ((size_t)(oend - op) < nlit + nlit / 255 + match / 255 + 8) return NULL;
+    size_t m = match ? match - LZ_MIN_MATCH : 0;
+    uint8_t *token = op++;
+    *token = (uint8_t)((nlit < 15 ? nlit : 15) << 4);
+    if (nlit >= 15) op = put_len(op, nlit - 15);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (!match) return op;
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    *token |= (uint8_t)(m < 15 ? m : 15);
+    if (m >= 15) op = put_len(op, m - 15);
+    return op;
+}
+
+size_t pf_lz_compress(const void *src, size_t n, void *dst, size_t cap) {
+    const uint8_t *base = src, *ip = base, *anchor = base, *end = base + n;
+    uint8_t *op = dst, *oend = op + cap;
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    while (n >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH) {
+        uint32_t seq = read32(ip);
+        uint32_t h = lz_hash(seq);
+        const uint8_t *ref = base + table[h];
+        table[h] = (uint32_t)(ip - base);
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != seq) {
+            ip += 1 + ((ip - anchor) >> 6);     /* skip faster through what does not compress */
+            continue;
+        }
+        const uint8_t *m = ip + LZ_MIN_MATCH, *r = ref + LZ_MIN_MATCH;
+        while (m < end && *m == *r) ++m, ++r;
+        op = put_seq(op, oend, anchor, (size_t)(ip - anchor), (size_t)(m - ip), (size_t)(ip - ref));
+        if (!op) return 0;
+        ip = anchor = m;
+    }
+    op = put_seq(op, oend, anchor, (size_t)(end - anchor), 0, 0);
+    return op ? (size_t)(op - (uint8_t *)dst) : 0;
+}
+
+/* bytes written, or -1 if src is corrupt or dst too small */
+long pf_lz_decompress(const void *src, size_t n, void *dst, size_t cap) {
+    const uint8_t *ip = src, *iend = ip + n;
+    uint8_t *op = dst, *obase = op, *oend = op + cap;
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            unsigned b;
+            do {
+                if (ip >= iend) return -1;
+                lit += b = *ip++;
+            } while (b == 255);
+        }
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) return -1;
+        if (lit <= 16 && iend - ip >= 16 && oend - op >= 16) memcpy(op, ip, 16);   /* short runs: one copy */
+        else memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend) break;          /* the last sequence has no match */
+        if (iend - ip < 2) return -1;
+        size_t off = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15) {
+            unsigned b;
+            do {
+                if (ip >= iend) return -1;
+                match += b = *ip++;
+            } while (b == 255);
+        }
+        match += LZ_MIN_MATCH;
+        if (off == 0 || off > (size_t)(op - obase) || match > (size_t)(oend - op)) return -1;
+        const uint8_t *r = op - off;
+        uint8_t *mend = op + match;
+        if (off >= 16 && (size_t)(oend - op) >= match + 16) {
+            for (; op < mend; op += 16, r += 16) memcpy(op, r, 16);    /* may run past: rewritten next */
+        } else if (off >= 8 && (size_t)(oend - op) >= match + 8) {
+            for (; op < mend; op += 8, r += 8) memcpy(op, r, 8);
+        } else {
+            while (op < mend) *op++ = *r++;   /* overlapping, or at the end of dst */
+        }
+        op = mend;
+    }
+    return (long)(op - obase);
+}
+
+/* ---------- Columnar blocks ---------- */
+
+static inline uint64_t dbits(double d) {
+    uint64_t u;
+    memcpy(&u, &d, 8);
+    return u;
+}
+
+static inline double bits_d(uint64_t u) {
+    double d;
+    memcpy(&d, &u, 8);
+    return d;
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v) {
+    for (; v >= 0x80; v >>= 7) *p++ = (uint8_t)(v | 0x80);
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v) {
+    uint64_t x = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        x |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) { *v = x; return p; }
+    }
+    return NULL;
+}
+
+struct pf_zwriter {
+    FILE *f;
+    Stock *row;
+    uint8_t *removed;
+    int rows;
+    uint8_t *raw, *comp;
+    int err;
+};
+
+struct pf_zreader {
+    FILE *f;
+    char codes[256][PF_CCY_LEN];
+    int ncodes;
+    Stock *row;
+    uint8_t *removed;
+    int rows, next;
+    uint8_t *raw, *comp;
+};
+
+static size_t block_encode(const struct pf_zwriter *z, uint8_t *raw) {
+    int n = z->rows;
+    uint8_t *p = raw;
+    memcpy(p, z->removed, (size_t)n);
+    p += n;
+    for (int i = 0; i < n; ++i) *p++ = (uint8_t)z->row[i].ccy;
+    uint64_t prev = 0;
+    for (int i = 0; i < n; ++i) {
+        uint64_t b = dbits(z->row[i].buy_price), x = b ^ prev;
+        uint64_t c = dbits(z->row[i].cur_price) ^ b;
+        prev = b;
+        for (int k = 0; k < 8; ++k) {
+            p[(size_t)k * n + i] = (uint8_t)(x >> (56 - 8 * k));
+            p[(size_t)(8 + k) * n + i] = (uint8_t)(c >> (56 - 8 * k));
+        }
+    }
+    p += (size_t)16 * n;
+    int q = 0;
+    for (int i = 0; i < n; ++i) {
+        int64_t d = (int64_t)z->row[i].qty - q;
+        p = put_varint(p, ((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+        q = z->row[i].qty;
+    }
+    const char *last = "";
+    for (int i = 0; i < n; ++i) {
+        const char *s = z->row[i].symbol;
+        size_t shared = 0;
+        while (s[shared] && s[shared] == last[shared]) ++shared;
+        size_t rest = strlen(s + shared);
+        *p++ = (uint8_t)shared;
+        *p++ = (uint8_t)rest;
+        memcpy(p, s + shared, rest);
+        p += rest;
+        last = s;
+    }
+    return (size_t)(p - raw);
+}
+
+static int block_decode(struct pf_zreader *z, const uint8_t *raw, size_t len, int n) {
+    const uint8_t *p = raw, *end = raw + len;
+    if (len < (size_t)18 * n) return -1;
+    memcpy(z->removed, p, (size_t)n);
+    p += n;
+    for (int i = 0; i < n; ++i) {
+        if (*p >= z->ncodes && !z->removed[i]) return -1;
+        z->row[i].ccy = *p++;
+    }
+    uint64_t prev = 0;
+    for (int i = 0; i < n; ++i) {
+        uint64_t x = 0, c = 0;
+        for (int k = 0; k < 8; ++k) {
+            x = x << 8 | p[(size_t)k * n + i];
+            c = c << 8 | p[(size_t)(8 + k) * n + i];
+        }
+        prev ^= x;
+        z->row[i].buy_price = bits_d(prev);
+        z->row[i].cur_price = bits_d(c ^ prev);
+    }
+    p += (size_t)16 * n;
+    int64_t q = 0;
+    for (int i = 0; i < n; ++i) {
+        uint64_t v;
+        if (!(p = get_varint(p, end, &v))) return -1;
+        q += (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+        z->row[i].qty = (int)q;
+    }
+    const char *last = "";
+    for (int i = 0; i < n; ++i) {
+        if (end - p < 2) return -1;
+        size_t shared = p[0], rest = p[1];
+        p += 2;
+        if (shared + rest >= PF_SYMBOL_LEN || rest > (size_t)(end - p) || shared > strlen(last)) return -1;
+        char *s = z->row[i].symbol;
+        memmove(s, last, shared);
+        memcpy(s + shared, p, rest);
+        s[shared + rest] = '\0';
+        p += rest;
+        last = s;
+    }
+    return 0;
+}
+
+static int put_u32(FILE *f, uint32_t v) {
+    return fwrite(&v, 4, 1, f) == 1 ? 0 : -1;
+}
+
+static int get_u32(FILE *f, uint32_t *v) {
+    return fread(v, 4, 1, f) == 1 ? 0 : -1;
+}
+
+static int flush_block(struct pf_zwriter *z) {
+    if (z->rows == 0 || z->err) return z->err;
+    size_t raw = block_encode(z, z->raw);
+    size_t comp = pf_lz_compress(z->raw, raw, z->comp, pf_lz_bound(raw));
+    int stored = comp == 0 || comp >= raw;      /* 0: the block is stored as is */
+    if (put_u32(z->f, (uint32_t)z->rows) || put_u32(z->f, (uint32_t)raw)
+        || put_u32(z->f, stored ? 0 : (uint32_t)comp)
+        || fwrite(stored ? z->raw : z->comp, stored ? raw : comp, 1, z->f) != 1)
+        z->err = -1;
+    z->rows = 0;
+    return z->err;
+}
+
+static void zwriter_free(struct pf_zwriter *z) {
+    pf_mem_free(z->row);
+    pf_mem_free(z->removed);
+    pf_mem_free(z->raw);
+    pf_mem_free(z->comp);
+    pf_mem_free(z);
+}
+
+/* "PFZ1", the header line (may be NULL) and the currency codes rows
+ * index; NULL without memory. A failed write shows at close. */
+struct pf_zwriter *pf_zwriter_open(FILE *f, const char *header, const char (*codes)[PF_CCY_LEN], int ncodes) {
+    struct pf_zwriter *z = pf_mem_calloc(PF_MEM_BUFFERS, 1, sizeof(*z));
+    if (!z) return NULL;
+    z->f = f;
+    z->row = pf_mem_alloc(PF_MEM_BUFFERS, ZBLOCK_ROWS * sizeof(Stock));
+    z->removed = pf_mem_alloc(PF_MEM_BUFFERS, ZBLOCK_ROWS);
+    z->raw = pf_mem_alloc(PF_MEM_BUFFERS, (size_t)ZBLOCK_ROWS * ZROW_MAX);
+    z->comp = pf_mem_alloc(PF_MEM_BUFFERS, pf_lz_bound((size_t)ZBLOCK_ROWS * ZROW_MAX));
+    if (!z->row || !z->removed || !z->raw || !z->comp) {
+        zwriter_free(z);
+        return NULL;
+    }
+    size_t hlen = header ? strlen(header) : 0;
+    uint8_t nc = (uint8_t)ncodes;
+    if (ncodes > 255 || fwrite("PFZ1", 4, 1, f) != 1 || put_u32(f, (uint32_t)hlen) || (hlen && fwrite(header, hlen, 1, f) != 1)
+        || fwrite(&nc, 1, 1, f) != 1 || (nc && fwrite(codes, PF_CCY_LEN, nc, f) != nc))
+        z->err = -1;
+    return z;
+}
+
+/* does nothing once a write has failed */
+void pf_zwriter_row(struct pf_zwriter *z, const Stock *row, int removed) {
+    if (z->err) return;
+    if (z->rows == ZBLOCK_ROWS && flush_block(z)) return;
+    Stock *s = &z->row[z->rows];
+    *s = *row;
+    z->removed[z->rows++] = (uint8_t)(removed != 0);
+    if (removed) {
+        s->qty = s->ccy = 0;
+        s->buy_price = s->cur_price = 0.0;
+    }
+}
+
+/* the last block and the end mark; -1 if anything failed to write */
+int pf_zwriter_close(struct pf_zwriter *z) {
+    if (!z) return -1;
+    int err = flush_block(z);
+    if (!err && put_u32(z->f, 0)) err = -1;
+    zwriter_free(z);
+    return err;
+}
+
+/* after the magic: the header line into header[n] ("" for none) */
+struct pf_zreader *pf_zreader_open(FILE *f, char *header, size_t n) {
+    uint32_t hlen;
+    uint8_t nc;
+    if (get_u32(f, &hlen) || hlen > 4096) return NULL;
+    struct pf_zreader *z = pf_mem_calloc(PF_MEM_BUFFERS, 1, sizeof(*z));
+    if (!z) return NULL;
+    z->f = f;
+    char buf[4096];
+    if ((hlen && fread(buf, hlen, 1, f) != 1) || fread(&nc, 1, 1, f) != 1
+        || (nc && fread(z->codes, PF_CCY_LEN, nc, f) != nc)) {
+        pf_mem_free(z);
+        return NULL;
+    }
+    snprintf(header, n, "%.*s", (int)hlen, buf);
+    z->ncodes = nc;
+    for (int c = 0; c < nc; ++c) z->codes[c][PF_CCY_LEN - 1] = '\0';
+    return z;
+}
+
+/* 1 and the next row (*code its currency), 0 at the end, -1 if corrupt */
+int pf_zreader_next(struct pf_zreader *z, Stock *row, const char **code, int *removed) {
+    if (z->next == z->rows) {
+        uint32_t rows, raw, comp;
+        if (get_u32(z->f, &rows)) return -1;
+        if (rows == 0) return 0;
+        if (rows > ZBLOCK_ROWS || get_u32(z->f, &raw) || get_u32(z->f, &comp)
+            || raw > (size_t)ZBLOCK_ROWS * ZROW_MAX || comp > pf_lz_bound(raw))
+            return -1;
+        if (!z->row) {
+            z->row = pf_mem_alloc(PF_MEM_BUFFERS, ZBLOCK_ROWS * sizeof(Stock));
+            z->removed = pf_mem_alloc(PF_MEM_BUFFERS, ZBLOCK_ROWS);
+            z->raw = pf_mem_alloc(PF_MEM_BUFFERS, (size_t)ZBLOCK_ROWS * ZROW_MAX);
+            z->comp = pf_mem_alloc(PF_MEM_BUFFERS, pf_lz_bound((size_t)ZBLOCK_ROWS * ZROW_MAX));
+            if (!z->row || !z->removed || !z->raw || !z->comp) return -1;
+        }
+        if (comp == 0) {
+            if (fread(z->raw, raw, 1, z->f) != 1) return -1;
+        } else if (fread(z->comp, comp, 1, z->f) != 1
+                   || pf_lz_decompress(z->comp, comp, z->raw, raw) != (long)raw) {
+            return -1;
+        }
+        if (block_decode(z, z->raw, raw, (int)rows) != 0) return -1;
+        z->rows = (int)rows;
+        z->next = 0;
+    }
+    int i = z->next++;
+    *row = z->row[i];
+    *removed = z->removed[i];
+    *code = z->codes[z->row[i].ccy];
+    return 1;
+}
+
+void pf_zreader_close(struct pf_zreader *z) {
+    if (!z) return;
+    pf_mem_free(z->row);
+    pf_mem_free(z->removed);
+    pf_mem_free(z->raw);
+    pf_mem_free(z->comp);
+    pf_mem_free(z);
+}
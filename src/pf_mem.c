@@ -0,0 +1,132 @@
+/* src/pf_mem.c
+ * Tracking allocator: every block carries a small header with its size
+ * and category, so live and peak bytes per category are known at any
+ * time without walking the heap. Counters are atomic, so worker threads
+ * may allocate too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "portfolio.h"
+
+/* 16 bytes keeps the user block as aligned as malloc's */
+typedef struct {
+    _Alignas(16) size_t size;
+    int cat;
+} BlockHeader;
+
+typedef struct {
+    atomic_llong live, peak, blocks, allocs;
+} MemCounter;
+
+static MemCounter counters[PF_MEM_COUNT];
+
+static void account(int cat, long long delta, long long dblocks) {
+    MemCounter *c = &counters[cat];
+    long long now = atomic_fetch_add_explicit(&c->live, delta, memory_order_relaxed) + delta;
+    atomic_fetch_add_explicit(&c->blocks, dblocks, memory_order_relaxed);
+    if (delta <= 0) return;
+    atomic_fetch_add_explicit(&c->allocs, 1, memory_order_relaxed);
+    long long peak = atomic_load_explicit(&c->peak, memory_order_relaxed);
+    while (now > peak && !atomic_compare_exchange_weak_explicit(&c->peak, &peak, now, memory_order_relaxed,
+                                                                memory_order_relaxed)) { }
+}
+
+void *pf_mem_alloc(pf_mem_category cat, size_t n) {
+    if ((unsigned)cat >= PF_MEM_COUNT || n > SIZE_MAX - sizeof(BlockHeader)) return NULL;
+    BlockHeader *b = malloc(sizeof(BlockHeader) + n);
+    if (!b) return NULL;
+    b->size = n;
+    b->cat = cat;
+    account(cat, (long long)n, 1);
+    return b + 1;
+}
+
+void *pf_mem_calloc(pf_mem_category cat, size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) return NULL;
+    void *p = pf_mem_alloc(cat, count * size);
+    if (p) memset(p, 0, count * size);
+    return p;
+}
+
+/* the block keeps the category it was first allocated with */
+void *pf_mem_realloc(pf_mem_category cat, void *p, size_t n) {
+    if (!p) return pf_mem_alloc(cat, n);
+    if (n > SIZE_MAX - sizeof(BlockHeader)) return NULL;
+    BlockHeader *b = (BlockHeader *)p - 1;
+    size_t old = b->size;
+    int c = b->cat;
+    BlockHeader *grown = realloc(b, sizeof(BlockHeader) + n);
+    if (!grown) return NULL;
+    grown->size = n;
+    account(c, (long long)n - (long long)old, 0);
+    return grown + 1;
+}
+
+void pf_mem_free(void *p) {
+    if (!p) return;
+    BlockHeader *b = (BlockHeader *)p - 1;
+    account(b->cat, -(long long)b->size, -1);
+    free(b);
+}
+
+const char *pf_mem_name(pf_mem_category cat) {
+    static const char *names[PF_MEM_COUNT] = { "holdings", "indexes", "history", "covariance", "analytics",
+                                               "instrumentation", "buffers" };
+    return (unsigned)cat < PF_MEM_COUNT ? names[cat] : "?";
+}
+
+pf_status pf_mem_get(pf_mem_category cat, pf_mem_stats *out) {
+    if ((unsigned)cat >= PF_MEM_COUNT || !out) return PF_ERR_INVALID;
+    out->live = atomic_load(&counters[cat].live);
+    out->peak = atomic_load(&counters[cat].peak);
+    out->blocks = atomic_load(&counters[cat].blocks);
+    out->allocs = atomic_load(&counters[cat].allocs);
+    return PF_OK;
+}
+
+long pf_mem_rss_kb(void) {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return -1;
+    int ok = fscanf(f, "%ld %ld", &pages, &resident) == 2;
+    fclose(f);
+    return ok ? resident * (sysconf(_SC_PAGESIZE) / 1024) : -1;
+}
+
+long pf_mem_peak_rss_kb(void) {
+    struct rusage ru;
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : -1;
+}
+
+pf_status pf_mem_write(const Portfolio *pf, FILE *out) {
+    long long live = 0, blocks = 0;
+    fprintf(out, "%-16s %14s %14s %10s %12s\n", "Structure", "Live bytes", "Peak bytes", "Blocks", "Allocations");
+    for (int c = 0; c < PF_MEM_COUNT; ++c) {
+        pf_mem_stats st;
+        pf_mem_get((pf_mem_category)c, &st);
+        fprintf(out, "%-16s %14lld %14lld %10lld %12lld\n", pf_mem_name((pf_mem_category)c), st.live, st.peak,
+                st.blocks, st.allocs);
+        live += st.live;
+        blocks += st.blocks;
+    }
+    fprintf(out, "%-16s %14lld %14s %10lld\n", "total", live, "", blocks);
+    fprintf(out, "Tracking headers: %lld bytes\n", blocks * (long long)sizeof(BlockHeader));
+    if (pf) {
+        size_t used = (size_t)pf->count * sizeof(Stock), reserved = (size_t)pf->capacity * sizeof(Stock);
+        fprintf(out, "Positions: %d of %d reserved (%zu of %zu holdings bytes in use)\n", pf->count, pf->capacity,
+                used, reserved);
+        if (pf->count > 0)
+            fprintf(out, "Bytes per position: %.1f holdings, %.1f all structures\n",
+                    (double)reserved / pf->count, (double)live / pf->count);
+    }
+    long rss = pf_mem_rss_kb(), peak = pf_mem_peak_rss_kb();
+    fprintf(out, "RSS: %ld KB now, %ld KB peak\n", rss, peak > rss ? peak : rss);
+    return ferror(out) ? PF_ERR_IO : PF_OK;
+}
@@ -0,0 +1,674 @@
+/* src/pf_persist.c
+ * Background saves and delta snapshots.
+ *
+ * Background saves, as Redis does BGSAVE: fork() and let the child write
+ * its copy-on-write image of the book while the parent keeps trading.
+ *
+ * - The parent is blocked only while fork() copies the page tables;
+ *   after that, only pages the parent writes to are duplicated.
+ * - The child saves as pf_save() does: PATH.tmp, fdatasync, rename over
+ *   PATH, fsync of the directory, so readers and a crash see either the
+ *   old file or the complete new one.
+ * - Progress (rows written) and the outcome go through one shared
+ *   anonymous page; the parent reaps the child with waitpid(WNOHANG).
+ * - The child leaves with _exit(): no atexit handlers, no flushing of
+ *   the parent's stdio buffers, and it closes inherited descriptors
+ *   (sockets, the feed) so clients never wait on it.
+ *
+ * Delta snapshots: a bit per row, set by every change to it, and the
+ * symbols sold out since the last save. A delta file holds those rows
+ * and a "-SYMBOL" line per removal; the base names its chain (an id and
+ * how many deltas it already holds) and each delta repeats the id and
+ * its number, so a crash between any two renames leaves a chain that
+ * replays to one of the saved states. Merges are background saves of a
+ * new base with the same id; the deltas it holds are unlinked after it
+ * lands, and deltas written meanwhile chain onto it.
+ *
+ * Background loads: a thread runs pf_load() into a book of its own, so
+ * nothing it touches is shared; the caller's book only changes when
+ * pf_load_wait() moves the rows across.
+ */
+
+#define _GNU_SOURCE /* close_range */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "portfolio.h"
+#include "pf_internal.h"
+
+#define BGSAVE_PATH_LEN 512
+
+struct pf_delta;
+static void delta_merged(struct pf_delta *d, int seq);
+
+typedef struct {
+    volatile long done;         /* rows written by the child */
+    long total;
+    atomic_int result;          /* pf_status + 1 once the child is done */
+    double write_sec;
+    double t_end;               /* CLOCK_MONOTONIC, which parent and child share */
+} BgShared;
+
+struct pf_bgsave {
+    pid_t pid;                  /* running child, 0 when idle */
+    BgShared *sh;
+    double t_start;
+    char header[64];            /* first line of the file, "" for none */
+    int merge_seq;              /* deltas a running merge folds in, 0 for a plain save */
+    pf_bgsave_stats st;
+};
+
+static double mono_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void child_main(const Portfolio *pf, const char *path, BgShared *sh, const char *header) {
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);  /* not the signals the parent's loop blocks */
+    signal(SIGINT, SIG_IGN);    /* ^C at the terminal is for the parent */
+    close_range(3, ~0U, 0);
+    double t0 = mono_sec();
+    pf_status st = pf_save_file(pf, path, PF_SYNC_FULL, &sh->done, header[0] ? header : NULL);
+    sh->t_end = mono_sec();
+    sh->write_sec = sh->t_end - t0;
+    atomic_store(&sh->result, (int)st + 1);
+    _exit(st == PF_OK ? 0 : 1);
+}
+
+static pf_status bgsave_start(Portfolio *pf, const char *path, const char *header, int merge_seq) {
+    if (!path || strlen(path) >= BGSAVE_PATH_LEN) return PF_ERR_INVALID;
+    pf_bgsave_poll(pf, NULL);
+    struct pf_bgsave *b = pf->bgsave;
+    if (b && b->pid) return PF_ERR_INVALID;
+    if (!b) {
+        b = pf_mem_calloc(PF_MEM_BUFFERS, 1, sizeof(*b));
+        if (!b) return PF_ERR_NOMEM;
+        b->sh = mmap(NULL, sizeof(BgShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (b->sh == MAP_FAILED) { pf_mem_free(b); return PF_ERR_NOMEM; }
+        pf->bgsave = b;
+    }
+    b->sh->done = 0;
+    b->sh->total = pf->count;
+    b->sh->write_sec = b->sh->t_end = 0.0;
+    atomic_store(&b->sh->result, 0);
+    snprintf(b->header, sizeof(b->header), "%s", header ? header : "");
+    b->merge_seq = merge_seq;
+    fflush(NULL);               /* or the child could repeat buffered output */
+    b->t_start = mono_sec();
+    pid_t pid = fork();
+    if (pid < 0) return PF_ERR_NOMEM;
+    if (pid == 0) child_main(pf, path, b->sh, b->header);
+    b->pid = pid;
+    b->st.fork_ms = (mono_sec() - b->t_start) * 1e3;
+    b->st.running = 1;
+    snprintf(b->st.path, sizeof(b->st.path), "%s", path);
+    return PF_OK;
+}
+
+pf_status pf_bgsave_start(Portfolio *pf, const char *path) {
+    pf_load_settle(pf);    /* nor fork() with the loader running */
+    pf_status st = bgsave_start(pf, path, NULL, 0);
+    if (st == PF_OK && pf->delta) pf_delta_overwritten(pf, path);
+    return st;
+}
+
+static void reap(struct pf_bgsave *b, struct pf_delta *d) {
+    int r = atomic_load(&b->sh->result);
+    b->pid = 0;
+    b->st.running = 0;
+    b->st.saves++;
+    b->st.last = r > 0 ? (pf_status)(r - 1) : PF_ERR_IO;   /* killed before it finished */
+    b->st.elapsed_sec = (b->sh->t_end > 0.0 ? b->sh->t_end : mono_sec()) - b->t_start;
+    b->st.write_sec = b->sh->write_sec;
+    if (b->merge_seq && b->st.last == PF_OK && d) delta_merged(d, b->merge_seq);
+    b->merge_seq = 0;
+}
+
+pf_status pf_bgsave_poll(Portfolio *pf, pf_bgsave_stats *out) {
+    struct pf_bgsave *b = pf->bgsave;
+    if (out) memset(out, 0, sizeof(*out));
+    if (!b) return PF_OK;
+    if (b->pid && waitpid(b->pid, NULL, WNOHANG) == b->pid) reap(b, pf->delta);
+    b->st.rows_done = b->sh->done;
+    b->st.rows_total = b->sh->total;
+    if (b->pid) b->st.elapsed_sec = mono_sec() - b->t_start;
+    if (out) *out = b->st;
+    return PF_OK;
+}
+
+pf_status pf_bgsave_wait(const Portfolio *pf) {
+    struct pf_bgsave *b = pf->bgsave;
+    if (!b) return PF_OK;
+    if (b->pid) {
+        while (waitpid(b->pid, NULL, 0) < 0 && errno == EINTR) { }
+        reap(b, pf->delta);
+    }
+    return b->st.last;
+}
+
+void pf_bgsave_free(Portfolio *pf) {
+    if (!pf->bgsave) return;
+    pf_bgsave_wait(pf);
+    munmap(pf->bgsave->sh, sizeof(BgShared));
+    pf_mem_free(pf->bgsave);
+    pf->bgsave = NULL;
+}
+
+/* ---------- Background loads ---------- */
+
+struct pf_bgload {
+    pthread_t thread;
+    Portfolio book;             /* the loader's own; empty FX table */
+    char path[BGSAVE_PATH_LEN];
+    pf_status st;
+    int loaded, skipped;
+    uint64_t t0;                /* latency clock at the start, 0 if not sampled */
+    int counters;               /* count the loader thread too */
+};
+
+static void *loader_main(void *arg) {
+    struct pf_bgload *b = arg;
+    pf_trace_thread_name("loader");
+    if (b->counters) pf_counters_enable(&b->book);     /* the group counts the thread that opens it */
+    b->st = pf_load(&b->book, b->path, &b->loaded, &b->skipped);
+    return NULL;
+}
+
+pf_status pf_load_start(Portfolio *pf, const char *path) {
+    if (!path || strlen(path) >= BGSAVE_PATH_LEN) return PF_ERR_INVALID;
+    pf_load_settle(pf);
+    if (access(path, R_OK) != 0) return PF_ERR_IO;
+    struct pf_bgload *b = pf_mem_calloc(PF_MEM_BUFFERS, 1, sizeof(*b));
+    if (!b) return PF_ERR_NOMEM;
+    pf_init(&b->book);
+    snprintf(b->path, sizeof(b->path), "%s", path);
+    b->counters = pf->counters != NULL;
+    b->t0 = pf_op_start(pf);
+    if (pthread_create(&b->thread, NULL, loader_main, b) != 0) {
+        pf_mem_free(b);
+        return PF_ERR_NOMEM;
+    }
+    pf->bgload = b;
+    return PF_OK;
+}
+
+pf_status pf_load_wait(Portfolio *pf, int *loaded, int *skipped) {
+    struct pf_bgload *b = pf->bgload;
+    if (loaded) *loaded = 0;
+    if (skipped) *skipped = 0;
+    if (!b) return PF_OK;
+    pthread_join(b->thread, NULL);
+    pf->bgload = NULL;
+    pf_op_finish(pf, PF_OP_LOAD, b->t0, &b->book);
+
+    /* currency ids are the loader's; 0 stays the implicit currency */
+    Portfolio *t = &b->book;
+    int n = 0;
+    for (int i = 0; i < t->count; ++i) {
+        Stock *s = &t->items[i];
+        int ccy = s->ccy ? pf_ccy_id(pf, t->fx.codes[s->ccy]) : 0;
+        if (ccy < 0) { b->skipped++; continue; }
+        s->ccy = ccy;
+        t->items[n++] = *s;
+    }
+    pf_delta_free(pf);
+    pf_mem_free(pf->items);
+    pf->items = t->items;
+    pf->count = n;
+    pf->capacity = t->capacity;
+    pf->layout++;
+    pf_holdings_changed(pf);
+    pf->delta = t->delta;
+    if (pf->delta && n < t->count) pf_holdings_changed(pf);  /* rows left out: the next save is a base */
+    t->items = NULL;
+    t->delta = NULL;
+    pf_free(t);
+
+    pf_status st = b->st;
+    if (loaded) *loaded = n;
+    if (skipped) *skipped = b->skipped;
+    pf_mem_free(b);
+    return st;
+}
+
+/* ---------- Delta snapshots ---------- */
+
+struct pf_delta {
+    uint64_t *bits;             /* row i changed since the last save */
+    int words;
+    char (*gone)[PF_SYMBOL_LEN];    /* sold out since the last save */
+    int ngone, gone_cap;
+    int chained;                /* 0: the next save writes a base */
+    char path[BGSAVE_PATH_LEN];
+    unsigned long id;           /* of the chain, checked against every file */
+    int seq;                    /* last delta written */
+    int base_seq;               /* deltas the base already holds */
+    long deltas, bases, merges;
+};
+
+static struct pf_delta *delta_of(Portfolio *pf) {
+    if (!pf->delta) pf->delta = pf_mem_calloc(PF_MEM_INDEX, 1, sizeof(struct pf_delta));
+    return pf->delta;
+}
+
+static void delta_name(char *out, size_t n, const char *path, int seq) {
+    snprintf(out, n, "%s.d%d", path, seq);
+}
+
+/* bits for rows [0, rows), cleared */
+static int bits_grow(struct pf_delta *d, int rows) {
+    int words = rows / 64 + 1;
+    if (words > d->words) {
+        uint64_t *bits = pf_mem_realloc(PF_MEM_INDEX, d->bits, (size_t)words * sizeof(*bits));
+        if (!bits) return 0;
+        memset(bits + d->words, 0, (size_t)(words - d->words) * sizeof(*bits));
+        d->bits = bits;
+        d->words = words;
+    }
+    return 1;
+}
+
+static int bits_reset(struct pf_delta *d, int rows) {
+    if (!bits_grow(d, rows)) return 0;
+    memset(d->bits, 0, (size_t)d->words * sizeof(*d->bits));
+    return 1;
+}
+
+void pf_delta_mark(Portfolio *pf, int idx) {
+    struct pf_delta *d = pf->delta;
+    if (!d->chained) return;
+    if (idx / 64 >= d->words) {
+        int words = d->words * 2 > idx / 64 + 1 ? d->words * 2 : idx / 64 + 1;
+        uint64_t *bits = pf_mem_realloc(PF_MEM_INDEX, d->bits, (size_t)words * sizeof(*bits));
+        if (!bits) { d->chained = 0; return; }
+        memset(bits + d->words, 0, (size_t)(words - d->words) * sizeof(*bits));
+        d->bits = bits;
+        d->words = words;
+    }
+    d->bits[idx / 64] |= 1ULL << (idx % 64);
+}
+
+/* row idx is about to go and the rows after it move up one */
+void pf_delta_removed(Portfolio *pf, int idx) {
+    struct pf_delta *d = pf->delta;
+    if (!d->chained) return;
+    if (d->ngone == d->gone_cap) {
+        int cap = d->gone_cap ? d->gone_cap * 2 : 16;
+        char (*gone)[PF_SYMBOL_LEN] = pf_mem_realloc(PF_MEM_INDEX, d->gone, (size_t)cap * PF_SYMBOL_LEN);
+        if (!gone) { d->chained = 0; return; }
+        d->gone = gone;
+        d->gone_cap = cap;
+    }
+    memcpy(d->gone[d->ngone++], pf->items[idx].symbol, PF_SYMBOL_LEN);
+    int w = idx / 64;
+    if (w >= d->words) return;
+    uint64_t low = (1ULL << (idx % 64)) - 1;
+    uint64_t *b = d->bits;
+    b[w] = (b[w] & low) | ((b[w] >> 1) & ~low);
+    for (; w + 1 < d->words; ++w) {
+        b[w] |= b[w + 1] << 63;
+        b[w + 1] >>= 1;
+    }
+}
+
+void pf_delta_reset(Portfolio *pf) {
+    pf->delta->chained = 0;
+}
+
+void pf_delta_overwritten(const Portfolio *pf, const char *path) {
+    if (strcmp(pf->delta->path, path) == 0) pf->delta->chained = 0;
+}
+
+static void unlink_deltas(const char *path, int from, int to) {
+    char name[BGSAVE_PATH_LEN + 16];
+    for (int k = from; k <= to; ++k) {
+        delta_name(name, sizeof(name), path, k);
+        unlink(name);
+    }
+}
+
+/* every PATH.dN beside PATH: after a new base none of them can replay,
+ * whether from this chain, an older one or a crash before a merge's
+ * deltas were unlinked */
+static void sweep_deltas(const char *path) {
+    char dir[BGSAVE_PATH_LEN], name[BGSAVE_PATH_LEN + 16];
+    const char *slash = strrchr(path, '/');
+    const char *base = slash ? slash + 1 : path;
+    int nd = slash ? (int)(slash - path) + 1 : 0;      /* "dir/", or "" for the working directory */
+    snprintf(dir, sizeof(dir), "%.*s", nd, path);
+    size_t nb = strlen(base);
+    DIR *dp = opendir(nd ? dir : ".");
+    if (!dp) return;
+    for (struct dirent *e; (e = readdir(dp)) != NULL;) {
+        const char *s = e->d_name;
+        if (strncmp(s, base, nb) != 0 || s[nb] != '.' || s[nb + 1] != 'd' || !s[nb + 2]) continue;
+        if (strspn(s + nb + 2, "0123456789") != strlen(s + nb + 2)) continue;
+        snprintf(name, sizeof(name), "%s%s", dir, s);
+        unlink(name);
+    }
+    closedir(dp);
+}
+
+/* a merge landed: the base now holds deltas up to seq */
+static void delta_merged(struct pf_delta *d, int seq) {
+    unlink_deltas(d->path, d->base_seq + 1, seq);
+    d->base_seq = seq;
+    d->merges++;
+}
+
+static pf_status write_base(Portfolio *pf, struct pf_delta *d, const char *path, int *rows) {
+    if (pf->bgsave) pf_bgsave_wait(pf);    /* a save or merge still running lands first */
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    unsigned long id = (((unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec)
+                        ^ ((unsigned long)getpid() << 40)) | 1;   /* 0 is "no chain" */
+    char header[64];
+    snprintf(header, sizeof(header), "#PF base %lu 0\n", id);
+    if (!bits_grow(d, pf->count)) return PF_ERR_NOMEM;
+    pf_status st = pf_save_file(pf, path, PF_SYNC_FULL, NULL, header);
+    if (st != PF_OK) return st;     /* the old chain still needs its dirty rows */
+    bits_reset(d, pf->count);
+    sweep_deltas(path);                 /* another id now: never replayed */
+    snprintf(d->path, sizeof(d->path), "%s", path);
+    d->id = id;
+    d->seq = d->base_seq = 0;
+    d->ngone = 0;
+    d->chained = 1;
+    d->bases++;
+    if (rows) *rows = pf->count;
+    return PF_OK;
+}
+
+pf_status pf_delta_save(Portfolio *pf, const char *path, int *rows) {
+    if (rows) *rows = 0;
+    pf_load_settle(pf);
+    if (!path || strlen(path) >= BGSAVE_PATH_LEN) return PF_ERR_INVALID;
+    struct pf_delta *d = delta_of(pf);
+    if (!d) return PF_ERR_NOMEM;
+    pf_bgsave_poll(pf, NULL);   /* so a finished merge shortens the chain */
+    if (!d->chained || strcmp(d->path, path) != 0) return write_base(pf, d, path, rows);
+
+    int words = pf->count / 64 + 1 < d->words ? pf->count / 64 + 1 : d->words;
+    int dirty = 0;
+    for (int w = 0; w < words; ++w) dirty |= d->bits[w] != 0;
+    if (!dirty && d->ngone == 0) return PF_OK;
+
+    char name[BGSAVE_PATH_LEN + 16], tmp[BGSAVE_PATH_LEN + 24];
+    delta_name(name, sizeof(name), path, d->seq + 1);
+    FILE *f = pf_open_temp(name, tmp, sizeof(tmp));
+    if (!f) return PF_ERR_IO;
+    char header[64];
+    snprintf(header, sizeof(header), "#PF delta %lu %d\n", d->id, d->seq + 1);
+    struct pf_zwriter *z = NULL;
+    if (pf->compress && !(z = pf_zwriter_open(f, header, pf->fx.codes, pf->fx.n)))
+        return pf_replace_file(f, PF_ERR_NOMEM, tmp, name, PF_SYNC_FULL);
+    if (!z) fputs(header, f);
+    Stock gone = { 0 };
+    for (int g = 0; g < d->ngone; ++g) {
+        if (!z) {
+            fprintf(f, "-%s\n", d->gone[g]);
+            continue;
+        }
+        memcpy(gone.symbol, d->gone[g], PF_SYMBOL_LEN);
+        pf_zwriter_row(z, &gone, 1);
+    }
+    int n = d->ngone;
+    for (int w = 0; w < words; ++w) {
+        for (uint64_t m = d->bits[w]; m; m &= m - 1) {
+            int i = w * 64 + __builtin_ctzll(m);
+            if (i >= pf->count) break;
+            if (z)
+                pf_zwriter_row(z, &pf->items[i], 0);
+            else
+                fprintf(f, "%s %d %.10g %.10g %s\n",
+                        pf->items[i].symbol,
+                        pf->items[i].qty,
+                        pf->items[i].buy_price,
+                        pf->items[i].cur_price,
+                        pf->fx.codes[pf->items[i].ccy]);
+            ++n;
+        }
+    }
+    pf_status st = PF_OK;
+    if (pf->compress && pf_zwriter_close(z) != 0) st = PF_ERR_IO;
+    st = pf_replace_file(f, st, tmp, name, PF_SYNC_FULL);
+    if (st != PF_OK) return st;
+    memset(d->bits, 0, (size_t)words * sizeof(*d->bits));
+    d->ngone = 0;
+    d->seq++;
+    d->deltas++;
+    if (rows) *rows = n;
+
+    if (d->seq - d->base_seq >= PF_DELTA_CHAIN && !(pf->bgsave && pf->bgsave->pid)) {
+        char header[64];
+        snprintf(header, sizeof(header), "#PF base %lu %d\n", d->id, d->seq);
+        bgsave_start(pf, path, header, d->seq);    /* if it cannot start, the next save tries again */
+    }
+    return PF_OK;
+}
+
+/* ---------- Replay ---------- */
+
+/* what the chain says about one symbol, after every delta so far */
+typedef struct {
+    Stock row;
+    int present;        /* held after the last delta */
+    int moved;          /* sold out on the way: if held again, it went to the end */
+    int used;           /* found in the base */
+    long order;         /* when it last became held, for rows that go to the end */
+} Change;
+
+typedef struct {
+    Change *e;
+    int n, cap;
+    int *slot;          /* open addressing, -1 empty */
+    int mask;
+} ChangeSet;
+
+static uint32_t sym_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    for (; *s; ++s) h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+static int change_find(const ChangeSet *cs, const char *sym) {
+    if (!cs->slot) return -1;
+    for (uint32_t h = sym_hash(sym) & cs->mask;; h = (h + 1) & cs->mask) {
+        int k = cs->slot[h];
+        if (k < 0 || strcmp(cs->e[k].row.symbol, sym) == 0) return k;
+    }
+}
+
+static int change_get(ChangeSet *cs, const char *sym) {
+    int k = change_find(cs, sym);
+    if (k >= 0) return k;
+    if (cs->n == cs->cap) {
+        int cap = cs->cap ? cs->cap * 2 : 64;
+        Change *e = pf_mem_realloc(PF_MEM_BUFFERS, cs->e, (size_t)cap * sizeof(*e));
+        int *slot = pf_mem_alloc(PF_MEM_BUFFERS, (size_t)cap * 2 * sizeof(int));
+        if (!e || !slot) {
+            if (e) cs->e = e;
+            pf_mem_free(slot);
+            return -1;
+        }
+        cs->e = e;
+        cs->cap = cap;
+        pf_mem_free(cs->slot);
+        cs->slot = slot;
+        cs->mask = cap * 2 - 1;
+        memset(slot, -1, (size_t)cap * 2 * sizeof(int));
+        for (int j = 0; j < cs->n; ++j) {
+            uint32_t h = sym_hash(cs->e[j].row.symbol) & cs->mask;
+            while (slot[h] >= 0) h = (h + 1) & cs->mask;
+            slot[h] = j;
+        }
+    }
+    Change *c = &cs->e[cs->n];
+    memset(c, 0, sizeof(*c));
+    snprintf(c->row.symbol, PF_SYMBOL_LEN, "%s", sym);
+    uint32_t h = sym_hash(sym) & cs->mask;
+    while (cs->slot[h] >= 0) h = (h + 1) & cs->mask;
+    cs->slot[h] = cs->n;
+    return cs->n++;
+}
+
+/* one line of a delta: a row as it now is, or a symbol sold out */
+static pf_status apply_change(Portfolio *pf, ChangeSet *cs, long *order, const Stock *row, const char *code,
+                              int removed, int *skipped) {
+    int ccy = 0, k;
+    if (!removed && code[0] && (ccy = pf_ccy_id(pf, code)) < 0) {
+        ++*skipped;
+        return PF_OK;
+    }
+    if ((k = change_get(cs, row->symbol)) < 0) return PF_ERR_NOMEM;
+    Change *c = &cs->e[k];
+    if (removed) {
+        c->present = 0;
+        c->moved = 1;
+        return PF_OK;
+    }
+    if (!c->present) c->order = ++*order;
+    c->present = 1;
+    c->row.qty = row->qty;
+    c->row.buy_price = row->buy_price;
+    c->row.cur_price = row->cur_price;
+    c->row.ccy = ccy;
+    return PF_OK;
+}
+
+/* read PATH.dN, text or compressed; 0 when it is missing or from another chain */
+static int read_delta(Portfolio *pf, const char *path, unsigned long id, int seq, ChangeSet *cs, long *order,
+                      int *skipped, pf_status *st) {
+    char name[BGSAVE_PATH_LEN + 16], line[128], code[8];
+    unsigned long fid;
+    int fseq, removed;
+    Stock row = { 0 };
+    delta_name(name, sizeof(name), path, seq);
+    FILE *f = fopen(name, "r");
+    if (!f) return 0;
+    struct pf_zreader *z = NULL;
+    if (fread(line, 4, 1, f) == 1 && memcmp(line, "PFZ1", 4) == 0) {
+        z = pf_zreader_open(f, line, sizeof(line));
+        if (!z) line[0] = '\0';
+    } else {
+        rewind(f);
+        if (!fgets(line, sizeof(line), f)) line[0] = '\0';
+    }
+    if (sscanf(line, "#PF delta %lu %d", &fid, &fseq) != 2 || fid != id || fseq != seq) {
+        pf_zreader_close(z);
+        fclose(f);
+        return 0;
+    }
+    if (z) {
+        const char *zcode;
+        int r = 0;
+        while (*st == PF_OK && (r = pf_zreader_next(z, &row, &zcode, &removed)) > 0)
+            *st = apply_change(pf, cs, order, &row, zcode, removed, skipped);
+        if (r < 0 && *st == PF_OK) *st = PF_ERR_IO;
+        pf_zreader_close(z);
+    }
+    while (!z && *st == PF_OK && fgets(line, sizeof(line), f) != NULL) {
+        code[0] = '\0';
+        removed = line[0] == '-';
+        if (removed ? sscanf(line + 1, "%15s", row.symbol) != 1
+                    : sscanf(line, "%15s %d %lf %lf %7s", row.symbol, &row.qty, &row.buy_price,
+                             &row.cur_price, code) < 4)
+            continue;
+        *st = apply_change(pf, cs, order, &row, code, removed, skipped);
+    }
+    fclose(f);
+    return 1;
+}
+
+static int by_order(const void *a, const void *b) {
+    long x = (*(Change *const *)a)->order, y = (*(Change *const *)b)->order;
+    return (x > y) - (x < y);
+}
+
+/* pf_load() read a chain's base holding deltas up to seq: apply the
+ * rest, as one pass over the book, and carry on the chain from there */
+pf_status pf_delta_replay(Portfolio *pf, const char *path, unsigned long id, int seq, int *skipped) {
+    if (strlen(path) >= BGSAVE_PATH_LEN) return PF_OK;
+    struct pf_delta *d = delta_of(pf);
+    if (!d) return PF_ERR_NOMEM;
+    ChangeSet cs = { 0 };
+    long order = 0;
+    pf_status st = PF_OK;
+    int last = seq;
+    while (st == PF_OK && read_delta(pf, path, id, last + 1, &cs, &order, skipped, &st)) ++last;
+
+    int n = 0;
+    for (int i = 0; i < pf->count; ++i) {
+        int k = change_find(&cs, pf->items[i].symbol);
+        if (k < 0) { pf->items[n++] = pf->items[i]; continue; }
+        if (cs.e[k].present && !cs.e[k].moved) {
+            pf->items[n++] = cs.e[k].row;
+            cs.e[k].used = 1;
+        }
+    }
+    pf->count = n;
+    Change **tail = pf_mem_alloc(PF_MEM_BUFFERS, (size_t)(cs.n ? cs.n : 1) * sizeof(*tail));
+    int ntail = 0;
+    if (!tail) st = PF_ERR_NOMEM;
+    for (int k = 0; tail && k < cs.n; ++k)
+        if (cs.e[k].present && !cs.e[k].used) tail[ntail++] = &cs.e[k];
+    if (ntail) qsort(tail, (size_t)ntail, sizeof(*tail), by_order);
+    if (ntail && pf_reserve(pf, pf->count + ntail) != PF_OK) { st = PF_ERR_NOMEM; ntail = 0; }
+    for (int j = 0; j < ntail; ++j) pf->items[pf->count++] = tail[j]->row;
+    pf_mem_free(tail);
+    pf_mem_free(cs.e);
+    pf_mem_free(cs.slot);
+
+    if (st == PF_OK && bits_reset(d, pf->count)) {
+        snprintf(d->path, sizeof(d->path), "%s", path);
+        d->id = id;
+        d->base_seq = seq;
+        d->seq = last;
+        d->ngone = 0;
+        d->chained = 1;
+    }
+    return st;
+}
+
+pf_status pf_delta_get(const Portfolio *pf, pf_delta_stats *out) {
+    if (!out) return PF_ERR_INVALID;
+    memset(out, 0, sizeof(*out));
+    const struct pf_delta *d = pf->delta;
+    if (!d) return PF_OK;
+    out->chained = d->chained;
+    snprintf(out->path, sizeof(out->path), "%s", d->path);
+    out->length = d->seq - d->base_seq;
+    out->last = d->seq;
+    if (d->chained) {
+        int words = pf->count / 64 + 1 < d->words ? pf->count / 64 + 1 : d->words;
+        for (int w = 0; w < words; ++w) out->dirty_rows += __builtin_popcountll(d->bits[w]);
+        out->removed_rows = d->ngone;
+    }
+    out->merging = pf->bgsave && pf->bgsave->pid && pf->bgsave->merge_seq;
+    out->deltas = d->deltas;
+    out->bases = d->bases;
+    out->merges = d->merges;
+    return PF_OK;
+}
+
+void pf_delta_free(Portfolio *pf) {
+    if (!pf->delta) return;
+    pf_mem_free(pf->delta->bits);
+    pf_mem_free(pf->delta->gone);
+    pf_mem_free(pf->delta);
+    pf->delta = NULL;
+}
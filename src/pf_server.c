@@ -0,0 +1,605 @@
+/* src/pf_server.c
+ * Portfolio daemon: serves one book to many local clients over a Unix
+ * domain socket, built on the portfolio library.
+ *
+ * - One thread, one epoll loop: the book is never shared, so no locks.
+ * - Line protocol, one response line per request:
+ *     BUY SYM QTY PRICE [CCY]   -> OK qty avg_price cur_price
+ *     SELL SYM QTY PRICE        -> OK remaining_qty
+ *     PRICE SYM PRICE           -> OK
+ *     METRICS                   -> OK cost market_value unrealized return_pct positions
+ *     VIEW [PATTERN]            -> OK n, then n lines "SYM CCY QTY BUY CUR"; PATTERN as BRK* or *.L
+ *     SORTED FIELD N [DESC]     -> as VIEW, the first N by SYMBOL, VALUE, PL or PCT
+ *     SAVE                      -> OK n, once portfolio.txt is on disk (group commit)
+ *     BGSAVE                    -> OK n, saving n rows from a forked child
+ *     DELTASAVE                 -> OK rows length, only the rows changed since the last one
+ *     SAVESTATUS                -> OK running rows_done rows_total elapsed_ms fork_ms saves last_status
+ *     STATS                     -> OK n, then n lines "OP COUNT MEAN P50 P90 P99 P99.9 MAX" (ns)
+ *     COUNTERS                  -> OK n, then n lines "OP CALLS CYCLES INSTRUCTIONS CACHE_MISSES
+ *                                  BRANCH_MISSES TASK_CLOCK_NS" per call (-1 if unavailable)
+ *     MEMORY                    -> OK n rss_kb peak_rss_kb, then n lines "STRUCTURE LIVE PEAK BLOCKS" (bytes)
+ *     QUIT                      -> closes the connection
+ *   Failures answer "ERR <reason>".
+ * - Clients may pipeline: every complete line in a read is answered and
+ *   the answers go back in a single write.
+ * - With a FEED name, prices published by portfolio-feed are applied
+ *   between requests (polled at least every millisecond).
+ * - SAVE is a group commit: the client's later requests wait, the rest
+ *   carry on, and every SAVE within PF_COMMIT_US microseconds (default
+ *   1000; 0 batches one loop pass) shares one fsync'd save. A
+ *   background save or merge still running holds the commit, and a
+ *   DELTASAVE that has to write a new base, without blocking the loop.
+ * - Loads portfolio.txt and fx.txt at start, saves the book on SIGINT/SIGTERM
+ *   (a delta once DELTASAVE has started a chain).
+ * - STATS times one call in PF_LATENCY_EVERY (default 8; 1 for every
+ *   call, 0 for none); PF_COUNTERS=1 turns on the hardware counters
+ *   behind COUNTERS; PF_TRACE=FILE writes a Chrome trace of every
+ *   request until shutdown.
+ *
+ * Usage: portfolio-server [SOCKET_PATH [FEED]]   (default portfolio.sock)
+ */
+
+#define _GNU_SOURCE /* accept4 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "portfolio.h"
+
+#define DEFAULT_SOCKET "portfolio.sock"
+#define PORTFOLIO_FILE "portfolio.txt"
+#define FX_FILE "fx.txt"
+#define IN_BUF 16384            /* longest pipelined burst read at once */
+#define OUT_HIGH_WATER (1 << 20) /* stop reading a client that does not drain */
+#define MAX_EVENTS 256
+#define MAX_ARGS 6
+#define FEED_POLL_MS 1
+#define COMMIT_US 1000
+#define LATENCY_EVERY 8
+#define DELTASAVE_RETRY_US 1000   /* a parked DELTASAVE checks on the background save */
+
+typedef struct Conn {
+    int fd;
+    int closing;        /* QUIT seen: close once the output is flushed */
+    int reading;        /* EPOLLIN armed */
+    int writing;        /* EPOLLOUT armed */
+    unsigned long ticket;   /* SAVE waiting for its group commit, 0 if none */
+    int deltasave;          /* DELTASAVE waiting for a background save to land */
+    struct Conn *wait_next;
+    char in[IN_BUF];
+    size_t in_len;
+    char *out;
+    size_t out_len, out_off, out_cap;
+} Conn;
+
+static volatile sig_atomic_t stop_requested;
+static Conn *waiting;           /* connections parked on a SAVE or DELTASAVE */
+
+/* later requests from a parked client wait for its save */
+static int parked(const Conn *c) { return c->ticket || c->deltasave; }
+
+static void on_signal(int sig) { (void)sig; stop_requested = 1; }
+static void on_child(int sig) { (void)sig; }   /* wakes epoll_pwait to reap a background save */
+
+/* ---------- Output buffer ---------- */
+
+static int out_reserve(Conn *c, size_t extra) {
+    if (c->out_len + extra <= c->out_cap) return 1;
+    size_t cap = c->out_cap ? c->out_cap : 4096;
+    while (cap < c->out_len + extra) cap *= 2;
+    char *grown = pf_mem_realloc(PF_MEM_BUFFERS, c->out, cap);
+    if (!grown) return 0;
+    c->out = grown;
+    c->out_cap = cap;
+    return 1;
+}
+
+static void out_printf(Conn *c, const char *fmt, ...) {
+    va_list ap;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        size_t room = c->out_cap - c->out_len;
+        va_start(ap, fmt);
+        int n = vsnprintf(c->out ? c->out + c->out_len : NULL, room, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if ((size_t)n < room) { c->out_len += (size_t)n; return; }
+        if (!out_reserve(c, (size_t)n + 1)) return;
+    }
+}
+
+/* ---------- Requests ---------- */
+
+static int split_args(char *line, char **argv) {
+    int argc = 0;
+    char *p = line;
+    while (*p && argc < MAX_ARGS) {
+        while (*p == ' ' || *p == '\t' || *p == '\r') ++p;
+        if (!*p) break;
+        argv[argc++] = p;
+        while (*p && *p != ' ' && *p != '\t' && *p != '\r') ++p;
+        if (*p) *p++ = '\0';
+    }
+    return argc;
+}
+
+static int arg_int(const char *s, int *out) {
+    char *end;
+    errno = 0;
+    long v = strtol(s, &end, 10);
+    if (end == s || *end != '\0' || errno == ERANGE || v < INT_MIN || v > INT_MAX) return 0;
+    *out = (int)v;
+    return 1;
+}
+
+static int arg_double(const char *s, double *out) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || *end != '\0') return 0;
+    *out = v;
+    return 1;
+}
+
+static void reply_status(Conn *c, pf_status st) {
+    if (st == PF_OK) out_printf(c, "OK\n");
+    else out_printf(c, "ERR %s\n", pf_strerror(st));
+}
+
+static void delta_save(Portfolio *pf, Conn *c) {
+    int rows = 0;
+    pf_status st = pf_save_delta(pf, PORTFOLIO_FILE, &rows);
+    if (st != PF_OK) {
+        reply_status(c, st);
+    } else {
+        pf_delta_stats ds;
+        pf_delta_get(pf, &ds);
+        out_printf(c, "OK %d %d\n", rows, ds.length);
+    }
+}
+
+static void dispatch(Portfolio *pf, Conn *c, char *line) {
+    char *argv[MAX_ARGS];
+    int argc = split_args(line, argv);
+    if (argc == 0) return;
+    pf_symbol_upper(argv[0]);
+    const char *cmd = argv[0];
+    int q;
+    double p;
+    pf_position pos;
+    pf_status st;
+
+    if (argc >= 2) pf_symbol_upper(argv[1]);
+    if (strcmp(cmd, "BUY") == 0) {
+        if ((argc != 4 && argc != 5) || !arg_int(argv[2], &q) || !arg_double(argv[3], &p)) {
+            out_printf(c, "ERR usage: BUY SYM QTY PRICE [CCY]\n");
+            return;
+        }
+        st = pf_buy(pf, argv[1], q, p, argc == 5 ? argv[4] : NULL, &pos);
+        if (st != PF_OK) reply_status(c, st);
+        else out_printf(c, "OK %d %.10g %.10g\n", pos.qty, pos.buy_price, pos.cur_price);
+    } else if (strcmp(cmd, "SELL") == 0) {
+        if (argc != 4 || !arg_int(argv[2], &q) || !arg_double(argv[3], &p)) {
+            out_printf(c, "ERR usage: SELL SYM QTY PRICE\n");
+            return;
+        }
+        st = pf_sell(pf, argv[1], q, p, &pos);
+        if (st != PF_OK) reply_status(c, st);
+        else out_printf(c, "OK %d\n", pos.qty);
+    } else if (strcmp(cmd, "PRICE") == 0) {
+        if (argc != 3 || !arg_double(argv[2], &p)) {
+            out_printf(c, "ERR usage: PRICE SYM PRICE\n");
+            return;
+        }
+        reply_status(c, pf_update_price(pf, argv[1], p));
+    } else if (strcmp(cmd, "METRICS") == 0) {
+        pf_metrics m;
+        pf_get_metrics(pf, &m);
+        out_printf(c, "OK %.2f %.2f %.2f %.4f %d\n", m.cost, m.market_value, m.unrealized,
+                   m.return_pct, m.positions);
+    } else if (strcmp(cmd, "VIEW") == 0 && argc == 2) {
+        int matched = 0;
+        int *idx = pf_mem_alloc(PF_MEM_BUFFERS, (size_t)(pf->count ? pf->count : 1) * sizeof(int));
+        if (!idx) {
+            reply_status(c, PF_ERR_NOMEM);
+            return;
+        }
+        st = pf_search(pf, argv[1], idx, pf->count, &matched);
+        if (st != PF_OK) reply_status(c, st);
+        else out_printf(c, "OK %d\n", matched);
+        for (int j = 0; j < matched && st == PF_OK; ++j) {
+            const Stock *s = &pf->items[idx[j]];
+            out_printf(c, "%s %s %d %.10g %.10g\n", s->symbol, pf->fx.codes[s->ccy], s->qty,
+                       s->buy_price, s->cur_price);
+        }
+        pf_mem_free(idx);
+    } else if (strcmp(cmd, "VIEW") == 0) {
+        out_printf(c, "OK %d\n", pf->count);
+        for (int i = 0; i < pf->count; ++i) {
+            const Stock *s = &pf->items[i];
+            out_printf(c, "%s %s %d %.10g %.10g\n", s->symbol, pf->fx.codes[s->ccy], s->qty,
+                       s->buy_price, s->cur_price);
+        }
+    } else if (strcmp(cmd, "SORTED") == 0) {
+        static const char *const fields[PF_VIEW_COUNT] = { "SYMBOL", "VALUE", "PL", "PCT" };
+        int v = 0, idx[256], got = 0, first = 0, n = 0;
+        while (argc >= 2 && v < PF_VIEW_COUNT && strcmp(argv[1], fields[v]) != 0) ++v;
+        if (argc >= 4) pf_symbol_upper(argv[3]);
+        if ((argc != 3 && argc != 4) || v == PF_VIEW_COUNT || !arg_int(argv[2], &n) || n < 0 ||
+            (argc == 4 && strcmp(argv[3], "DESC") != 0)) {
+            out_printf(c, "ERR usage: SORTED SYMBOL|VALUE|PL|PCT N [DESC]\n");
+            return;
+        }
+        if ((st = pf_view_enable(pf)) != PF_OK) {
+            reply_status(c, st);
+            return;
+        }
+        out_printf(c, "OK %d\n", n < pf->count ? n : pf->count);
+        while (first < n && pf_view_range(pf, (pf_view)v, argc == 4, first,
+                                          n - first < 256 ? n - first : 256, idx, &got) == PF_OK && got) {
+            for (int j = 0; j < got; ++j) {
+                const Stock *s = &pf->items[idx[j]];
+                out_printf(c, "%s %s %d %.10g %.10g\n", s->symbol, pf->fx.codes[s->ccy], s->qty,
+                           s->buy_price, s->cur_price);
+            }
+            first += got;
+        }
+    } else if (strcmp(cmd, "SAVE") == 0) {
+        st = pf_commit_request(pf, PORTFOLIO_FILE, &c->ticket);
+        if (st != PF_OK) {
+            reply_status(c, st);
+        } else {                /* answered by settle_saves() */
+            c->wait_next = waiting;
+            waiting = c;
+        }
+    } else if (strcmp(cmd, "BGSAVE") == 0) {
+        st = pf_bgsave_start(pf, PORTFOLIO_FILE);
+        if (st == PF_ERR_INVALID) out_printf(c, "ERR background save already running\n");
+        else if (st != PF_OK) reply_status(c, st);
+        else out_printf(c, "OK %d\n", pf->count);
+    } else if (strcmp(cmd, "DELTASAVE") == 0) {
+        pf_delta_stats ds;
+        pf_bgsave_stats bs;
+        pf_delta_get(pf, &ds);
+        pf_bgsave_poll(pf, &bs);
+        if (bs.running && (!ds.chained || strcmp(ds.path, PORTFOLIO_FILE) != 0)) {
+            c->deltasave = 1;   /* a base would wait for it: answered by settle_saves() */
+            c->wait_next = waiting;
+            waiting = c;
+        } else {
+            delta_save(pf, c);
+        }
+    } else if (strcmp(cmd, "SAVESTATUS") == 0) {
+        pf_bgsave_stats bs;
+        pf_bgsave_poll(pf, &bs);
+        out_printf(c, "OK %d %ld %ld %.1f %.2f %ld %s\n", bs.running, bs.rows_done, bs.rows_total,
+                   bs.elapsed_sec * 1e3, bs.fork_ms, bs.saves,
+                   bs.saves == 0 ? "none" : bs.last == PF_OK ? "ok" : "failed");
+    } else if (strcmp(cmd, "STATS") == 0) {
+        pf_latency_stats ls[PF_OP_COUNT] = {{0}};
+        int n = 0;
+        for (int op = 0; op < PF_OP_COUNT; ++op)
+            if (pf_latency_get(pf, (pf_op)op, &ls[op]) == PF_OK && ls[op].count) ++n;
+        out_printf(c, "OK %d\n", n);
+        for (int op = 0; op < PF_OP_COUNT && n; ++op) {
+            if (!ls[op].count) continue;
+            out_printf(c, "%s %llu %.0f %.0f %.0f %.0f %.0f %.0f\n", pf_op_name((pf_op)op), ls[op].count,
+                       ls[op].mean_ns, ls[op].p50_ns, ls[op].p90_ns, ls[op].p99_ns, ls[op].p999_ns,
+                       ls[op].max_ns);
+        }
+    } else if (strcmp(cmd, "COUNTERS") == 0) {
+        pf_counter_stats cs[PF_OP_COUNT];
+        int n = 0;
+        if (!pf->counters) {
+            out_printf(c, "ERR counters off\n");
+            return;
+        }
+        for (int op = 0; op < PF_OP_COUNT; ++op)
+            if (pf_counters_get(pf, (pf_op)op, &cs[op]) == PF_OK && cs[op].calls) ++n;
+        out_printf(c, "OK %d\n", n);
+        for (int op = 0; op < PF_OP_COUNT && n; ++op) {
+            if (!cs[op].calls) continue;
+            out_printf(c, "%s %llu", pf_op_name((pf_op)op), cs[op].calls);
+            for (int e = 0; e < PF_CNT_COUNT; ++e) {
+                if (cs[op].available[e]) out_printf(c, " %.1f", (double)cs[op].total[e] / cs[op].calls);
+                else out_printf(c, " -1");
+            }
+            out_printf(c, "\n");
+        }
+    } else if (strcmp(cmd, "MEMORY") == 0) {
+        out_printf(c, "OK %d %ld %ld\n", PF_MEM_COUNT, pf_mem_rss_kb(), pf_mem_peak_rss_kb());
+        for (int m = 0; m < PF_MEM_COUNT; ++m) {
+            pf_mem_stats ms;
+            pf_mem_get((pf_mem_category)m, &ms);
+            out_printf(c, "%s %lld %lld %lld\n", pf_mem_name((pf_mem_category)m), ms.live, ms.peak, ms.blocks);
+        }
+    } else if (strcmp(cmd, "QUIT") == 0) {
+        c->closing = 1;
+    } else {
+        out_printf(c, "ERR unknown command\n");
+    }
+}
+
+/* trace span name: the request's command word, as a literal */
+static const char *command_span(const char *line) {
+    static const char *const names[] = { "BUY", "SELL", "PRICE", "METRICS", "VIEW", "SORTED", "SAVE",
+                                         "BGSAVE", "DELTASAVE", "SAVESTATUS", "STATS", "COUNTERS", "MEMORY", "QUIT" };
+    while (*line == ' ' || *line == '\t') ++line;
+    size_t n = strcspn(line, " \t\r");
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+        if (strlen(names[i]) == n && strncasecmp(line, names[i], n) == 0) return names[i];
+    return "unknown";
+}
+
+/* the book is read on a thread from start-up until the first use of it */
+static void load_finish(Portfolio *pf) {
+    int loaded = 0;
+    if (pf->bgload && pf_load_wait(pf, &loaded, NULL) == PF_OK)
+        printf("Loaded %d entries from %s.\n", loaded, PORTFOLIO_FILE);
+}
+
+static void handle_line(Portfolio *pf, Conn *c, char *line) {
+    load_finish(pf);
+    const char *span = command_span(line);
+    pf_trace_begin(span, "command");
+    dispatch(pf, c, line);
+    pf_trace_end(span, "command");
+}
+
+/* answer every complete line in the input buffer; keeps a partial tail,
+ * and everything after a SAVE or DELTASAVE until that save is on disk */
+static void handle_input(Portfolio *pf, Conn *c) {
+    size_t start = 0;
+    while (!parked(c)) {
+        char *nl = memchr(c->in + start, '\n', c->in_len - start);
+        if (!nl) break;
+        *nl = '\0';
+        if (!c->closing) handle_line(pf, c, c->in + start);
+        start = (size_t)(nl - c->in) + 1;
+    }
+    memmove(c->in, c->in + start, c->in_len - start);
+    c->in_len -= start;
+}
+
+/* ---------- Event loop ---------- */
+
+static void set_events(int ep, Conn *c, int reading, int writing) {
+    if (reading == c->reading && writing == c->writing) return;
+    struct epoll_event ev;
+    ev.events = (reading ? EPOLLIN : 0) | (writing ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+    c->reading = reading;
+    c->writing = writing;
+}
+
+static void close_conn(int ep, Conn *c) {
+    for (Conn **p = &waiting; *p; p = &(*p)->wait_next)
+        if (*p == c) { *p = c->wait_next; break; }
+    epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    pf_mem_free(c->out);
+    pf_mem_free(c);
+}
+
+/* write what the socket takes; returns 0 if the connection died */
+static int flush_out(Conn *c) {
+    while (c->out_off < c->out_len) {
+        ssize_t n = write(c->fd, c->out + c->out_off, c->out_len - c->out_off);
+        if (n > 0) { c->out_off += (size_t)n; continue; }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 1;
+        return 0;
+    }
+    c->out_len = c->out_off = 0;
+    return 1;
+}
+
+/* returns 0 if the connection should be closed */
+static int on_readable(Portfolio *pf, Conn *c) {
+    ssize_t n = read(c->fd, c->in + c->in_len, IN_BUF - c->in_len);
+    if (n == 0) return 0;
+    if (n < 0) return errno == EAGAIN || errno == EINTR;
+    c->in_len += (size_t)n;
+    handle_input(pf, c);
+    if (c->in_len == IN_BUF && !parked(c)) {
+        out_printf(c, "ERR line too long\n");
+        c->closing = 1;
+    }
+    return 1;
+}
+
+/* after reading or resuming: write, then close or re-arm */
+static void service(int ep, Conn *c, int alive) {
+    if (alive) alive = flush_out(c);
+    int pending = c->out_len > c->out_off;
+    if (!alive || (c->closing && !pending)) { close_conn(ep, c); return; }
+    /* backpressure: a client that stops reading stops being read, as
+     * does one waiting on a save */
+    set_events(ep, c, !c->closing && !parked(c) && c->out_len - c->out_off < OUT_HIGH_WATER, pending);
+}
+
+/* save for the parked SAVEs once the window is up and for the parked
+ * DELTASAVEs once no background save runs, neither blocking on one;
+ * answer them and run what their clients sent after; returns ms until
+ * the next commit is due */
+static int settle_saves(Portfolio *pf, int ep, long window_us) {
+    unsigned long settled;
+    long wait_us;
+    pf_bgsave_stats bs;
+    pf_status st = pf_commit_poll(pf, window_us, &settled, &wait_us);
+    pf_bgsave_poll(pf, &bs);
+    Conn *ready = NULL;
+    int held = 0;       /* DELTASAVEs still behind the background save */
+    for (Conn **p = &waiting; *p;) {
+        Conn *c = *p;
+        if (c->deltasave ? bs.running : c->ticket > settled) {
+            held |= c->deltasave;
+            p = &c->wait_next;
+            continue;
+        }
+        *p = c->wait_next;
+        c->wait_next = ready;
+        ready = c;
+    }
+    while (ready) {
+        Conn *c = ready;
+        ready = c->wait_next;
+        if (c->deltasave) {
+            c->deltasave = 0;
+            delta_save(pf, c);
+        } else {
+            c->ticket = 0;
+            if (st != PF_OK) reply_status(c, st);
+            else out_printf(c, "OK %d\n", pf->count);
+        }
+        handle_input(pf, c);
+        service(ep, c, 1);
+    }
+    if (held && (wait_us < 0 || wait_us > DELTASAVE_RETRY_US)) wait_us = DELTASAVE_RETRY_US;
+    return wait_us < 0 ? -1 : (int)((wait_us + 999) / 1000);
+}
+
+static void accept_all(int ep, int lfd) {
+    for (;;) {
+        int fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        Conn *c = pf_mem_calloc(PF_MEM_BUFFERS, 1, sizeof(Conn));
+        if (!c) { close(fd); continue; }
+        c->fd = fd;
+        c->reading = 1;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) != 0) { close(fd); pf_mem_free(c); }
+    }
+}
+
+static int listen_on(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("socket"); return -1; }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        perror("bind/listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* a thousand clients need more descriptors than the usual soft limit */
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : DEFAULT_SOCKET;
+    Portfolio book;
+
+    raise_fd_limit();
+    signal(SIGPIPE, SIG_IGN);
+    /* blocked except inside epoll_pwait(), so a signal that lands while
+     * the loop is busy still wakes the next wait instead of being missed */
+    sigset_t block, wait_mask;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &wait_mask);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;  /* no SA_RESTART: epoll_pwait returns EINTR */
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = on_child;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    long commit_us = getenv("PF_COMMIT_US") ? atol(getenv("PF_COMMIT_US")) : COMMIT_US;
+    if (getenv("PF_TRACE") && pf_trace_start(getenv("PF_TRACE")) != PF_OK) perror("PF_TRACE");
+    pf_trace_thread_name("portfolio-server");
+    pf_init(&book);
+    int every = getenv("PF_LATENCY_EVERY") ? atoi(getenv("PF_LATENCY_EVERY")) : LATENCY_EVERY;
+    if (every > 0) pf_latency_enable(&book, every);
+    if (getenv("PF_COUNTERS") && atoi(getenv("PF_COUNTERS")) > 0 && pf_counters_enable(&book) != PF_OK)
+        fprintf(stderr, "Hardware counters unavailable.\n");
+    book.compress = getenv("PF_COMPRESS") && atoi(getenv("PF_COMPRESS")) > 0;
+    pf_load_fx(&book, FX_FILE, NULL);
+    pf_load_start(&book, PORTFOLIO_FILE);
+
+    pf_feed *feed = NULL;
+    if (argc > 2) {
+        pf_status st = pf_feed_attach(argv[2], &feed);
+        if (st != PF_OK) { fprintf(stderr, "No feed %s: %s\n", argv[2], pf_strerror(st)); return 1; }
+        printf("Following prices on %s\n", argv[2]);
+    }
+
+    int lfd = listen_on(path);
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (lfd < 0 || ep < 0) { pf_free(&book); return 1; }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &ev);
+    printf("Serving on %s\n", path);
+    fflush(stdout);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (!stop_requested) {
+        pf_bgsave_poll(&book, NULL);
+        if (feed) {
+            load_finish(&book);
+            pf_trace_begin("feed poll", "update");
+            pf_feed_poll(feed, &book, 0, NULL);
+            pf_trace_end("feed poll", "update");
+        }
+        int timeout = settle_saves(&book, ep, commit_us);
+        if (feed && (timeout < 0 || timeout > FEED_POLL_MS)) timeout = FEED_POLL_MS;
+        int n = epoll_pwait(ep, events, MAX_EVENTS, timeout, &wait_mask);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_pwait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            Conn *c = events[i].data.ptr;
+            if (!c) { accept_all(ep, lfd); continue; }
+            int alive = 1;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) alive = on_readable(&book, c);
+            service(ep, c, alive);
+        }
+    }
+
+    close(lfd);
+    unlink(path);
+    pf_feed_close(feed);
+    load_finish(&book);
+    pf_delta_stats ds;
+    pf_delta_get(&book, &ds);
+    if ((ds.chained ? pf_save_delta(&book, PORTFOLIO_FILE, NULL) : pf_save(&book, PORTFOLIO_FILE)) == PF_OK)
+        printf("Portfolio saved to %s (%d entries).\n", PORTFOLIO_FILE, book.count);
+    if (pf_trace_dropped() > 0) fprintf(stderr, "Trace dropped %ld events.\n", pf_trace_dropped());
+    pf_trace_stop();
+    pf_free(&book);
+    return 0;
+}
@@ -0,0 +1,264 @@
+/* src/pf_trace.c
+ * Opt-in tracing to Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+ *
+ * - Each thread appends begin/end events to its own single-producer ring.
+ *   Recording takes one clock read and a few stores, with no lock and no
+ *   system call. A full ring drops the event and counts it.
+ * - A background thread drains every ring every TRACE_FLUSH_MS and
+ *   formats the JSON, so file I/O never runs on a traced thread. A ring
+ *   that reaches half full wakes it early.
+ * - Rings outlive their threads: when a thread exits, its ring is handed
+ *   to the next new thread, so short-lived workers do not pile up memory.
+ */
+
+#define _GNU_SOURCE /* gettid via syscall */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "portfolio.h"
+#include "pf_internal.h"
+
+/* events per thread, a power of two: with 32-byte events on LP64 a ring
+ * is 2 MiB plus its header, kept for the life of the process (a thread
+ * that exits leaves its ring to the next one) */
+#define TRACE_RING 65536
+#define TRACE_FLUSH_MS 50
+#define TRACE_OUT_BUF (1 << 20)
+
+typedef struct {
+    uint64_t ts;                /* CLOCK_MONOTONIC ns */
+    const char *name, *cat;
+    int tid;
+    char ph;                    /* 'B', 'E' or 'M' (thread name) */
+} TraceEvent;
+
+typedef struct TraceRing {
+    _Atomic uint64_t head;      /* written by the owning thread */
+    char pad0[64 - sizeof(uint64_t)];
+    _Atomic uint64_t tail;      /* written by the flusher */
+    char pad1[64 - sizeof(uint64_t)];
+    atomic_int in_use;          /* owned by a live thread */
+    int tid;
+    struct TraceRing *next;
+    TraceEvent ev[TRACE_RING];
+} TraceRing;
+
+static _Atomic(TraceRing *) rings;     /* every ring ever made; never freed */
+static atomic_int active;
+volatile int pf_trace_on;              /* mirrors active for pf_core.c's inline check */
+static atomic_long dropped;
+static _Thread_local TraceRing *my_ring;
+static pthread_key_t ring_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+static FILE *out;
+static int nwritten;
+static uint64_t t_start;
+static pthread_t flusher;
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond = PTHREAD_COND_INITIALIZER;
+static int stopping;
+
+static uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void release_ring(void *p) {
+    atomic_store_explicit(&((TraceRing *)p)->in_use, 0, memory_order_release);
+}
+
+static void make_key(void) { pthread_key_create(&ring_key, release_ring); }
+
+/* this thread's ring: a released one if any, else a new one */
+static TraceRing *thread_ring(void) {
+    if (my_ring) return my_ring;
+    pthread_once(&key_once, make_key);
+    TraceRing *r;
+    for (r = atomic_load(&rings); r; r = r->next) {
+        int idle = 0;
+        if (atomic_compare_exchange_strong(&r->in_use, &idle, 1)) break;
+    }
+    if (!r) {
+        r = pf_mem_calloc(PF_MEM_INSTRUMENTATION, 1, sizeof(*r));
+        if (!r) return NULL;
+        atomic_store(&r->in_use, 1);
+        r->next = atomic_load(&rings);
+        while (!atomic_compare_exchange_weak(&rings, &r->next, r)) { }
+    }
+    r->tid = (int)syscall(SYS_gettid);
+    pthread_setspecific(ring_key, r);
+    my_ring = r;
+    return r;
+}
+
+static void wake_flusher(void) {
+    pthread_mutex_lock(&flush_lock);
+    pthread_cond_signal(&flush_cond);
+    pthread_mutex_unlock(&flush_lock);
+}
+
+static void record(char ph, const char *name, const char *cat) {
+    TraceRing *r = thread_ring();
+    if (!r) { atomic_fetch_add(&dropped, 1); return; }
+    uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint64_t used = h - atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (used >= TRACE_RING) {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+    if (used == TRACE_RING / 2) wake_flusher();
+    TraceEvent *e = &r->ev[h & (TRACE_RING - 1)];
+    e->ts = trace_now();
+    e->name = name;
+    e->cat = cat;
+    e->tid = r->tid;
+    e->ph = ph;
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+void pf_trace_begin(const char *name, const char *cat) {
+    if (atomic_load_explicit(&active, memory_order_relaxed)) record('B', name, cat);
+}
+
+void pf_trace_end(const char *name, const char *cat) {
+    if (atomic_load_explicit(&active, memory_order_relaxed)) record('E', name, cat);
+}
+
+void pf_trace_thread_name(const char *name) {
+    if (atomic_load_explicit(&active, memory_order_relaxed)) record('M', name, "");
+}
+
+long pf_trace_dropped(void) { return atomic_load(&dropped); }
+
+/* ---------- Flushing ---------- */
+
+/* JSON is formatted by hand into a block buffer: the flusher has to keep
+ * up with every traced thread, and on one CPU it shares their core */
+static char obuf[TRACE_OUT_BUF];
+static size_t olen;
+
+static void put_raw(const char *s, size_t n) {
+    if (olen + n > sizeof(obuf)) { fwrite(obuf, 1, olen, out); olen = 0; }
+    memcpy(obuf + olen, s, n);
+    olen += n;
+}
+
+static void put_lit(const char *s) { put_raw(s, strlen(s)); }
+
+static void put_string(const char *s) {
+    char tmp[256];
+    size_t n = 0;
+    tmp[n++] = '"';
+    for (; *s && n < sizeof(tmp) - 3; ++s) {
+        if (*s == '"' || *s == '\\') tmp[n++] = '\\';
+        if ((unsigned char)*s >= 0x20) tmp[n++] = *s;
+    }
+    tmp[n++] = '"';
+    put_raw(tmp, n);
+}
+
+static void put_u64(uint64_t v) {
+    char tmp[24];
+    int n = 0;
+    do { tmp[sizeof(tmp) - 1 - n++] = (char)('0' + v % 10); v /= 10; } while (v);
+    put_raw(tmp + sizeof(tmp) - n, (size_t)n);
+}
+
+static void write_event(const TraceEvent *e, uint64_t pid) {
+    put_lit(nwritten++ ? ",\n{\"name\":" : "\n{\"name\":");
+    if (e->ph == 'M') {
+        put_lit("\"thread_name\",\"ph\":\"M\",\"args\":{\"name\":");
+        put_string(e->name);
+        put_lit("}");
+    } else {
+        uint64_t rel = e->ts > t_start ? e->ts - t_start : 0;
+        char frac[4] = { '.', (char)('0' + rel / 100 % 10), (char)('0' + rel / 10 % 10),
+                         (char)('0' + rel % 10) };
+        put_string(e->name);
+        put_lit(",\"cat\":");
+        put_string(e->cat);
+        put_lit(e->ph == 'B' ? ",\"ph\":\"B\",\"ts\":" : ",\"ph\":\"E\",\"ts\":");
+        put_u64(rel / 1000);
+        put_raw(frac, sizeof(frac));
+    }
+    put_lit(",\"pid\":");
+    put_u64(pid);
+    put_lit(",\"tid\":");
+    put_u64((uint64_t)e->tid);
+    put_lit("}");
+}
+
+static void drain(void) {
+    uint64_t pid = (uint64_t)getpid();
+    for (TraceRing *r = atomic_load(&rings); r; r = r->next) {
+        uint64_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        uint64_t h = atomic_load_explicit(&r->head, memory_order_acquire);
+        for (; t != h; ++t) write_event(&r->ev[t & (TRACE_RING - 1)], pid);
+        atomic_store_explicit(&r->tail, t, memory_order_release);
+    }
+    fwrite(obuf, 1, olen, out);
+    olen = 0;
+}
+
+static void *flush_loop(void *unused) {
+    (void)unused;
+    pthread_mutex_lock(&flush_lock);
+    while (!stopping) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += TRACE_FLUSH_MS * 1000000L;
+        if (until.tv_nsec >= 1000000000L) { until.tv_sec++; until.tv_nsec -= 1000000000L; }
+        pthread_cond_timedwait(&flush_cond, &flush_lock, &until);
+        pthread_mutex_unlock(&flush_lock);
+        drain();
+        pthread_mutex_lock(&flush_lock);
+    }
+    pthread_mutex_unlock(&flush_lock);
+    return NULL;
+}
+
+pf_status pf_trace_start(const char *path) {
+    if (atomic_load(&active) || out) return PF_ERR_INVALID;
+    out = fopen(path, "w");
+    if (!out) return PF_ERR_IO;
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out);
+    nwritten = 0;
+    stopping = 0;
+    atomic_store(&dropped, 0);
+    /* events left from an earlier trace are discarded */
+    for (TraceRing *r = atomic_load(&rings); r; r = r->next) atomic_store(&r->tail, atomic_load(&r->head));
+    t_start = trace_now();
+    if (pthread_create(&flusher, NULL, flush_loop, NULL) != 0) {
+        fclose(out);
+        out = NULL;
+        return PF_ERR_NOMEM;
+    }
+    atomic_store(&active, 1);
+    pf_trace_on = 1;
+    return PF_OK;
+}
+
+pf_status pf_trace_stop(void) {
+    if (!out) return PF_ERR_INVALID;
+    pf_trace_on = 0;
+    atomic_store(&active, 0);
+    pthread_mutex_lock(&flush_lock);
+    stopping = 1;
+    pthread_cond_signal(&flush_cond);
+    pthread_mutex_unlock(&flush_lock);
+    pthread_join(flusher, NULL);
+    drain();
+    fprintf(out, "\n],\"otherData\":{\"dropped_events\":%ld}}\n", pf_trace_dropped());
+    int ok = fclose(out) == 0;
+    out = NULL;
+    return ok ? PF_OK : PF_ERR_IO;
+}
@@ -0,0 +1,433 @@
+/* src/pf_view.c
+ * Sorted views of the holdings: one treap per ordering, with subtree
+ * sizes so a rank is found in O(log n).
+ *
+ * - Node ids are position indices, so the trees need no id maps. The
+ *   treaps only hold links, sizes, priorities and cached metric keys.
+ * - Metric keys are cached per node: a changed row is taken out under its
+ *   old key and put back under the new one.
+ * - Equal keys are ordered by symbol, then by index, so each node has
+ *   exactly one place in each tree.
+ * - A fifth tree orders symbols by their reversed text, so a pattern's
+ *   literal suffix ("*.L") is a contiguous range just as a literal prefix
+ *   ("BRK*") is in the symbol tree.
+ * - Anything that changes many rows at once (loads, compaction, FX
+ *   rates, direct edits) marks the views stale. The next query rebuilds
+ *   them in O(n log n) by sorting, then O(n) to build the trees.
+ */
+
+#define _GNU_SOURCE /* qsort_r */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "portfolio.h"
+#include "pf_internal.h"
+
+typedef struct {
+    int root;
+    int *l, *r, *size;
+    double *key;            /* NULL for the symbol and suffix trees */
+} Treap;
+
+#define SUFFIX_TREE PF_VIEW_COUNT   /* internal: symbols compared from the end */
+#define NTREES (PF_VIEW_COUNT + 1)
+#define PATTERN_MAX 64
+
+struct pf_views {
+    int n;                  /* nodes in the trees */
+    int cap;
+    int stale;
+    uint64_t rng;
+    uint32_t *prio;
+    Treap t[NTREES];
+};
+
+static double row_key(const Portfolio *pf, pf_view v, int i) {
+    const Stock *s = &pf->items[i];
+    double mv = s->cur_price * s->qty, cost = s->buy_price * s->qty;
+    switch (v) {
+    case PF_VIEW_VALUE: return mv * pf->fx.conv[s->ccy];
+    case PF_VIEW_PL: return (mv - cost) * pf->fx.conv[s->ccy];
+    case PF_VIEW_PL_PCT: return cost == 0.0 ? 0.0 : (mv - cost) / cost * 100.0;
+    default: return 0.0;
+    }
+}
+
+static uint32_t next_prio(struct pf_views *w) {
+    w->rng ^= w->rng << 13;
+    w->rng ^= w->rng >> 7;
+    w->rng ^= w->rng << 17;
+    return (uint32_t)(w->rng >> 32);
+}
+
+/* strcmp of the reversed strings */
+static int suffix_cmp(const char *a, const char *b) {
+    size_t i = strlen(a), j = strlen(b);
+    while (i && j) {
+        unsigned char ca = (unsigned char)a[--i], cb = (unsigned char)b[--j];
+        if (ca != cb) return ca < cb ? -1 : 1;
+    }
+    return (i > 0) - (j > 0);
+}
+
+/* node a sorts before node b */
+static int before(const Portfolio *pf, const struct pf_views *w, const Treap *t, int a, int b) {
+    if (t->key && t->key[a] != t->key[b]) return t->key[a] < t->key[b];
+    int c = t == &w->t[SUFFIX_TREE] ? suffix_cmp(pf->items[a].symbol, pf->items[b].symbol)
+                                    : strcmp(pf->items[a].symbol, pf->items[b].symbol);
+    return c ? c < 0 : a < b;
+}
+
+static inline int size_of(const Treap *t, int x) { return x < 0 ? 0 : t->size[x]; }
+
+static inline void pull(Treap *t, int x) { t->size[x] = 1 + size_of(t, t->l[x]) + size_of(t, t->r[x]); }
+
+/* split x into nodes before k and the rest */
+static void split(const Portfolio *pf, const struct pf_views *w, Treap *t, int x, int k, int *a, int *b) {
+    if (x < 0) { *a = *b = -1; return; }
+    if (before(pf, w, t, x, k)) {
+        split(pf, w, t, t->r[x], k, &t->r[x], b);
+        *a = x;
+    } else {
+        split(pf, w, t, t->l[x], k, a, &t->l[x]);
+        *b = x;
+    }
+    pull(t, x);
+}
+
+/* every node of a sorts before every node of b */
+static int merge(const struct pf_views *w, Treap *t, int a, int b) {
+    if (a < 0) return b;
+    if (b < 0) return a;
+    if (w->prio[a] > w->prio[b]) {
+        t->r[a] = merge(w, t, t->r[a], b);
+        pull(t, a);
+        return a;
+    }
+    t->l[b] = merge(w, t, a, t->l[b]);
+    pull(t, b);
+    return b;
+}
+
+static int insert(const Portfolio *pf, const struct pf_views *w, Treap *t, int x, int k) {
+    if (x < 0 || w->prio[k] > w->prio[x]) {
+        split(pf, w, t, x, k, &t->l[k], &t->r[k]);
+        pull(t, k);
+        return k;
+    }
+    if (before(pf, w, t, k, x)) t->l[x] = insert(pf, w, t, t->l[x], k);
+    else t->r[x] = insert(pf, w, t, t->r[x], k);
+    pull(t, x);
+    return x;
+}
+
+static int erase(const Portfolio *pf, const struct pf_views *w, Treap *t, int x, int k) {
+    if (x < 0) return -1;
+    if (x == k) return merge(w, t, t->l[k], t->r[k]);
+    if (before(pf, w, t, k, x)) t->l[x] = erase(pf, w, t, t->l[x], k);
+    else t->r[x] = erase(pf, w, t, t->r[x], k);
+    pull(t, x);
+    return x;
+}
+
+static int grow(struct pf_views *w, int n) {
+    if (n <= w->cap) return 1;
+    int cap = w->cap ? w->cap : 1024;
+    while (cap < n) cap *= 2;
+    void *p = pf_mem_realloc(PF_MEM_INDEX, w->prio, (size_t)cap * sizeof(*w->prio));
+    if (!p) return 0;
+    w->prio = p;
+    for (int v = 0; v < NTREES; ++v) {
+        Treap *t = &w->t[v];
+        int **links[3] = { &t->l, &t->r, &t->size };
+        for (int j = 0; j < 3; ++j) {
+            p = pf_mem_realloc(PF_MEM_INDEX, *links[j], (size_t)cap * sizeof(int));
+            if (!p) return 0;
+            *links[j] = p;
+        }
+        if (v != PF_VIEW_SYMBOL && v != SUFFIX_TREE) {
+            p = pf_mem_realloc(PF_MEM_INDEX, t->key, (size_t)cap * sizeof(double));
+            if (!p) return 0;
+            t->key = p;
+        }
+    }
+    w->cap = cap;
+    return 1;
+}
+
+/* ---------- Rebuild ---------- */
+
+typedef struct {
+    double key;
+    const char *sym;
+    int idx;
+} SortRow;
+
+static int cmp_row(const void *pa, const void *pb) {
+    const SortRow *a = pa, *b = pb;
+    if (a->key != b->key) return a->key < b->key ? -1 : 1;
+    int c = strcmp(a->sym, b->sym);
+    return c ? c : (a->idx > b->idx) - (a->idx < b->idx);
+}
+
+static int cmp_row_suffix(const void *pa, const void *pb) {
+    const SortRow *a = pa, *b = pb;
+    int c = suffix_cmp(a->sym, b->sym);
+    return c ? c : (a->idx > b->idx) - (a->idx < b->idx);
+}
+
+static int fix_sizes(Treap *t, int x) {
+    if (x < 0) return 0;
+    t->size[x] = 1 + fix_sizes(t, t->l[x]) + fix_sizes(t, t->r[x]);
+    return t->size[x];
+}
+
+/* sort, then build the Cartesian tree of (order, priority) with a stack */
+static int rebuild(Portfolio *pf, struct pf_views *w) {
+    int n = pf->count;
+    if (!grow(w, n)) return 0;
+    SortRow *rows = pf_mem_alloc(PF_MEM_INDEX, (size_t)(n ? n : 1) * sizeof(SortRow));
+    int *stack = pf_mem_alloc(PF_MEM_INDEX, (size_t)(n ? n : 1) * sizeof(int));
+    if (!rows || !stack) { pf_mem_free(rows); pf_mem_free(stack); return 0; }
+    for (int i = 0; i < n; ++i) w->prio[i] = next_prio(w);
+    for (int v = 0; v < NTREES; ++v) {
+        Treap *t = &w->t[v];
+        for (int i = 0; i < n; ++i) {
+            rows[i].key = t->key ? (t->key[i] = row_key(pf, (pf_view)v, i)) : 0.0;
+            rows[i].sym = pf->items[i].symbol;
+            rows[i].idx = i;
+        }
+        qsort(rows, (size_t)n, sizeof(SortRow), v == SUFFIX_TREE ? cmp_row_suffix : cmp_row);
+        int top = 0;
+        for (int j = 0; j < n; ++j) {
+            int x = rows[j].idx, last = -1;
+            while (top && w->prio[stack[top - 1]] < w->prio[x]) last = stack[--top];
+            t->l[x] = last;
+            t->r[x] = -1;
+            if (top) t->r[stack[top - 1]] = x;
+            stack[top++] = x;
+        }
+        t->root = top ? stack[0] : -1;
+        fix_sizes(t, t->root);
+    }
+    pf_mem_free(rows);
+    pf_mem_free(stack);
+    w->n = n;
+    w->stale = 0;
+    return 1;
+}
+
+/* ---------- Hooks from pf_core.c ---------- */
+
+void pf_view_invalidate(Portfolio *pf) {
+    if (pf->views) pf->views->stale = 1;
+}
+
+/* position idx was appended */
+void pf_view_inserted(Portfolio *pf, int idx) {
+    struct pf_views *w = pf->views;
+    if (!w || w->stale) return;
+    if (idx != w->n || !grow(w, idx + 1)) { w->stale = 1; return; }
+    w->prio[idx] = next_prio(w);
+    for (int v = 0; v < NTREES; ++v) {
+        Treap *t = &w->t[v];
+        if (t->key) t->key[idx] = row_key(pf, (pf_view)v, idx);
+        t->l[idx] = t->r[idx] = -1;
+        t->size[idx] = 1;
+        t->root = insert(pf, w, t, t->root, idx);
+    }
+    w->n++;
+}
+
+/* qty or a price of position idx changed: only the metric trees move */
+void pf_view_updated(Portfolio *pf, int idx) {
+    struct pf_views *w = pf->views;
+    if (!w || w->stale) return;
+    for (int v = 0; v < NTREES; ++v) {
+        Treap *t = &w->t[v];
+        if (!t->key) continue;
+        double k = row_key(pf, (pf_view)v, idx);
+        if (k == t->key[idx]) continue;
+        t->root = erase(pf, w, t, t->root, idx);
+        t->key[idx] = k;
+        t->l[idx] = t->r[idx] = -1;
+        t->size[idx] = 1;
+        t->root = insert(pf, w, t, t->root, idx);
+    }
+}
+
+/* position idx is about to be removed and the ones after it shifted
+ * down: O(n), like the shift of the holdings itself */
+void pf_view_removed(Portfolio *pf, int idx) {
+    struct pf_views *w = pf->views;
+    if (!w || w->stale) return;
+    int tail = w->n - idx - 1;
+    for (int v = 0; v < NTREES; ++v) {
+        Treap *t = &w->t[v];
+        t->root = erase(pf, w, t, t->root, idx);
+        memmove(&t->l[idx], &t->l[idx + 1], (size_t)tail * sizeof(int));
+        memmove(&t->r[idx], &t->r[idx + 1], (size_t)tail * sizeof(int));
+        memmove(&t->size[idx], &t->size[idx + 1], (size_t)tail * sizeof(int));
+        if (t->key) memmove(&t->key[idx], &t->key[idx + 1], (size_t)tail * sizeof(double));
+        for (int i = 0; i < w->n - 1; ++i) {
+            t->l[i] -= t->l[i] > idx;
+            t->r[i] -= t->r[i] > idx;
+        }
+        t->root -= t->root > idx;
+    }
+    memmove(&w->prio[idx], &w->prio[idx + 1], (size_t)tail * sizeof(*w->prio));
+    w->n--;
+}
+
+/* ---------- Queries ---------- */
+
+pf_status pf_view_enable(Portfolio *pf) {
+    pf_load_settle(pf);
+    if (!pf->views) {
+        pf->views = pf_mem_calloc(PF_MEM_INDEX, 1, sizeof(*pf->views));
+        if (!pf->views) return PF_ERR_NOMEM;
+        pf->views->rng = 0x9e3779b97f4a7c15ULL;
+        pf->views->stale = 1;
+        for (int v = 0; v < NTREES; ++v) pf->views->t[v].root = -1;
+    }
+    if (pf->views->stale && !rebuild(pf, pf->views)) return PF_ERR_NOMEM;
+    return PF_OK;
+}
+
+void pf_view_disable(Portfolio *pf) {
+    struct pf_views *w = pf->views;
+    if (!w) return;
+    for (int v = 0; v < NTREES; ++v) {
+        pf_mem_free(w->t[v].l);
+        pf_mem_free(w->t[v].r);
+        pf_mem_free(w->t[v].size);
+        pf_mem_free(w->t[v].key);
+    }
+    pf_mem_free(w->prio);
+    pf_mem_free(w);
+    pf->views = NULL;
+}
+
+const char *pf_view_name(pf_view v) {
+    static const char *names[PF_VIEW_COUNT] = { "symbol", "market value", "P/L", "P/L%" };
+    return (unsigned)v < PF_VIEW_COUNT ? names[v] : "?";
+}
+
+/* in-order walk from the near side, skipping the first *skip nodes */
+static void collect(const Treap *t, int x, int desc, int *skip, int n, int *idx, int *got) {
+    while (x >= 0 && *got < n) {
+        int near = desc ? t->r[x] : t->l[x], far = desc ? t->l[x] : t->r[x];
+        if (*skip >= size_of(t, near)) *skip -= size_of(t, near);
+        else collect(t, near, desc, skip, n, idx, got);
+        if (*got >= n) return;
+        if (*skip > 0) --*skip;
+        else idx[(*got)++] = x;
+        x = far;
+    }
+}
+
+pf_status pf_view_range(Portfolio *pf, pf_view v, int desc, int first, int n, int *idx, int *got) {
+    *got = 0;
+    if ((unsigned)v >= PF_VIEW_COUNT || first < 0 || n < 0) return PF_ERR_INVALID;
+    pf_status st = pf_view_enable(pf);
+    if (st != PF_OK) return st;
+    int skip = first;
+    collect(&pf->views->t[v], pf->views->t[v].root, desc, &skip, n, idx, got);
+    return PF_OK;
+}
+
+/* ---------- Pattern search ---------- */
+
+/* '*' matches any run of characters, '?' any one */
+static int glob_match(const char *p, const char *s) {
+    const char *star = NULL, *resume = NULL;
+    while (*s) {
+        if (*p == '?' || (*p && *p != '*' && *p == *s)) { ++p; ++s; }
+        else if (*p == '*') { star = p++; resume = s; }
+        else if (star) { p = star + 1; s = ++resume; }
+        else return 0;
+    }
+    while (*p == '*') ++p;
+    return *p == '\0';
+}
+
+/* sym against a literal: <0, 0 (sym starts with lit) or >0 */
+static int prefix_order(const char *sym, const char *lit, size_t n) {
+    return strncmp(sym, lit, n);
+}
+
+/* the same from the end: 0 when sym ends with lit */
+static int suffix_order(const char *sym, const char *lit, size_t n) {
+    size_t ls = strlen(sym);
+    for (size_t k = 0; k < n; ++k) {
+        if (k >= ls) return -1;
+        unsigned char a = (unsigned char)sym[ls - 1 - k], b = (unsigned char)lit[n - 1 - k];
+        if (a != b) return a < b ? -1 : 1;
+    }
+    return 0;
+}
+
+/* nodes whose order against lit is below 0 (upto 0) or at most 0 (upto 1) */
+static int rank_of(const Portfolio *pf, const Treap *t, int suffix, const char *lit, size_t n, int upto) {
+    int rank = 0;
+    for (int x = t->root; x >= 0;) {
+        const char *sym = pf->items[x].symbol;
+        int c = suffix ? suffix_order(sym, lit, n) : prefix_order(sym, lit, n);
+        if (c < upto) { rank += size_of(t, t->l[x]) + 1; x = t->r[x]; }
+        else x = t->l[x];
+    }
+    return rank;
+}
+
+static int cmp_symbol_idx(const void *pa, const void *pb, void *arg) {
+    const Portfolio *pf = arg;
+    return strcmp(pf->items[*(const int *)pa].symbol, pf->items[*(const int *)pb].symbol);
+}
+
+pf_status pf_search(Portfolio *pf, const char *pattern, int *idx, int max, int *matched) {
+    char pat[PATTERN_MAX];
+    *matched = 0;
+    if (!pattern || !*pattern || strlen(pattern) >= sizeof(pat) || max < 0) return PF_ERR_INVALID;
+    snprintf(pat, sizeof(pat), "%s", pattern);
+    pf_symbol_upper(pat);
+    pf_status st = pf_view_enable(pf);
+    if (st != PF_OK) return st;
+    struct pf_views *w = pf->views;
+
+    /* literal prefix and suffix narrow the candidates to a rank range */
+    size_t len = strlen(pat), np = strcspn(pat, "*?"), ns = 0;
+    while (ns < len && pat[len - 1 - ns] != '*' && pat[len - 1 - ns] != '?') ++ns;
+    const Treap *pt = &w->t[PF_VIEW_SYMBOL], *stt = &w->t[SUFFIX_TREE];
+    int plo = rank_of(pf, pt, 0, pat, np, 0), phi = rank_of(pf, pt, 0, pat, np, 1);
+    int slo = rank_of(pf, stt, 1, pat + len - ns, ns, 0), shi = rank_of(pf, stt, 1, pat + len - ns, ns, 1);
+    int by_suffix = shi - slo < phi - plo;
+    const Treap *t = by_suffix ? stt : pt;
+    int first = by_suffix ? slo : plo, last = by_suffix ? shi : phi;
+
+    /* walk the range in chunks; suffix order is not symbol order, so
+     * those matches are all kept and sorted before the cut to max */
+    int keep = !idx || max == 0 ? 0 : by_suffix ? last - first : max;     /* 0: only count */
+    int *out = by_suffix && keep ? pf_mem_alloc(PF_MEM_INDEX, (size_t)keep * sizeof(int)) : idx;
+    if (keep && !out) return PF_ERR_NOMEM;
+    int chunk[256], got, nkept = 0;
+    while (first < last) {
+        int skip = first;
+        got = 0;
+        collect(t, t->root, 0, &skip, last - first < 256 ? last - first : 256, chunk, &got);
+        if (got == 0) break;
+        for (int j = 0; j < got; ++j) {
+            if (!glob_match(pat, pf->items[chunk[j]].symbol)) continue;
+            if (nkept < keep) out[nkept++] = chunk[j];
+            ++*matched;
+        }
+        first += got;
+    }
+    if (by_suffix && keep) {
+        qsort_r(out, (size_t)nkept, sizeof(int), cmp_symbol_idx, pf);
+        memcpy(idx, out, (size_t)(nkept < max ? nkept : max) * sizeof(int));
+        pf_mem_free(out);
+    }
+    return PF_OK;
+}
@@ -1,5 +1,5 @@
 /* src/portfolio.c
- * Complete Portfolio Simulator (single-file)
+ * Complete Portfolio Simulator (menu client)
  *
  * Person A: core (view, metrics, helpers)
  * Person B: buy / sell
@@ -9,38 +9,58 @@
  * Notes:
  * - Simple, robust input handling using fgets + parsing helpers.
  * - Symbols normalized to uppercase.
+ * - Book keeping lives in the portfolio library (portfolio.h, pf_core.c);
+ *   this file prompts, calls it and prints the outcome.
+ * - No global book: every operation takes a Portfolio, so one process
+ *   can hold many books and work on them from separate threads.
  * - Saves/loads to 'portfolio.txt' in working directory.
+ * - Risk analytics read daily prices from 'history.txt'.
+ *
+ * Build: make   (or: gcc -O2 -pthread src/portfolio.c src/pf_core.c src/pf_feed.c src/pf_trace.c
+ *                    src/pf_mem.c src/pf_view.c src/pf_persist.c src/pf_lz.c
+ *                    -o portfolio -lm -lrt)
  */
 
+#define _GNU_SOURCE /* fopencookie */
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "portfolio.h"
 
-#define MAX_STOCKS 100
-#define SYMBOL_LEN 16
+#define SYMBOL_LEN PF_SYMBOL_LEN
 #define LINE_BUF 128
+#define PORTFOLIO_FILE "portfolio.txt"
+#define HISTORY_FILE "history.txt"
+#define TARGETS_FILE "targets.txt"
+#define FX_FILE "fx.txt"
+#define MAX_CCY PF_MAX_CCY
+#define MAX_THREADS 64
+#define LATENCY_EVERY 8    /* time one call in 8 unless PF_LATENCY_EVERY says otherwise */
 
+/* One run of the menu: its command-line options and what main() keeps
+ * between commands */
 typedef struct {
-    char symbol[SYMBOL_LEN];
-    int qty;
-    double buy_price;
-    double cur_price;
-} Stock;
-
-/* Global portfolio array (non-static for simplicity) */
-Stock portfolio[MAX_STOCKS];
-int count = 0;
+    FILE *record;           /* --record: input is copied here as it is read */
+    const char *stats_file; /* --stats */
+    long bgsaves_seen;      /* background saves already reported */
+} Session;
 
 /* ---------- Internal helpers ---------- */
 
-static void strtoupper(char *s) {
-    for (; *s; ++s) *s = (char) toupper((unsigned char)*s);
-}
-
 /* safe line input, returns 1 on success, 0 on EOF */
 static int get_line(char *buf, size_t n) {
-    if (fgets(buf, (int)n, stdin) == NULL) return 0;
+    pf_trace_begin("read input", "parse");
+    char *got = fgets(buf, (int)n, stdin);
+    pf_trace_end("read input", "parse");
+    if (got == NULL) return 0;
     size_t len = strlen(buf);
     if (len > 0 && buf[len-1] == '\n') buf[len-1] = '\0';
     return 1;
@@ -64,58 +84,264 @@ static int parse_double(const char *s, double *out) {
     return 1;
 }
 
-/* Find index by symbol (stored uppercase) */
-static int find_index(const char *sym) {
-    for (int i = 0; i < count; ++i) {
-        if (strcmp(portfolio[i].symbol, sym) == 0) return i;
+/* a symbol and its index; sorting these needs no global context */
+typedef struct {
+    const char *sym;
+    int idx;
+} SymRef;
+
+static int cmp_symref(const void *a, const void *b) {
+    return strcmp(((const SymRef *)a)->sym, ((const SymRef *)b)->sym);
+}
+
+/* holdings sorted by symbol, for joins and O(log n) lookups; caller frees */
+static SymRef *sorted_positions(const Portfolio *pf) {
+    SymRef *refs = pf_mem_alloc(PF_MEM_INDEX, (size_t)(pf->count ? pf->count : 1) * sizeof(SymRef));
+    if (!refs) return NULL;
+    for (int i = 0; i < pf->count; ++i) {
+        refs[i].sym = pf->items[i].symbol;
+        refs[i].idx = i;
+    }
+    qsort(refs, (size_t)pf->count, sizeof(SymRef), cmp_symref);
+    return refs;
+}
+
+/* index stored with sym in a sorted SymRef array, or -1 */
+static int lookup_sorted(const SymRef *refs, int n, const char *sym) {
+    int lo = 0, hi = n - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        int c = strcmp(refs[mid].sym, sym);
+        if (c == 0) return refs[mid].idx;
+        if (c < 0) lo = mid + 1; else hi = mid - 1;
     }
     return -1;
 }
 
+/* prompt for an int; empty input keeps the default. returns 1 on success */
+static int prompt_int(const char *prompt, int def, int *out) {
+    char line[LINE_BUF];
+    printf("%s", prompt);
+    if (!get_line(line, sizeof(line))) return 0;
+    if (strlen(line) == 0) { *out = def; return 1; }
+    return parse_int(line, out);
+}
+
+/* prompt for a double; empty input keeps the default. returns 1 on success */
+static int prompt_double(const char *prompt, double def, double *out) {
+    char line[LINE_BUF];
+    printf("%s", prompt);
+    if (!get_line(line, sizeof(line))) return 0;
+    if (strlen(line) == 0) { *out = def; return 1; }
+    return parse_double(line, out);
+}
+
+/* ---------- Shared numeric helpers (threads, kernels, RNG) ---------- */
+
+typedef void (*range_fn)(void *arg, int begin, int end);
+
+typedef struct {
+    range_fn fn;
+    void *arg;
+    int begin, end;
+} RangeTask;
+
+static void *range_thread(void *p) {
+    RangeTask *t = (RangeTask *)p;
+    pf_trace_begin("worker range", "compute");
+    t->fn(t->arg, t->begin, t->end);
+    pf_trace_end("worker range", "compute");
+    return NULL;
+}
+
+/* worker count: online CPUs, or PF_THREADS if set */
+static int num_threads(void) {
+    const char *env = getenv("PF_THREADS");
+    int n = 0;
+    if (env == NULL || !parse_int(env, &n) || n <= 0) {
+        long c = sysconf(_SC_NPROCESSORS_ONLN);
+        n = (c > 0) ? (int)c : 1;
+    }
+    return n > MAX_THREADS ? MAX_THREADS : n;
+}
+
+/* Run fn over [0, n) split into contiguous chunks of at least `grain`
+ * items, one chunk per thread. The caller runs the first chunk itself. */
+static void parallel_for(int n, int grain, range_fn fn, void *arg) {
+    if (n <= 0) return;
+    if (grain < 1) grain = 1;
+    int nt = num_threads();
+    int chunks = (n + grain - 1) / grain;
+    if (nt > chunks) nt = chunks;
+    if (nt <= 1) { fn(arg, 0, n); return; }
+
+    pthread_t tid[MAX_THREADS];
+    RangeTask task[MAX_THREADS];
+    int started[MAX_THREADS];
+    for (int t = 0; t < nt; ++t) {
+        task[t].fn = fn;
+        task[t].arg = arg;
+        task[t].begin = (int)((long long)n * t / nt);
+        task[t].end = (int)((long long)n * (t + 1) / nt);
+    }
+    for (int t = 1; t < nt; ++t)
+        started[t] = (pthread_create(&tid[t], NULL, range_thread, &task[t]) == 0);
+    fn(arg, task[0].begin, task[0].end);
+    for (int t = 1; t < nt; ++t) {
+        if (started[t]) pthread_join(tid[t], NULL);
+        else fn(arg, task[t].begin, task[t].end); /* could not spawn: run inline */
+    }
+}
+
+/* dot product with independent accumulators so the loop vectorizes */
+static double dot(const double *restrict a, const double *restrict b, int n) {
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; ++i) s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+#define GEMV_COL_BLOCK 2048 /* 16 KB slice of x stays in L1 across rows */
+
+typedef struct {
+    const double *a, *x;
+    double *y;
+    int cols;
+} GemvArgs;
+
+static void gemv_range(void *p, int r0, int r1) {
+    GemvArgs *g = (GemvArgs *)p;
+    for (int r = r0; r < r1; ++r) g->y[r] = 0.0;
+    for (int c0 = 0; c0 < g->cols; c0 += GEMV_COL_BLOCK) {
+        int w = g->cols - c0 < GEMV_COL_BLOCK ? g->cols - c0 : GEMV_COL_BLOCK;
+        for (int r = r0; r < r1; ++r)
+            g->y[r] += dot(g->a + (size_t)r * g->cols + c0, g->x + c0, w);
+    }
+}
+
+/* y = A x for row-major A (rows x cols); rows are split across threads */
+static void gemv(const double *a, int rows, int cols, const double *x, double *y) {
+    GemvArgs g = { a, x, y, cols };
+    parallel_for(rows, 64, gemv_range, &g);
+}
+
+/* k-th smallest (0-based) of v[0..n); v[0..k] ends up <= result */
+static double select_kth(double *v, int n, int k) {
+    int lo = 0, hi = n - 1;
+    while (lo < hi) {
+        double pivot = v[lo + (hi - lo) / 2];
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (v[i] < pivot) ++i;
+            while (v[j] > pivot) --j;
+            if (i <= j) { double t = v[i]; v[i] = v[j]; v[j] = t; ++i; --j; }
+        }
+        if (k <= j) hi = j;
+        else if (k >= i) lo = i;
+        else break;
+    }
+    return v[k];
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* monotonic wall clock in seconds, for timings */
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* splitmix64: small, fast and good enough for resampling */
+static uint64_t rng_next(uint64_t *s) {
+    uint64_t z = (*s += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
 /* ---------- Person A: core functions ---------- */
 
 /* Print current holdings */
-void view() {
-    if (count == 0) {
+void view(Portfolio *pf) {
+    if (pf->count == 0) {
+        printf("Portfolio is empty.\n");
+        return;
+    }
+    pf_write_view(pf, stdout);
+}
+
+/* Holdings whose symbol matches a pattern such as BRK* or *.L */
+void search_view(Portfolio *pf) {
+    char line[LINE_BUF];
+    int matched = 0;
+    printf("Symbol pattern (* any run, ? any one character): ");
+    if (!get_line(line, sizeof(line))) return;
+    if (strlen(line) == 0) { printf("No input.\n"); return; }
+    pf_status st = pf_search(pf, line, NULL, 0, &matched);    /* count only */
+    if (st != PF_OK) { printf("Search failed: %s.\n", pf_strerror(st)); return; }
+    if (matched == 0) { printf("No holdings match %s.\n", line); return; }
+    pf_write_view_matching(pf, line, stdout);
+    printf("%d of %d holdings match.\n", matched, pf->count);
+}
+
+/* Holdings ordered by a metric, a page at a time: "top 20 losers" is
+ * P/L ascending, 20 rows from rank 1 */
+void sorted_view(Portfolio *pf) {
+    char line[LINE_BUF];
+    int by, rows, from;
+    if (pf->count == 0) {
         printf("Portfolio is empty.\n");
         return;
     }
-    printf("%-10s %-6s %-10s %-10s %-12s %-8s\n",
-           "Symbol", "Qty", "Buy", "Cur", "Mkt Value", "P/L%");
-    for (int i = 0; i < count; ++i) {
-        double mv = portfolio[i].cur_price * portfolio[i].qty;
-        double cost = portfolio[i].buy_price * portfolio[i].qty;
-        double pl_pct = (cost == 0.0) ? 0.0 : ((mv - cost) / cost) * 100.0;
-        printf("%-10s %-6d %-10.2f %-10.2f %-12.2f %-7.2f%%\n",
-               portfolio[i].symbol,
-               portfolio[i].qty,
-               portfolio[i].buy_price,
-               portfolio[i].cur_price,
-               mv,
-               pl_pct);
+    if (!prompt_int("Sort by 1) symbol 2) market value 3) P/L 4) P/L% [2]: ", 2, &by) || by < 1 ||
+        by > PF_VIEW_COUNT) {
+        printf("Invalid choice.\n");
+        return;
+    }
+    printf("Order: (d)escending or (a)scending [d]: ");
+    if (!get_line(line, sizeof(line))) return;
+    int desc = !(line[0] == 'a' || line[0] == 'A');
+    if (!prompt_int("Rows [20]: ", 20, &rows) || rows < 1 || !prompt_int("From rank [1]: ", 1, &from) ||
+        from < 1) {
+        printf("Invalid number.\n");
+        return;
     }
+    pf_status st = pf_write_view_sorted(pf, (pf_view)(by - 1), desc, from - 1, rows, stdout);
+    if (st != PF_OK) printf("Sorted view failed: %s.\n", pf_strerror(st));
 }
 
 /* Compute and print portfolio metrics */
-void metrics() {
-    double total_cost = 0.0;
-    double market_value = 0.0;
-    for (int i = 0; i < count; ++i) {
-        total_cost += portfolio[i].buy_price * portfolio[i].qty;
-        market_value += portfolio[i].cur_price * portfolio[i].qty;
-    }
-    double unrealized = market_value - total_cost;
-    double pct = (total_cost == 0.0) ? 0.0 : (unrealized / total_cost) * 100.0;
+void metrics(Portfolio *pf) {
+    pf_metrics m;
+    pf_get_metrics(pf, &m);
 
-    printf("Total cost basis : %.2f\n", total_cost);
-    printf("Market value      : %.2f\n", market_value);
-    printf("Unrealized P/L    : %.2f\n", unrealized);
-    printf("Portfolio return  : %.2f%%\n", pct);
+    printf("Total cost basis : %.2f\n", m.cost);
+    printf("Market value      : %.2f\n", m.market_value);
+    printf("Unrealized P/L    : %.2f\n", m.unrealized);
+    printf("Portfolio return  : %.2f%%\n", m.return_pct);
+    if (pf->fx.n > 1) {
+        printf("By currency, converted to %s at current rates:\n", pf->fx.codes[pf->fx.base]);
+        for (int c = 0; c < pf->fx.n; ++c) {
+            if (pf->fx.npos[c] == 0) continue;
+            printf("  %-4s %5d positions  value %14.2f %s = %14.2f %s\n", pf->fx.codes[c], pf->fx.npos[c],
+                   pf->fx.mv[c], pf->fx.codes[c], pf->fx.mv[c] * pf->fx.conv[c], pf->fx.codes[pf->fx.base]);
+        }
+    }
 }
 
 /* ---------- Person B: buy & sell ---------- */
 
-void buy() {
+void buy(Portfolio *pf) {
     char line[LINE_BUF];
     char sym[SYMBOL_LEN];
     int q;
@@ -125,7 +351,7 @@ void buy() {
     if (!get_line(line, sizeof(line))) return;
     if (strlen(line) == 0) { printf("No symbol entered.\n"); return; }
     snprintf(sym, sizeof(sym), "%s", line);
-    strtoupper(sym);
+    pf_symbol_upper(sym);
 
     printf("Enter quantity: ");
     if (!get_line(line, sizeof(line)) || !parse_int(line, &q)) {
@@ -133,37 +359,31 @@ void buy() {
     }
     if (q <= 0) { printf("Quantity must be > 0.\n"); return; }
 
-    printf("Enter buy price: ");
-    if (!get_line(line, sizeof(line)) || !parse_double(line, &p)) {
+    printf("Enter buy price (optionally with currency, e.g. 12.50 EUR): ");
+    if (!get_line(line, sizeof(line))) { printf("Invalid price.\n"); return; }
+    char *code = strchr(line, ' ');
+    if (code) { *code++ = '\0'; while (*code == ' ') ++code; }
+    if (!parse_double(line, &p)) {
         printf("Invalid price.\n"); return;
     }
     if (p <= 0.0) { printf("Price must be > 0.\n"); return; }
 
-    int idx = find_index(sym);
-    if (idx >= 0) {
-        double old_cost = (double)portfolio[idx].qty * portfolio[idx].buy_price;
-        double new_cost = (double)q * p;
-        portfolio[idx].qty += q;
-        portfolio[idx].buy_price = (old_cost + new_cost) / (double)portfolio[idx].qty;
-        portfolio[idx].cur_price = p;
-        printf("Updated %s: qty=%d avg_buy=%.2f cur_price=%.2f\n",
-               sym, portfolio[idx].qty, portfolio[idx].buy_price, portfolio[idx].cur_price);
-        return;
-    }
-
-    if (count < MAX_STOCKS) {
-        snprintf(portfolio[count].symbol, SYMBOL_LEN, "%s", sym);
-        portfolio[count].qty = q;
-        portfolio[count].buy_price = p;
-        portfolio[count].cur_price = p;
-        count++;
-        printf("Added %s to portfolio (qty=%d @ %.2f)\n", sym, q, p);
-    } else {
-        printf("Portfolio full! Cannot buy.\n");
+    pf_position pos;
+    switch (pf_buy(pf, sym, q, p, code, &pos)) {
+        case PF_OK:
+            if (pos.created) printf("Added %s to portfolio (qty=%d @ %.2f)\n", sym, q, p);
+            else printf("Updated %s: qty=%d avg_buy=%.2f cur_price=%.2f\n",
+                        sym, pos.qty, pos.buy_price, pos.cur_price);
+            break;
+        case PF_ERR_CURRENCY:
+            printf("%s is held in %s.\n", sym, pf->fx.codes[pf->items[pf_find(pf, sym)].ccy]);
+            break;
+        case PF_ERR_INVALID: printf("Invalid currency %s.\n", code); break;
+        default: printf("Portfolio full! Cannot buy.\n"); break;
     }
 }
 
-void sell() {
+void sell(Portfolio *pf) {
     char line[LINE_BUF];
     char sym[SYMBOL_LEN];
     int q;
@@ -173,10 +393,9 @@ void sell() {
     if (!get_line(line, sizeof(line))) return;
     if (strlen(line) == 0) { printf("No symbol entered.\n"); return; }
     snprintf(sym, sizeof(sym), "%s", line);
-    strtoupper(sym);
+    pf_symbol_upper(sym);
 
-    int index = find_index(sym);
-    if (index == -1) {
+    if (pf_find(pf, sym) == -1) {
         printf("Stock not found!\n");
         return;
     }
@@ -193,183 +412,2302 @@ void sell() {
     }
     if (p < 0.0) { printf("Price must be >= 0.\n"); return; }
 
-    if (q > portfolio[index].qty) {
+    pf_position pos;
+    pf_status st = pf_sell(pf, sym, q, p, &pos);
+    if (st == PF_ERR_SHARES) {
         printf("You don't have enough shares!\n");
-        return;
-    }
-
-    portfolio[index].qty -= q;
-    portfolio[index].cur_price = p;
-
-    if (portfolio[index].qty == 0) {
-        for (int j = index; j < count - 1; j++) {
-            portfolio[j] = portfolio[j + 1];
-        }
-        count--;
+    } else if (st != PF_OK) {
+        printf("Sell failed: %s.\n", pf_strerror(st));
+    } else if (pos.removed) {
         printf("All shares sold. Stock removed.\n");
     } else {
-        printf("Sold %d shares of %s. Remaining qty=%d\n", q, sym, portfolio[index].qty);
+        printf("Sold %d shares of %s. Remaining qty=%d\n", q, sym, pos.qty);
     }
 }
 
 /* ---------- Person C: update_prices, save_file, load_file ---------- */
 
-void update_prices() {
+static void cov_stream_tick(Portfolio *pf); /* folds a full price update into the covariance */
+
+void update_prices(Portfolio *pf) {
     char line[LINE_BUF];
     char sym[SYMBOL_LEN];
     double price;
 
-    printf("Enter symbol to update (or ALL): ");
+    printf("Enter symbol to update (ALL, or a pattern such as BRK* or *.L): ");
     if (!get_line(line, sizeof(line))) return;
     if (strlen(line) == 0) { printf("No input.\n"); return; }
 
     snprintf(sym, sizeof(sym), "%s", line);
-    strtoupper(sym);
+    pf_symbol_upper(sym);
 
     if (strcmp(sym, "ALL") == 0) {
-        if (count == 0) { printf("Portfolio empty.\n"); return; }
-        for (int i = 0; i < count; ++i) {
-            printf("Enter current price for %s (cur %.2f): ", portfolio[i].symbol, portfolio[i].cur_price);
+        if (pf->count == 0) { printf("Portfolio empty.\n"); return; }
+        for (int i = 0; i < pf->count; ++i) {
+            printf("Enter current price for %s (cur %.2f): ", pf->items[i].symbol, pf->items[i].cur_price);
             if (!get_line(line, sizeof(line))) { printf("Input error.\n"); return; }
             if (strlen(line) == 0) { continue; }
-            if (!parse_double(line, &price) || price <= 0.0) {
-                printf("Invalid price for %s, skipping.\n", portfolio[i].symbol);
+            if (!parse_double(line, &price) || pf_set_price(pf, i, price) != PF_OK) {
+                printf("Invalid price for %s, skipping.\n", pf->items[i].symbol);
                 continue;
             }
-            portfolio[i].cur_price = price;
         }
+        cov_stream_tick(pf);
         printf("All updates processed.\n");
         return;
     }
 
-    int idx = find_index(sym);
+    if (strpbrk(sym, "*?")) {
+        int matched = 0;
+        int *idx = pf_mem_alloc(PF_MEM_BUFFERS, (size_t)(pf->count ? pf->count : 1) * sizeof(int));
+        if (!idx) { printf("Out of memory.\n"); return; }
+        if (pf_search(pf, sym, idx, pf->count, &matched) != PF_OK) matched = 0;
+        for (int j = 0; j < matched; ++j) {
+            int i = idx[j];
+            printf("Enter current price for %s (cur %.2f): ", pf->items[i].symbol, pf->items[i].cur_price);
+            if (!get_line(line, sizeof(line))) { printf("Input error.\n"); break; }
+            if (strlen(line) == 0) { continue; }
+            if (!parse_double(line, &price) || pf_set_price(pf, i, price) != PF_OK)
+                printf("Invalid price for %s, skipping.\n", pf->items[i].symbol);
+        }
+        pf_mem_free(idx);
+        printf("%d holdings match %s.\n", matched, sym);
+        return;
+    }
+
+    int idx = pf_find(pf, sym);
     if (idx < 0) {
         printf("Symbol %s not found.\n", sym);
         return;
     }
-    printf("Enter current price for %s (cur %.2f): ", portfolio[idx].symbol, portfolio[idx].cur_price);
+    printf("Enter current price for %s (cur %.2f): ", pf->items[idx].symbol, pf->items[idx].cur_price);
     if (!get_line(line, sizeof(line))) { printf("Input error.\n"); return; }
-    if (!parse_double(line, &price) || price <= 0.0) {
+    if (!parse_double(line, &price) || pf_set_price(pf, idx, price) != PF_OK) {
         printf("Invalid price.\n");
         return;
     }
-    portfolio[idx].cur_price = price;
-    printf("Updated %s current price to %.2f\n", portfolio[idx].symbol, portfolio[idx].cur_price);
+    printf("Updated %s current price to %.2f\n", pf->items[idx].symbol, pf->items[idx].cur_price);
 }
 
-void save_file() {
-    const char *fname = "portfolio.txt";
-    FILE *f = fopen(fname, "w");
-    if (!f) {
-        perror("Failed to open save file");
+void save_file(Portfolio *pf) {
+    pf_status st = pf_save(pf, PORTFOLIO_FILE);
+    if (st != PF_OK) {
+        printf("Failed to save portfolio: %s.\n", pf_strerror(st));
+        return;
+    }
+    printf("Portfolio saved to %s (%d entries).\n", PORTFOLIO_FILE, pf->count);
+}
+
+/* save in a forked child; the menu stays responsive on a large book */
+void bgsave_file(Portfolio *pf) {
+    pf_status st = pf_bgsave_start(pf, PORTFOLIO_FILE);
+    if (st == PF_ERR_INVALID) { printf("A background save is already running.\n"); return; }
+    if (st != PF_OK) { printf("Background save failed to start: %s.\n", pf_strerror(st)); return; }
+    pf_bgsave_stats bs;
+    pf_bgsave_poll(pf, &bs);
+    printf("Saving %ld entries to %s in the background (fork took %.2f ms).\n", bs.rows_total, bs.path,
+           bs.fork_ms);
+}
+
+void bgsave_status(Portfolio *pf) {
+    pf_bgsave_stats bs;
+    pf_bgsave_poll(pf, &bs);
+    if (bs.running) {
+        printf("Saving to %s: %ld of %ld entries (%.0f%%), %.2f s so far.\n", bs.path, bs.rows_done,
+               bs.rows_total, bs.rows_total ? 100.0 * bs.rows_done / bs.rows_total : 100.0, bs.elapsed_sec);
+    } else if (bs.saves == 0) {
+        printf("No background save has run.\n");
         return;
+    } else {
+        printf("Last background save to %s: %s, %ld entries in %.2f s (%.2f s writing).\n", bs.path,
+               bs.last == PF_OK ? "ok" : pf_strerror(bs.last), bs.rows_done, bs.elapsed_sec, bs.write_sec);
     }
-    for (int i = 0; i < count; ++i) {
-        fprintf(f, "%s %d %.10g %.10g\n",
-                portfolio[i].symbol,
-                portfolio[i].qty,
-                portfolio[i].buy_price,
-                portfolio[i].cur_price);
+    printf("Fork pause %.2f ms; %ld background saves finished.\n", bs.fork_ms, bs.saves);
+}
+
+/* only what changed since the last save; the first writes a whole base */
+void save_changes(Portfolio *pf) {
+    pf_delta_stats before, ds;
+    int rows = 0;
+    pf_delta_get(pf, &before);
+    pf_status st = pf_save_delta(pf, PORTFOLIO_FILE, &rows);
+    if (st != PF_OK) {
+        printf("Failed to save changes: %s.\n", pf_strerror(st));
+        return;
     }
-    fclose(f);
-    printf("Portfolio saved to %s (%d entries).\n", fname, count);
+    pf_delta_get(pf, &ds);
+    if (ds.bases > before.bases)
+        printf("Portfolio saved to %s (%d entries); later saves write only changes.\n", PORTFOLIO_FILE, rows);
+    else if (ds.deltas == before.deltas)
+        printf("No changes since the last save.\n");
+    else
+        printf("Saved %d changed entries to %s.d%d (%d deltas on the base%s).\n", rows, PORTFOLIO_FILE,
+               ds.last, ds.length, ds.merging ? ", merging in the background" : "");
 }
 
-void load_file() {
-    const char *fname = "portfolio.txt";
-    FILE *f = fopen(fname, "r");
-    if (!f) {
-        printf("No saved portfolio found (%s).\n", fname);
+/* one line when a background save has finished since the last command */
+static void bgsave_notice(Portfolio *pf, Session *s) {
+    pf_bgsave_stats bs;
+    pf_bgsave_poll(pf, &bs);
+    if (bs.saves == s->bgsaves_seen) return;
+    s->bgsaves_seen = bs.saves;
+    if (bs.last == PF_OK) printf("Background save to %s done (%ld entries).\n", bs.path, bs.rows_done);
+    else printf("Background save to %s failed: %s.\n", bs.path, pf_strerror(bs.last));
+}
+
+static void load_report(pf_status st, int loaded, int skipped) {
+    if (skipped) printf("Warning: skipped %d entries with a bad currency\n", skipped);
+    if (st != PF_OK) printf("Warning: %s, load stopped early\n", pf_strerror(st));
+    printf("Loaded %d entries from %s.\n", loaded, PORTFOLIO_FILE);
+}
+
+void load_file(Portfolio *pf) {
+    int loaded = 0, skipped = 0;
+    pf_status st = pf_load(pf, PORTFOLIO_FILE, &loaded, &skipped);
+    if (st == PF_ERR_IO) {
+        printf("No saved portfolio found (%s).\n", PORTFOLIO_FILE);
         return;
     }
+    load_report(st, loaded, skipped);
+}
 
-    char line[LINE_BUF];
-    char sym[SYMBOL_LEN];
-    int q;
-    double bp, cp;
-    int loaded = 0;
+/* At start-up the file is read on a thread while the menu waits for
+ * input, so the prompt comes up at once whatever the size of the book;
+ * the first command waits for whatever is left. */
+static void load_file_start(Portfolio *pf) {
+    if (pf_load_start(pf, PORTFOLIO_FILE) == PF_ERR_IO) printf("No saved portfolio found (%s).\n", PORTFOLIO_FILE);
+}
 
-    count = 0;
+static void load_file_finish(Portfolio *pf) {
+    if (!pf->bgload) return;
+    int loaded = 0, skipped = 0;
+    pf_trace_begin("load wait", "io");
+    pf_status st = pf_load_wait(pf, &loaded, &skipped);
+    pf_trace_end("load wait", "io");
+    load_report(st, loaded, skipped);
+}
 
-    while (fgets(line, sizeof(line), f) != NULL) {
-        size_t ln = strlen(line); if (ln && line[ln-1] == '\n') line[ln-1] = '\0';
-        if (sscanf(line, "%15s %d %lf %lf", sym, &q, &bp, &cp) == 4) {
-            strtoupper(sym);
-            if (count < MAX_STOCKS) {
-                snprintf(portfolio[count].symbol, SYMBOL_LEN, "%s", sym);
-                portfolio[count].qty = q;
-                portfolio[count].buy_price = bp;
-                portfolio[count].cur_price = cp;
-                ++count;
-                ++loaded;
-            } else {
-                printf("Warning: reached MAX_STOCKS, skipping %s\n", sym);
+/* ---------- Risk: price history & historical VaR ---------- */
+
+/* Daily closes, one row per day. history.txt layout:
+ *   DATE AAPL MSFT ...
+ *   2024-01-02 185.64 370.87 ...
+ * Commas also work as separators; missing or non-positive prices
+ * carry the previous day's close forward. */
+typedef struct {
+    int nsym;
+    int ndays;
+    char (*symbols)[SYMBOL_LEN];
+    double *prices;  /* ndays x nsym, row-major */
+} History;
+
+static void free_history(History *h) {
+    pf_mem_free(h->symbols);
+    pf_mem_free(h->prices);
+    memset(h, 0, sizeof(*h));
+}
+
+/* next separator-delimited token in *p (NUL-terminated in place) or NULL */
+static char *next_token(char **p) {
+    char *s = *p;
+    while (*s == ' ' || *s == '\t' || *s == ',' || *s == '\r' || *s == '\n') ++s;
+    if (*s == '\0') { *p = s; return NULL; }
+    char *tok = s;
+    while (*s && *s != ' ' && *s != '\t' && *s != ',' && *s != '\r' && *s != '\n') ++s;
+    if (*s) *s++ = '\0';
+    *p = s;
+    return tok;
+}
+
+/* returns 1 on success; prints the reason and returns 0 otherwise */
+static int load_history(History *h, const char *fname) {
+    memset(h, 0, sizeof(*h));
+    FILE *f = fopen(fname, "r");
+    if (!f) {
+        printf("No price history found (%s).\n", fname);
+        return 0;
+    }
+
+    char *line = NULL;
+    size_t linecap = 0;
+    int cap_days = 0;
+    while (getline(&line, &linecap, f) != -1) {
+        char *p = line;
+        char *tok = next_token(&p);
+        if (tok == NULL || tok[0] == '#') continue;
+
+        if (h->symbols == NULL) {
+            /* header: skip the DATE label, the rest are symbols */
+            int cap = 16;
+            h->symbols = pf_mem_alloc(PF_MEM_HISTORY, (size_t)cap * sizeof(*h->symbols));
+            while (h->symbols && (tok = next_token(&p)) != NULL) {
+                if (h->nsym == cap) {
+                    cap *= 2;
+                    void *grown = pf_mem_realloc(PF_MEM_HISTORY, h->symbols, (size_t)cap * sizeof(*h->symbols));
+                    if (!grown) { pf_mem_free(h->symbols); h->symbols = NULL; break; }
+                    h->symbols = grown;
+                }
+                snprintf(h->symbols[h->nsym], SYMBOL_LEN, "%s", tok);
+                pf_symbol_upper(h->symbols[h->nsym]);
+                h->nsym++;
             }
-        } else {
+            if (h->symbols == NULL || h->nsym == 0) break;
             continue;
         }
+
+        if (h->ndays == cap_days) {
+            cap_days = cap_days ? cap_days * 2 : 256;
+            double *grown = pf_mem_realloc(PF_MEM_HISTORY, h->prices, (size_t)cap_days * h->nsym * sizeof(double));
+            if (!grown) break;
+            h->prices = grown;
+        }
+        double *row = h->prices + (size_t)h->ndays * h->nsym;
+        const double *prev = h->ndays ? row - h->nsym : NULL;
+        for (int j = 0; j < h->nsym; ++j) {
+            double v;
+            tok = next_token(&p);
+            if (tok == NULL || !parse_double(tok, &v) || v <= 0.0)
+                v = prev ? prev[j] : NAN;
+            row[j] = v;
+        }
+        h->ndays++;
     }
+    free(line);
     fclose(f);
-    printf("Loaded %d entries from %s.\n", loaded, fname);
+
+    if (h->nsym == 0 || h->ndays < 2) {
+        printf("Price history %s needs a header and at least 2 days.\n", fname);
+        free_history(h);
+        return 0;
+    }
+    return 1;
 }
 
-/* ---------- Person D: UI improvements ---------- */
+/* For each holding, its history column or -1. Uses a sorted column index
+ * so large books against wide histories stay O(n log n). Caller frees. */
+static int *history_lookup(const Portfolio *pf, const History *h) {
+    int *cols = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)(pf->count ? pf->count : 1) * sizeof(int));
+    SymRef *refs = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)h->nsym * sizeof(SymRef));
+    if (!cols || !refs) { pf_mem_free(cols); pf_mem_free(refs); return NULL; }
+    for (int j = 0; j < h->nsym; ++j) {
+        refs[j].sym = h->symbols[j];
+        refs[j].idx = j;
+    }
+    qsort(refs, (size_t)h->nsym, sizeof(SymRef), cmp_symref);
+    for (int i = 0; i < pf->count; ++i) cols[i] = lookup_sorted(refs, h->nsym, pf->items[i].symbol);
+    pf_mem_free(refs);
+    return cols;
+}
 
-void ui_help() {
-    puts("\n=== Portfolio Simulator — Help & Tips ===");
-    puts("- Buy: provide symbol (letters/numbers), quantity (integer), buy price (float).");
-    puts("- Sell: provide symbol, quantity to sell, and sell price.");
-    puts("- Update Prices: enter a symbol to update one, or type ALL to update every holding.");
-    puts("- Save/Load: portfolio is saved to 'portfolio.txt' in the program directory.");
-    puts("- Symbols are case-insensitive and stored uppercase (e.g. AAPL).");
-    puts("- When updating prices, press Enter on an empty line to skip a holding.");
-    puts("- Invalid numeric input will be rejected; re-run the operation to retry.");
-    puts("- Program auto-saves on exit.\n");
+/* Simple daily returns for the given columns: (ndays-1) x k, row-major.
+ * Days with an unknown price on either side count as a zero return. */
+static double *gather_returns(const History *h, const int *cols, int k) {
+    int t_n = h->ndays - 1;
+    double *r = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)t_n * (k ? k : 1) * sizeof(double));
+    if (!r) return NULL;
+    for (int t = 0; t < t_n; ++t) {
+        const double *p0 = h->prices + (size_t)t * h->nsym;
+        const double *p1 = p0 + h->nsym;
+        double *out = r + (size_t)t * k;
+        for (int j = 0; j < k; ++j) {
+            double a = p0[cols[j]], b = p1[cols[j]];
+            out[j] = (isnan(a) || isnan(b)) ? 0.0 : b / a - 1.0;
+        }
+    }
+    return r;
 }
 
-/* menu with help option */
-int menu() {
+typedef struct {
+    int days;           /* return observations */
+    int covered;        /* holdings found in history */
+    double exposure;    /* market value of covered holdings */
+    double uncovered;   /* market value without history */
+    double var, es;     /* as positive losses */
+    int samples, window;
+    double bs_mean, bs_se, bs_lo, bs_hi;
+} VarResult;
+
+/* VaR and expected shortfall of a P/L sample; reorders pnl */
+static double var_of(double *pnl, int n, double conf, double *es) {
+    int k = (int)((1.0 - conf) * n);
+    if (k >= n) k = n - 1;
+    double q = select_kth(pnl, n, k);
+    if (es) {
+        double tail = 0.0;
+        for (int i = 0; i <= k; ++i) tail += pnl[i];
+        *es = -tail / (k + 1);
+    }
+    return -q;
+}
+
+typedef struct {
+    const double *pnl;
+    int days, window;
+    double conf;
+    uint64_t seed;
+    double *est;
+} BootArgs;
+
+/* Moving-block bootstrap: rebuild a series of `days` P/L values from
+ * randomly chosen windows, then take its VaR. Each sample seeds its own
+ * stream so results do not depend on the thread count. */
+static void boot_range(void *p, int b0, int b1) {
+    BootArgs *a = (BootArgs *)p;
+    double *scratch = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)a->days * sizeof(double));
+    if (!scratch) {
+        for (int b = b0; b < b1; ++b) a->est[b] = NAN;
+        return;
+    }
+    int starts = a->days - a->window + 1;
+    for (int b = b0; b < b1; ++b) {
+        uint64_t rng = a->seed ^ ((uint64_t)b * 0xD1B54A32D192ED03ULL);
+        int filled = 0;
+        while (filled < a->days) {
+            int s = (int)(rng_next(&rng) % (uint64_t)starts);
+            int len = a->window;
+            if (len > a->days - filled) len = a->days - filled;
+            memcpy(scratch + filled, a->pnl + s, (size_t)len * sizeof(double));
+            filled += len;
+        }
+        a->est[b] = var_of(scratch, a->days, a->conf, NULL);
+    }
+    pf_mem_free(scratch);
+}
+
+/* Revalue current holdings under every historical day's returns
+ * (P/L = R * value, a blocked matrix-vector product) and bootstrap the
+ * VaR estimate. Returns 1 on success. */
+static int compute_var(Portfolio *pf, const History *h, double conf, int samples, int window,
+                       uint64_t seed, VarResult *res) {
+    memset(res, 0, sizeof(*res));
+    int *pos_col = history_lookup(pf, h);
+    int *cols = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)(pf->count ? pf->count : 1) * sizeof(int));
+    double *value = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)(pf->count ? pf->count : 1) * sizeof(double));
+    if (!pos_col || !cols || !value) {
+        pf_mem_free(pos_col); pf_mem_free(cols); pf_mem_free(value);
+        return 0;
+    }
+
+    int k = 0;
+    for (int i = 0; i < pf->count; ++i) {
+        double mv = pf->items[i].cur_price * pf->items[i].qty * pf->fx.conv[pf->items[i].ccy];
+        if (pos_col[i] < 0) { res->uncovered += mv; continue; }
+        cols[k] = pos_col[i];
+        value[k] = mv;
+        res->exposure += mv;
+        ++k;
+    }
+    pf_mem_free(pos_col);
+    res->covered = k;
+    res->days = h->ndays - 1;
+
+    double *ret = gather_returns(h, cols, k);
+    double *pnl = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)res->days * sizeof(double));
+    double *work = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)res->days * sizeof(double));
+    double *est = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)(samples > 0 ? samples : 1) * sizeof(double));
+    int ok = ret && pnl && work && est;
+    if (ok) {
+        gemv(ret, res->days, k, value, pnl);
+        memcpy(work, pnl, (size_t)res->days * sizeof(double));
+        res->var = var_of(work, res->days, conf, &res->es);
+
+        if (window > res->days) window = res->days;
+        res->samples = samples;
+        res->window = window;
+        if (samples > 0) {
+            BootArgs ba = { pnl, res->days, window, conf, seed, est };
+            parallel_for(samples, 16, boot_range, &ba);
+            double sum = 0.0, sq = 0.0;
+            for (int b = 0; b < samples; ++b) sum += est[b];
+            res->bs_mean = sum / samples;
+            for (int b = 0; b < samples; ++b) sq += (est[b] - res->bs_mean) * (est[b] - res->bs_mean);
+            res->bs_se = samples > 1 ? sqrt(sq / (samples - 1)) : 0.0;
+            qsort(est, (size_t)samples, sizeof(double), cmp_double);
+            res->bs_lo = est[(int)(0.05 * (samples - 1))];
+            res->bs_hi = est[(int)(0.95 * (samples - 1))];
+        }
+    }
+    pf_mem_free(ret); pf_mem_free(pnl); pf_mem_free(work); pf_mem_free(est);
+    pf_mem_free(cols); pf_mem_free(value);
+    return ok;
+}
+
+void var_report(Portfolio *pf) {
+    double conf_pct;
+    int samples, window;
+
+    if (pf->count == 0) { printf("Portfolio is empty.\n"); return; }
+    if (!prompt_double("Confidence level % (Enter for 99): ", 99.0, &conf_pct)
+        || conf_pct <= 50.0 || conf_pct >= 100.0) {
+        printf("Confidence must be between 50 and 100.\n"); return;
+    }
+    if (!prompt_int("Bootstrap samples (Enter for 1000, 0 to skip): ", 1000, &samples)
+        || samples < 0) {
+        printf("Invalid sample count.\n"); return;
+    }
+    if (!prompt_int("Bootstrap window in days (Enter for 5): ", 5, &window) || window <= 0) {
+        printf("Invalid window.\n"); return;
+    }
+
+    History h;
+    if (!load_history(&h, HISTORY_FILE)) return;
+    VarResult r;
+    if (!compute_var(pf, &h, conf_pct / 100.0, samples, window, 42, &r)) {
+        printf("Out of memory computing VaR.\n");
+        free_history(&h);
+        return;
+    }
+    free_history(&h);
+
+    printf("History          : %d daily returns, %d/%d holdings covered\n", r.days, r.covered, pf->count);
+    if (r.uncovered > 0.0)
+        printf("Not covered      : %.2f market value has no history (excluded)\n", r.uncovered);
+    printf("Exposure         : %.2f\n", r.exposure);
+    printf("1-day VaR %.1f%%  : %.2f\n", conf_pct, r.var);
+    printf("Expected shortfall: %.2f\n", r.es);
+    if (r.samples > 0) {
+        printf("Bootstrap (%d x %d-day blocks): mean %.2f, std err %.2f, 90%% CI [%.2f, %.2f]\n",
+               r.samples, r.window, r.bs_mean, r.bs_se, r.bs_lo, r.bs_hi);
+    }
+}
+
+/* ---------- Risk: covariance / correlation matrix ---------- */
+
+#define COV_TILE 32   /* output tile edge (columns per side) */
+#define COV_TBLK 256  /* time steps per pass: two 32x256 panels fit in L2 */
+
+typedef struct {
+    const double *xc;  /* k x t_n centered returns, column-major */
+    double *m2;
+    int k, t_n, nb;
+} CovArgs;
+
+/* one unit of work = one upper-triangle output tile (bi <= bj) */
+static void cov_tiles(void *p, int w0, int w1) {
+    CovArgs *a = (CovArgs *)p;
+    for (int w = w0; w < w1; ++w) {
+        int bi = 0, rem = w;
+        while (rem >= a->nb - bi) { rem -= a->nb - bi; ++bi; }
+        int bj = bi + rem;
+        int i0 = bi * COV_TILE, i1 = i0 + COV_TILE < a->k ? i0 + COV_TILE : a->k;
+        int j0 = bj * COV_TILE, j1 = j0 + COV_TILE < a->k ? j0 + COV_TILE : a->k;
+
+        for (int i = i0; i < i1; ++i)
+            for (int j = (bi == bj ? i : j0); j < j1; ++j)
+                a->m2[(size_t)i * a->k + j] = 0.0;
+        for (int t0 = 0; t0 < a->t_n; t0 += COV_TBLK) {
+            int len = a->t_n - t0 < COV_TBLK ? a->t_n - t0 : COV_TBLK;
+            for (int i = i0; i < i1; ++i) {
+                const double *xi = a->xc + (size_t)i * a->t_n + t0;
+                for (int j = (bi == bj ? i : j0); j < j1; ++j)
+                    a->m2[(size_t)i * a->k + j] += dot(xi, a->xc + (size_t)j * a->t_n + t0, len);
+            }
+        }
+        for (int i = i0; i < i1; ++i)
+            for (int j = (bi == bj ? i + 1 : j0); j < j1; ++j)
+                a->m2[(size_t)j * a->k + i] = a->m2[(size_t)i * a->k + j];
+    }
+}
+
+/* Column means and co-moment matrix of ret (t_n x k, row-major).
+ * The k x k output is cut into tiles; threads take whole tiles. */
+static int cov_build(const double *ret, int t_n, int k, double *mean, double *m2) {
+    double *xc = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)k * t_n * sizeof(double));
+    if (!xc) return 0;
+    for (int j = 0; j < k; ++j) mean[j] = 0.0;
+    for (int t = 0; t < t_n; ++t)
+        for (int j = 0; j < k; ++j) mean[j] += ret[(size_t)t * k + j];
+    for (int j = 0; j < k; ++j) mean[j] /= t_n;
+    /* transpose in column strips so both sides stay cache friendly */
+    for (int j0 = 0; j0 < k; j0 += COV_TILE) {
+        int j1 = j0 + COV_TILE < k ? j0 + COV_TILE : k;
+        for (int t = 0; t < t_n; ++t)
+            for (int j = j0; j < j1; ++j)
+                xc[(size_t)j * t_n + t] = ret[(size_t)t * k + j] - mean[j];
+    }
+    int nb = (k + COV_TILE - 1) / COV_TILE;
+    CovArgs a = { xc, m2, k, t_n, nb };
+    parallel_for(nb * (nb + 1) / 2, 1, cov_tiles, &a);
+    pf_mem_free(xc);
+    return 1;
+}
+
+typedef struct {
+    double *m2;
+    const double *d;
+    double scale;
+    int k;
+} RankOneArgs;
+
+static void cov_rank_one(void *p, int i0, int i1) {
+    RankOneArgs *a = (RankOneArgs *)p;
+    for (int i = i0; i < i1; ++i) {
+        double *restrict row = a->m2 + (size_t)i * a->k;
+        const double *restrict d = a->d;
+        double di = a->scale * d[i];
+        for (int j = 0; j < a->k; ++j) row[j] += di * d[j];
+    }
+}
+
+/* Welford-style update with one new return vector r (length k):
+ * M2 += n/(n+1) * d d^T with d = r - mean. */
+static int cov_observe(CovState *c, const double *r) {
+    double *d = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)c->k * sizeof(double));
+    if (!d) return 0;
+    double n = (double)c->nobs;
+    for (int i = 0; i < c->k; ++i) {
+        d[i] = r[i] - c->mean[i];
+        c->mean[i] += d[i] / (n + 1.0);
+    }
+    RankOneArgs a = { c->m2, d, n / (n + 1.0), c->k };
+    int grain = c->k > 0 ? 65536 / c->k + 1 : 1;
+    parallel_for(c->k, grain, cov_rank_one, &a);
+    c->nobs++;
+    pf_mem_free(d);
+    return 1;
+}
+
+/* Build cov_state for the current holdings that appear in history. */
+static int cov_from_history(Portfolio *pf, const History *h) {
+    pf_cov_free(&pf->cov);
+    int *pos_col = history_lookup(pf, h);
+    if (!pos_col) return 0;
+    int k = 0;
+    for (int i = 0; i < pf->count; ++i) if (pos_col[i] >= 0) ++k;
+
+    CovState *c = &pf->cov;
+    int *cols = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)(k ? k : 1) * sizeof(int));
+    c->symbols = pf_mem_alloc(PF_MEM_COVARIANCE, (size_t)(k ? k : 1) * sizeof(*c->symbols));
+    c->mean = pf_mem_alloc(PF_MEM_COVARIANCE, (size_t)(k ? k : 1) * sizeof(double));
+    c->last = pf_mem_alloc(PF_MEM_COVARIANCE, (size_t)(k ? k : 1) * sizeof(double));
+    c->m2 = pf_mem_alloc(PF_MEM_COVARIANCE, (size_t)(k ? k : 1) * (k ? k : 1) * sizeof(double));
+    int ok = cols && c->symbols && c->mean && c->last && c->m2;
+    if (ok) {
+        int j = 0;
+        for (int i = 0; i < pf->count; ++i) {
+            if (pos_col[i] < 0) continue;
+            cols[j] = pos_col[i];
+            memcpy(c->symbols[j], pf->items[i].symbol, SYMBOL_LEN);
+            c->last[j] = pf->items[i].cur_price;
+            ++j;
+        }
+        c->k = k;
+        c->nobs = h->ndays - 1;
+        double *ret = gather_returns(h, cols, k);
+        ok = ret && cov_build(ret, (int)c->nobs, k, c->mean, c->m2);
+        pf_mem_free(ret);
+    }
+    pf_mem_free(cols);
+    pf_mem_free(pos_col);
+    if (!ok) pf_cov_free(&pf->cov);
+    return ok;
+}
+
+/* where the covariance symbols are held, looked up again only after
+ * positions were added, removed or moved; -1 for sold out */
+static int cov_resolve(Portfolio *pf) {
+    CovState *c = &pf->cov;
+    if (c->pos && c->pos_layout == pf->layout) return 1;
+    if (!c->pos) c->pos = pf_mem_alloc(PF_MEM_COVARIANCE, (size_t)c->k * sizeof(int));
+    SymRef *refs = sorted_positions(pf);
+    if (!c->pos || !refs) {
+        pf_mem_free(refs);
+        return 0;
+    }
+    for (int j = 0; j < c->k; ++j) c->pos[j] = lookup_sorted(refs, pf->count, c->symbols[j]);
+    c->pos_layout = pf->layout;
+    pf_mem_free(refs);
+    return 1;
+}
+
+static void cov_stream_tick(Portfolio *pf) {
+    CovState *c = &pf->cov;
+    if (c->k == 0 || !cov_resolve(pf)) return;
+    double *r = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)c->k * sizeof(double));
+    if (!r) return;
+    for (int j = 0; j < c->k; ++j) {
+        int idx = c->pos[j];
+        double p = idx >= 0 ? pf->items[idx].cur_price : c->last[j];
+        r[j] = c->last[j] > 0.0 ? p / c->last[j] - 1.0 : 0.0;
+        c->last[j] = p;
+    }
+    if (cov_observe(c, r)) c->streamed++;
+    pf_mem_free(r);
+}
+
+/* (re)build cov_state from history.txt; returns 1 on success */
+static int cov_rebuild(Portfolio *pf) {
+    History h;
+    if (!load_history(&h, HISTORY_FILE)) return 0;
+    int ok = cov_from_history(pf, &h);
+    free_history(&h);
+    if (!ok) printf("Out of memory building covariance.\n");
+    return ok;
+}
+
+void covariance_report(Portfolio *pf) {
     char line[LINE_BUF];
-    puts("\n========== Portfolio Simulator ==========");
-    puts("1) View holdings        - Show current holdings");
-    puts("2) Buy shares           - Add or increase holding");
-    puts("3) Sell shares          - Sell partial or all shares");
-    puts("4) Update Prices        - Update market prices (symbol or ALL)");
-    puts("5) Portfolio Metrics    - Cost, market value, unrealized P/L");
-    puts("6) Save portfolio       - Save to portfolio.txt");
-    puts("7) Load portfolio       - Load from portfolio.txt (overwrites current)");
-    puts("8) Help                 - Show usage tips and examples");
-    puts("0) Exit                 - Save and quit");
-    printf("Enter choice (0-8): ");
-    if (!get_line(line, sizeof(line))) return -1;
-    int c;
-    if (!parse_int(line, &c)) return -1;
-    if (c < 0 || c > 8) return -1;
-    return c;
+
+    if (pf->count == 0) { printf("Portfolio is empty.\n"); return; }
+    int rebuild = (pf->cov.k == 0);
+    if (!rebuild) {
+        printf("Covariance has %ld observations (%ld streamed). Rebuild from %s? (y/N): ",
+               pf->cov.nobs, pf->cov.streamed, HISTORY_FILE);
+        if (!get_line(line, sizeof(line))) return;
+        rebuild = (line[0] == 'y' || line[0] == 'Y');
+    }
+    if (rebuild && !cov_rebuild(pf)) return;
+    CovState *c = &pf->cov;
+    if (c->k == 0) { printf("No holdings found in %s.\n", HISTORY_FILE); return; }
+    if (c->nobs < 2) { printf("Not enough observations.\n"); return; }
+
+    printf("Show (C)ovariance or c(O)rrelation? (Enter for correlation): ");
+    if (!get_line(line, sizeof(line))) return;
+    int corr = !(line[0] == 'c' || line[0] == 'C');
+
+    double denom = (double)(c->nobs - 1);
+    printf("%s of daily returns: %d symbols, %ld observations (%ld streamed)\n",
+           corr ? "Correlation" : "Covariance", c->k, c->nobs, c->streamed);
+    if (c->k <= 8) {
+        printf("%-10s", "");
+        for (int j = 0; j < c->k; ++j) printf(" %10s", c->symbols[j]);
+        printf("\n");
+        for (int i = 0; i < c->k; ++i) {
+            printf("%-10s", c->symbols[i]);
+            for (int j = 0; j < c->k; ++j) {
+                double v = c->m2[(size_t)i * c->k + j];
+                if (corr) {
+                    double s = sqrt(c->m2[(size_t)i * c->k + i] * c->m2[(size_t)j * c->k + j]);
+                    printf(" %10.4f", s > 0.0 ? v / s : 0.0);
+                } else {
+                    printf(" %10.6f", v / denom);
+                }
+            }
+            printf("\n");
+        }
+        return;
+    }
+
+    /* too wide to print: summarize */
+    double sum = 0.0, best = -2.0, worst = 2.0;
+    int bi = 0, bj = 0, wi = 0, wj = 0, vi = 0;
+    for (int i = 0; i < c->k; ++i) {
+        double sii = c->m2[(size_t)i * c->k + i];
+        if (sii > c->m2[(size_t)vi * c->k + vi]) vi = i;
+        for (int j = i + 1; j < c->k; ++j) {
+            double s = sqrt(sii * c->m2[(size_t)j * c->k + j]);
+            double r = s > 0.0 ? c->m2[(size_t)i * c->k + j] / s : 0.0;
+            sum += r;
+            if (r > best) { best = r; bi = i; bj = j; }
+            if (r < worst) { worst = r; wi = i; wj = j; }
+        }
+    }
+    printf("Average pairwise correlation: %.4f\n", sum / ((double)c->k * (c->k - 1) / 2.0));
+    printf("Most correlated  : %s / %s (%.4f)\n", c->symbols[bi], c->symbols[bj], best);
+    printf("Least correlated : %s / %s (%.4f)\n", c->symbols[wi], c->symbols[wj], worst);
+    printf("Highest variance : %s (daily vol %.4f)\n", c->symbols[vi],
+           sqrt(c->m2[(size_t)vi * c->k + vi] / denom));
 }
 
-/* main loop */
-int main(void) {
-    int choice;
-    /* Attempt to load any saved portfolio at program start (non-fatal) */
-    load_file();
+/* --bench-cov [N ...]: batch build and one streaming update on synthetic
+ * one-factor returns (1000 days) for each N, default 500..5000. */
+static int bench_cov(int argc, char **argv) {
+    static const int defaults[] = { 500, 1000, 2000, 5000 };
+    const int t_n = 1000;
+    int nsizes = argc > 0 ? argc : (int)(sizeof(defaults) / sizeof(defaults[0]));
+
+    printf("threads=%d days=%d\n", num_threads(), t_n);
+    for (int s = 0; s < nsizes; ++s) {
+        int k = defaults[s < 4 ? s : 0];
+        if (argc > 0 && (!parse_int(argv[s], &k) || k <= 0)) {
+            printf("Invalid size %s\n", argv[s]);
+            return 1;
+        }
+        double *ret = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)t_n * k * sizeof(double));
+        CovState c = { 0 };
+        c.k = k;
+        c.mean = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)k * sizeof(double));
+        c.m2 = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)k * k * sizeof(double));
+        double *r = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)k * sizeof(double));
+        if (!ret || !c.mean || !c.m2 || !r) {
+            printf("N=%d: out of memory\n", k);
+            pf_mem_free(ret); pf_mem_free(c.mean); pf_mem_free(c.m2); pf_mem_free(r);
+            return 1;
+        }
+        uint64_t rng = 7;
+        for (int t = 0; t < t_n; ++t) {
+            double market = (double)(rng_next(&rng) >> 11) * 0x1.0p-53 - 0.5;
+            for (int j = 0; j < k; ++j)
+                ret[(size_t)t * k + j] = 0.02 * market
+                    + 0.01 * ((double)(rng_next(&rng) >> 11) * 0x1.0p-53 - 0.5);
+        }
+        for (int j = 0; j < k; ++j) r[j] = ret[j];
+
+        double t0 = now_sec();
+        cov_build(ret, t_n, k, c.mean, c.m2);
+        double t1 = now_sec();
+        c.nobs = t_n;
+        cov_observe(&c, r);
+        double t2 = now_sec();
+
+        double flops = (double)k * (k + 1) / 2.0 * t_n * 2.0;
+        printf("cov N=%-5d build %9.2f ms (%6.2f GFLOP/s)  stream update %8.2f ms\n",
+               k, (t1 - t0) * 1e3, flops / (t1 - t0) * 1e-9, (t2 - t1) * 1e3);
+        pf_mem_free(ret); pf_mem_free(c.mean); pf_mem_free(c.m2); pf_mem_free(r);
+    }
+    return 0;
+}
+
+/* ---------- Optimization: mean-variance & efficient frontier ---------- */
+
+#define TRADING_DAYS 252
+#define CHOL_BLOCK 64
+#define FRONTIER_POINTS 16
+#define FISTA_MAX_ITERS 2000
+#define FISTA_TOL 1e-10
+
+typedef struct {
+    double *a;
+    int n, k0, k1;
+} CholArgs;
+
+/* rows below the diagonal block: L21 = A21 L11^-T */
+static void chol_panel(void *p, int r0, int r1) {
+    CholArgs *c = (CholArgs *)p;
+    for (int r = c->k1 + r0; r < c->k1 + r1; ++r) {
+        double *ar = c->a + (size_t)r * c->n;
+        for (int j = c->k0; j < c->k1; ++j) {
+            const double *aj = c->a + (size_t)j * c->n;
+            ar[j] = (ar[j] - dot(ar + c->k0, aj + c->k0, j - c->k0)) / aj[j];
+        }
+    }
+}
+
+/* trailing update A22 -= L21 L21^T (lower triangle). Row i costs about
+ * i dots, so unit u takes rows u and last-u to keep threads balanced. */
+static void chol_trailing(void *p, int u0, int u1) {
+    CholArgs *c = (CholArgs *)p;
+    int w = c->k1 - c->k0;
+    for (int u = u0; u < u1; ++u) {
+        int rows[2] = { c->k1 + u, c->n - 1 - u };
+        for (int s = 0; s < (rows[0] == rows[1] ? 1 : 2); ++s) {
+            double *ai = c->a + (size_t)rows[s] * c->n;
+            for (int j = c->k1; j <= rows[s]; ++j)
+                ai[j] -= dot(ai + c->k0, c->a + (size_t)j * c->n + c->k0, w);
+        }
+    }
+}
+
+/* In-place blocked Cholesky of a row-major SPD matrix; the lower triangle
+ * ends up holding L. Returns 0 if the matrix is not positive definite. */
+static int cholesky(double *a, int n) {
+    for (int k0 = 0; k0 < n; k0 += CHOL_BLOCK) {
+        int k1 = k0 + CHOL_BLOCK < n ? k0 + CHOL_BLOCK : n;
+        for (int j = k0; j < k1; ++j) {
+            double *aj = a + (size_t)j * n;
+            double d = aj[j] - dot(aj + k0, aj + k0, j - k0);
+            if (d <= 0.0) return 0;
+            aj[j] = sqrt(d);
+            for (int i = j + 1; i < k1; ++i) {
+                double *ai = a + (size_t)i * n;
+                ai[j] = (ai[j] - dot(ai + k0, aj + k0, j - k0)) / aj[j];
+            }
+        }
+        CholArgs c = { a, n, k0, k1 };
+        parallel_for(n - k1, 8, chol_panel, &c);
+        parallel_for((n - k1 + 1) / 2, 4, chol_trailing, &c);
+    }
+    return 1;
+}
+
+/* solve L L^T x = b, x holds b on entry */
+static void chol_solve(const double *l, int n, double *x) {
+    for (int i = 0; i < n; ++i)
+        x[i] = (x[i] - dot(l + (size_t)i * n, x, i)) / l[(size_t)i * n + i];
+    for (int i = n - 1; i >= 0; --i) {
+        const double *li = l + (size_t)i * n;
+        x[i] /= li[i];
+        for (int j = 0; j < i; ++j) x[j] -= li[j] * x[i];
+    }
+}
+
+static int cmp_double_desc(const void *a, const void *b) {
+    return cmp_double(b, a);
+}
+
+/* Euclidean projection onto {w >= 0, sum w = 1} (sort-based) */
+static void project_simplex(double *v, int k, double *sorted) {
+    memcpy(sorted, v, (size_t)k * sizeof(double));
+    qsort(sorted, (size_t)k, sizeof(double), cmp_double_desc);
+    double cum = 0.0, theta = 0.0;
+    for (int j = 0; j < k; ++j) {
+        cum += sorted[j];
+        double t = (cum - 1.0) / (j + 1);
+        if (sorted[j] - t > 0.0) theta = t;
+    }
+    for (int i = 0; i < k; ++i) v[i] = v[i] > theta ? v[i] - theta : 0.0;
+}
+
+typedef struct {
+    const double *cov, *mu;
+    int k;
+    double step;  /* 1 / largest eigenvalue of cov */
+} MvProblem;
+
+/* Long-only point: minimize 1/2 w'Cw - lambda mu'w over the simplex with
+ * accelerated projected gradient (FISTA, gradient restart), starting
+ * from w. work holds 4k doubles. Returns the iterations used. */
+static int solve_long_only(const MvProblem *pb, double lambda, double *w, double *work) {
+    int k = pb->k;
+    double *y = work, *g = work + k, *wn = work + 2 * k, *sorted = work + 3 * k;
+    GemvArgs ga = { pb->cov, y, g, k };
+    double t = 1.0;
+    int it;
+
+    memcpy(y, w, (size_t)k * sizeof(double));
+    for (it = 1; it <= FISTA_MAX_ITERS; ++it) {
+        gemv_range(&ga, 0, k); /* serial: frontier points already run in parallel */
+        for (int i = 0; i < k; ++i) wn[i] = y[i] - pb->step * (g[i] - lambda * pb->mu[i]);
+        project_simplex(wn, k, sorted);
+
+        double restart = 0.0, diff = 0.0;
+        for (int i = 0; i < k; ++i) restart += (y[i] - wn[i]) * (wn[i] - w[i]);
+        double tn = restart > 0.0 ? 1.0 : 0.5 * (1.0 + sqrt(1.0 + 4.0 * t * t));
+        double mom = restart > 0.0 ? 0.0 : (t - 1.0) / tn;
+        for (int i = 0; i < k; ++i) {
+            double d = wn[i] - w[i];
+            if (fabs(d) > diff) diff = fabs(d);
+            y[i] = wn[i] + mom * d;
+            w[i] = wn[i];
+        }
+        t = tn;
+        if (diff < FISTA_TOL) break;
+    }
+    return it;
+}
+
+typedef struct {
+    const MvProblem *pb;
+    const double *lambda;
+    const double *start;  /* long-only minimum-variance weights */
+    double *w;            /* points x k */
+    int *iters;
+} FrontierArgs;
+
+/* each thread walks a contiguous run of lambdas, warm-starting every
+ * point from its left neighbour */
+static void frontier_range(void *p, int j0, int j1) {
+    FrontierArgs *a = (FrontierArgs *)p;
+    int k = a->pb->k;
+    double *work = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)4 * k * sizeof(double));
+    const double *prev = a->start;
+    for (int j = j0; j < j1; ++j) {
+        double *w = a->w + (size_t)j * k;
+        memcpy(w, prev, (size_t)k * sizeof(double));
+        a->iters[j] = work ? solve_long_only(a->pb, a->lambda[j], w, work) : -1;
+        prev = w;
+    }
+    pf_mem_free(work);
+}
+
+/* daily expected return and variance of weights w */
+static void mv_stats(const MvProblem *pb, const double *w, double *tmp, double *ret, double *var) {
+    gemv(pb->cov, pb->k, pb->k, w, tmp);
+    *ret = dot(pb->mu, w, pb->k);
+    *var = dot(w, tmp, pb->k);
+}
+
+static void print_mv_row(const char *label, const MvProblem *pb, const double *w, double *tmp) {
+    double ret, var;
+    int names = 0;
+    mv_stats(pb, w, tmp, &ret, &var);
+    for (int i = 0; i < pb->k; ++i) if (fabs(w[i]) > 1e-6) ++names;
+    printf("%-26s %10.2f%% %9.2f%% %8d\n", label, ret * TRADING_DAYS * 100.0,
+           sqrt(var > 0.0 ? var * TRADING_DAYS : 0.0) * 100.0, names);
+}
+
+void optimize_report(Portfolio *pf) {
+    double target_pct;
+    int points;
+
+    if (pf->count == 0) { printf("Portfolio is empty.\n"); return; }
+    if (!prompt_double("Target annual return % (Enter to skip): ", NAN, &target_pct)) {
+        printf("Invalid return.\n"); return;
+    }
+    if (!prompt_int("Frontier points (Enter for 16): ", FRONTIER_POINTS, &points)
+        || points < 2 || points > 1000) {
+        printf("Frontier points must be 2..1000.\n"); return;
+    }
+    if (pf->cov.k == 0 && !cov_rebuild(pf)) return;
+    const CovState *c = &pf->cov;
+    if (c->k < 2 || c->nobs < 2) { printf("Need at least 2 holdings with history.\n"); return; }
+
+    int k = c->k;
+    size_t kk = (size_t)k * k;
+    double *cov = pf_mem_alloc(PF_MEM_ANALYTICS, kk * sizeof(double));
+    double *l = pf_mem_alloc(PF_MEM_ANALYTICS, kk * sizeof(double));
+    double *vec = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)6 * k * sizeof(double));
+    double *solver_work = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)4 * k * sizeof(double));
+    double *front = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)points * k * sizeof(double));
+    double *lambda = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)points * sizeof(double));
+    int *iters = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)points * sizeof(int));
+    if (!cov || !l || !vec || !solver_work || !front || !lambda || !iters || !cov_resolve(pf)) {
+        printf("Out of memory.\n");
+        pf_mem_free(cov); pf_mem_free(l); pf_mem_free(vec); pf_mem_free(solver_work); pf_mem_free(front); pf_mem_free(lambda); pf_mem_free(iters);
+        return;
+    }
+    double *cur = vec, *ia = vec + k, *ib = vec + 2 * k, *wmin = vec + 3 * k;
+    double *wt = vec + 4 * k, *tmp = vec + 5 * k;
+
+    double t0 = now_sec();
+    /* sample covariance shrunk toward (trace/k) I by k/(k+T): negligible for
+     * long histories, but keeps wide books (k near or above T) well
+     * conditioned so both the factorization and the solver converge */
+    double trace = 0.0, shrink = (double)k / (k + c->nobs);
+    for (size_t i = 0; i < kk; ++i) cov[i] = (1.0 - shrink) * c->m2[i] / (double)(c->nobs - 1);
+    for (int i = 0; i < k; ++i) trace += c->m2[(size_t)i * k + i] / (double)(c->nobs - 1);
+    for (int i = 0; i < k; ++i) cov[(size_t)i * k + i] += shrink * trace / k;
+    MvProblem pb = { cov, c->mean, k, 0.0 };
+
+    /* current weights over the covered holdings */
+    double total = 0.0;
+    for (int j = 0; j < k; ++j) {
+        int idx = c->pos[j];
+        cur[j] = idx >= 0 ? pf->items[idx].cur_price * pf->items[idx].qty * pf->fx.conv[pf->items[idx].ccy] : 0.0;
+        total += cur[j];
+    }
+    for (int j = 0; j < k; ++j) cur[j] = total > 0.0 ? cur[j] / total : 1.0 / k;
+
+    /* fully invested, shorting allowed: closed form from C^-1 1 and C^-1 mu.
+     * A small ridge keeps near-singular sample covariances factorable. */
+    int factored = 0;
+    for (double ridge = 1e-10; ridge < 1e-1 && !factored; ridge *= 100.0) {
+        memcpy(l, cov, kk * sizeof(double));
+        for (int i = 0; i < k; ++i) l[(size_t)i * k + i] += ridge * trace / k;
+        factored = cholesky(l, k);
+    }
+    double A = 0.0, B = 0.0, C = 0.0, D = 0.0;
+    if (factored) {
+        for (int i = 0; i < k; ++i) { ia[i] = 1.0; ib[i] = c->mean[i]; }
+        chol_solve(l, k, ia);
+        chol_solve(l, k, ib);
+        for (int i = 0; i < k; ++i) { A += ia[i]; B += ib[i]; C += c->mean[i] * ib[i]; }
+        D = A * C - B * B;
+    }
+
+    /* long-only frontier: step from the largest eigenvalue (power iteration) */
+    for (int i = 0; i < k; ++i) wt[i] = 1.0;
+    double eig = 0.0;
+    for (int it = 0; it < 50; ++it) {
+        gemv(cov, k, k, wt, tmp);
+        eig = sqrt(dot(tmp, tmp, k));
+        if (eig <= 0.0) break;
+        for (int i = 0; i < k; ++i) wt[i] = tmp[i] / eig;
+    }
+    eig = eig > 0.0 ? eig * 1.05 : 1.0;
+    pb.step = 1.0 / eig;
+
+    double mu_lo = c->mean[0], mu_hi = c->mean[0];
+    for (int i = 1; i < k; ++i) {
+        if (c->mean[i] < mu_lo) mu_lo = c->mean[i];
+        if (c->mean[i] > mu_hi) mu_hi = c->mean[i];
+    }
+    double lam_hi = mu_hi > mu_lo ? 4.0 * eig / (mu_hi - mu_lo) : 0.0;
+
+    for (int i = 0; i < k; ++i) wmin[i] = 1.0 / k;
+    int min_iters = solve_long_only(&pb, 0.0, wmin, solver_work);
+
+    lambda[0] = 0.0;
+    for (int j = 1; j < points; ++j)
+        lambda[j] = points > 2 ? lam_hi * pow(1e-4, (double)(points - 1 - j) / (points - 2)) : lam_hi;
+    FrontierArgs fa = { &pb, lambda, wmin, front, iters };
+    parallel_for(points, 1, frontier_range, &fa);
+    double t1 = now_sec();
+
+    printf("Universe: %d holdings with history (of %d), %ld observations, shrinkage %.3f\n",
+           k, pf->count, c->nobs, shrink);
+    printf("%-26s %11s %10s %8s\n", "", "Ann.Return", "Ann.Vol", "Names");
+    print_mv_row("Current portfolio", &pb, cur, tmp);
+    print_mv_row("Min variance (long-only)", &pb, wmin, tmp);
+    if (factored && A > 0.0) {
+        for (int i = 0; i < k; ++i) wt[i] = ia[i] / A;
+        print_mv_row("Min variance (short ok)", &pb, wt, tmp);
+    }
+
+    const double *top = wmin;
+    if (!isnan(target_pct)) {
+        double m = target_pct / 100.0 / TRADING_DAYS;
+        char label[64];
+        if (factored && D > 0.0) {
+            for (int i = 0; i < k; ++i)
+                wt[i] = ((C - m * B) * ia[i] + (m * A - B) * ib[i]) / D;
+            snprintf(label, sizeof(label), "Target %.1f%% (short ok)", target_pct);
+            print_mv_row(label, &pb, wt, tmp);
+        }
+        /* long-only target: bisect lambda between the bracketing frontier points */
+        double r_prev, r_j, v;
+        mv_stats(&pb, wmin, tmp, &r_prev, &v);
+        if (m > mu_hi) {
+            printf("Target %.1f%% is above the best single holding (%.1f%%); no long-only solution.\n",
+                   target_pct, mu_hi * TRADING_DAYS * 100.0);
+        } else if (m <= r_prev) {
+            snprintf(label, sizeof(label), "Target %.1f%% (long-only)", target_pct);
+            print_mv_row(label, &pb, wmin, tmp);
+        } else {
+            int j = 1;
+            for (; j < points; ++j) {
+                mv_stats(&pb, front + (size_t)j * k, tmp, &r_j, &v);
+                if (r_j >= m) break;
+            }
+            double lo = lambda[j - 1], hi = j < points ? lambda[j] : lam_hi;
+            if (j == points) { /* beyond the traced range: grow the bracket */
+                for (int g = 0; g < 30 && r_j < m; ++g) {
+                    lo = hi; hi *= 2.0;
+                    memcpy(wt, front + (size_t)(points - 1) * k, (size_t)k * sizeof(double));
+                    solve_long_only(&pb, hi, wt, solver_work);
+                    mv_stats(&pb, wt, tmp, &r_j, &v);
+                }
+            }
+            double *wlong = ib; /* reuse: closed-form vectors are no longer needed */
+            memcpy(wlong, front + (size_t)(j - 1) * k, (size_t)k * sizeof(double));
+            for (int it = 0; it < 40; ++it) {
+                double mid = 0.5 * (lo + hi);
+                solve_long_only(&pb, mid, wlong, solver_work);
+                mv_stats(&pb, wlong, tmp, &r_j, &v);
+                if (r_j < m) lo = mid; else hi = mid;
+            }
+            solve_long_only(&pb, hi, wlong, solver_work);
+            snprintf(label, sizeof(label), "Target %.1f%% (long-only)", target_pct);
+            print_mv_row(label, &pb, wlong, tmp);
+            top = wlong;
+        }
+    }
+
+    printf("\nEfficient frontier (long-only, %d points, %.3f s, %d threads):\n",
+           points, t1 - t0, num_threads());
+    printf("%4s %12s %11s %10s %8s %7s\n", "#", "lambda", "Ann.Return", "Ann.Vol", "Names", "Iters");
+    for (int j = 0; j < points; ++j) {
+        double ret, var;
+        const double *w = front + (size_t)j * k;
+        int names = 0;
+        mv_stats(&pb, w, tmp, &ret, &var);
+        for (int i = 0; i < k; ++i) if (w[i] > 1e-6) ++names;
+        printf("%4d %12.4g %10.2f%% %9.2f%% %8d %7d\n", j + 1, lambda[j],
+               ret * TRADING_DAYS * 100.0, sqrt(var * TRADING_DAYS) * 100.0, names,
+               j == 0 ? min_iters : iters[j]);
+    }
+
+    /* largest weights of the reported long-only portfolio */
+    printf("\nLargest weights (%s):", top == wmin ? "min variance, long-only" : "target, long-only");
+    memcpy(tmp, top, (size_t)k * sizeof(double));
+    for (int shown = 0; shown < 10; ++shown) {
+        int best = 0;
+        for (int i = 1; i < k; ++i) if (tmp[i] > tmp[best]) best = i;
+        if (tmp[best] <= 1e-6) break;
+        printf(" %s %.1f%%", c->symbols[best], tmp[best] * 100.0);
+        tmp[best] = -1.0;
+    }
+    printf("\n");
+
+    char line[LINE_BUF];
+    printf("Write these weights to %s for rebalancing? (y/N): ", TARGETS_FILE);
+    if (get_line(line, sizeof(line)) && (line[0] == 'y' || line[0] == 'Y')) {
+        FILE *f = fopen(TARGETS_FILE, "w");
+        if (!f) {
+            perror("Failed to open targets file");
+        } else {
+            for (int i = 0; i < k; ++i) fprintf(f, "%s %.10g\n", c->symbols[i], top[i]);
+            fclose(f);
+            printf("Wrote %d weights to %s.\n", k, TARGETS_FILE);
+        }
+    }
+
+    pf_mem_free(solver_work);
+    pf_mem_free(cov); pf_mem_free(l); pf_mem_free(vec); pf_mem_free(front); pf_mem_free(lambda); pf_mem_free(iters);
+}
+
+/* ---------- Rebalancing: target weights to a minimal trade list ---------- */
+
+#define TRADES_SHOWN 20
+
+/* targets.txt: "SYMBOL WEIGHT [LOT [PRICE]]" per line. WEIGHT is a
+ * fraction of current market value (0.25 = 25%); PRICE, in the base
+ * currency, is only needed for symbols not yet held. Unlisted holdings
+ * are left alone. */
+typedef struct {
+    char symbol[SYMBOL_LEN];
+    double weight;
+    int lot;
+    double price;
+} Target;
+
+typedef struct {
+    int idx;       /* position index, -1 for a new symbol */
+    int target;    /* index into the targets */
+    int qty;       /* > 0 buy, < 0 sell */
+    double price;
+    double value;  /* qty * price */
+} Trade;
+
+static int cmp_target_sym(const void *a, const void *b) {
+    return strcmp(((const Target *)a)->symbol, ((const Target *)b)->symbol);
+}
+
+/* largest |value| first */
+static int cmp_trade_size(const void *a, const void *b) {
+    double x = fabs(((const Trade *)a)->value), y = fabs(((const Trade *)b)->value);
+    return (x < y) - (x > y);
+}
+
+/* sells before buys, each in book order (new symbols last) */
+static int cmp_trade_exec(const void *a, const void *b) {
+    const Trade *x = (const Trade *)a, *y = (const Trade *)b;
+    if ((x->qty < 0) != (y->qty < 0)) return x->qty < 0 ? -1 : 1;
+    unsigned xi = (unsigned)x->idx, yi = (unsigned)y->idx; /* -1 sorts last */
+    if (xi != yi) return xi < yi ? -1 : 1;
+    return x->target - y->target;
+}
+
+/* Read and sort targets by symbol; a duplicated symbol keeps one entry.
+ * Returns the number of targets or -1 if the file is missing. */
+static int load_targets(const char *fname, int default_lot, Target **out) {
+    FILE *f = fopen(fname, "r");
+    if (!f) { printf("No targets found (%s).\n", fname); return -1; }
+    char line[LINE_BUF];
+    int n = 0, cap = 0;
+    Target *t = NULL;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        Target cur = { "", 0.0, default_lot, 0.0 };
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%15s %lf %d %lf", cur.symbol, &cur.weight, &cur.lot, &cur.price) < 2)
+            continue;
+        if (cur.weight < 0.0 || cur.lot <= 0) {
+            printf("Warning: bad weight or lot for %s, skipping.\n", cur.symbol);
+            continue;
+        }
+        pf_symbol_upper(cur.symbol);
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            Target *grown = pf_mem_realloc(PF_MEM_ANALYTICS, t, (size_t)cap * sizeof(Target));
+            if (!grown) break;
+            t = grown;
+        }
+        t[n++] = cur;
+    }
+    fclose(f);
+    if (n == 0) { pf_mem_free(t); *out = NULL; return 0; }
+
+    qsort(t, (size_t)n, sizeof(Target), cmp_target_sym);
+    int m = 0;
+    for (int i = 0; i < n; ++i) {
+        if (m > 0 && strcmp(t[m - 1].symbol, t[i].symbol) == 0) {
+            printf("Warning: %s listed twice, using one entry.\n", t[i].symbol);
+            continue;
+        }
+        t[m++] = t[i];
+    }
+    *out = t;
+    return m;
+}
+
+typedef struct {
+    int ntrades, nsells, skipped_band, skipped_price, dropped;
+    double book, turnover, net_cash;
+} RebalanceSummary;
+
+/* Match targets to holdings with a sort-merge join (O(n log n), no
+ * per-symbol scans) and emit one trade per symbol that is off target by
+ * more than `band` of book value after rounding to lots. With max_trades
+ * > 0 only the largest trades are kept. Trades come back in execution
+ * order: sells, then buys. */
+static Trade *plan_rebalance(const Portfolio *pf, const Target *tg, int nt, double band, int max_trades,
+                             RebalanceSummary *sum) {
+    memset(sum, 0, sizeof(*sum));
+    for (int i = 0; i < pf->count; ++i)
+        sum->book += pf->items[i].cur_price * pf->items[i].qty * pf->fx.conv[pf->items[i].ccy];
+
+    SymRef *order = sorted_positions(pf);
+    Trade *tr = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)nt * sizeof(Trade));
+    if (!order || !tr) { pf_mem_free(order); pf_mem_free(tr); return NULL; }
+
+    int n = 0, p = 0;
+    for (int t = 0; t < nt; ++t) {
+        while (p < pf->count && strcmp(order[p].sym, tg[t].symbol) < 0) ++p;
+        int idx = (p < pf->count && strcmp(order[p].sym, tg[t].symbol) == 0) ? order[p].idx : -1;
+        double price = idx >= 0 ? pf->items[idx].cur_price : tg[t].price;
+        double conv = idx >= 0 ? pf->fx.conv[pf->items[idx].ccy] : 1.0; /* new symbols trade in base */
+        int held = idx >= 0 ? pf->items[idx].qty : 0;
+        if (held == 0 && tg[t].weight == 0.0) continue;
+        if (price <= 0.0) { sum->skipped_price++; continue; }
+
+        double lots = floor(tg[t].weight * sum->book / (price * conv) / tg[t].lot + 0.5);
+        long long want = (long long)lots * tg[t].lot;
+        long long diff = want - held;
+        if (diff == 0) continue;
+        if (diff > INT32_MAX) { sum->skipped_price++; continue; } /* price too small */
+        if (fabs((double)diff * price * conv) < band * sum->book) { sum->skipped_band++; continue; }
+
+        tr[n].idx = idx;
+        tr[n].target = t;
+        tr[n].qty = (int)diff;
+        tr[n].price = price;
+        tr[n].value = (double)diff * price * conv; /* in base currency */
+        ++n;
+    }
+    pf_mem_free(order);
+
+    if (max_trades > 0 && n > max_trades) {
+        qsort(tr, (size_t)n, sizeof(Trade), cmp_trade_size);
+        sum->dropped = n - max_trades;
+        n = max_trades;
+    }
+    qsort(tr, (size_t)n, sizeof(Trade), cmp_trade_exec);
+    for (int i = 0; i < n; ++i) {
+        sum->turnover += fabs(tr[i].value);
+        sum->net_cash -= tr[i].value;
+        if (tr[i].qty < 0) sum->nsells++;
+    }
+    sum->ntrades = n;
+    return tr;
+}
+
+/* Apply a planned batch through the same cores as buy()/sell().
+ * Emptied positions are compacted once at the end instead of shifting
+ * the book on every sale. Returns the number of trades applied. */
+static int apply_trades(Portfolio *pf, const Trade *tr, int n, const Target *tg) {
+    int applied = 0;
+    for (int i = 0; i < n; ++i) {
+        if (tr[i].qty < 0) {
+            pf_remove_shares(pf, tr[i].idx, -tr[i].qty, tr[i].price, 1);
+            ++applied;
+        } else if (pf_add_shares(pf, tr[i].idx, tg[tr[i].target].symbol, tr[i].qty, tr[i].price,
+                              pf->fx.base) >= 0) {
+            ++applied;
+        }
+    }
+    pf_compact(pf);
+    return applied;
+}
+
+void rebalance(Portfolio *pf) {
+    char line[LINE_BUF];
+    int lot, max_trades;
+    double band_pct;
+
+    if (!prompt_int("Default lot size (Enter for 1): ", 1, &lot) || lot <= 0) {
+        printf("Invalid lot size.\n"); return;
+    }
+    if (!prompt_double("Drift band % of book value (Enter for 0.5): ", 0.5, &band_pct)
+        || band_pct < 0.0) {
+        printf("Invalid band.\n"); return;
+    }
+    if (!prompt_int("Max trades (Enter for no limit): ", 0, &max_trades) || max_trades < 0) {
+        printf("Invalid trade limit.\n"); return;
+    }
+
+    Target *tg = NULL;
+    int nt = load_targets(TARGETS_FILE, lot, &tg);
+    if (nt < 0) return;
+    if (nt == 0) { printf("No targets in %s.\n", TARGETS_FILE); return; }
+
+    RebalanceSummary sum;
+    Trade *tr = plan_rebalance(pf, tg, nt, band_pct / 100.0, max_trades, &sum);
+    if (!tr) { printf("Out of memory.\n"); pf_mem_free(tg); return; }
+
+    printf("Rebalance vs %s: %d targets, book value %.2f\n", TARGETS_FILE, nt, sum.book);
+    if (sum.ntrades == 0) {
+        printf("Already within band; nothing to trade.\n");
+    } else {
+        /* show the largest trades, execution order is unchanged */
+        Trade *shown = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)sum.ntrades * sizeof(Trade));
+        int nshow = sum.ntrades < TRADES_SHOWN ? sum.ntrades : TRADES_SHOWN;
+        if (shown) {
+            memcpy(shown, tr, (size_t)sum.ntrades * sizeof(Trade));
+            qsort(shown, (size_t)sum.ntrades, sizeof(Trade), cmp_trade_size);
+            printf("%-6s %-10s %10s %10s %14s\n", "Action", "Symbol", "Qty", "Price", "Value");
+            for (int i = 0; i < nshow; ++i)
+                printf("%-6s %-10s %10d %10.2f %14.2f\n", shown[i].qty < 0 ? "SELL" : "BUY",
+                       tg[shown[i].target].symbol, abs(shown[i].qty), shown[i].price,
+                       fabs(shown[i].value));
+            if (sum.ntrades > nshow) printf("... and %d smaller trades\n", sum.ntrades - nshow);
+            pf_mem_free(shown);
+        }
+        printf("Trades: %d (%d sells, %d buys), turnover %.2f (%.1f%% of book), net cash %+.2f\n",
+               sum.ntrades, sum.nsells, sum.ntrades - sum.nsells, sum.turnover,
+               sum.book > 0.0 ? sum.turnover / sum.book * 100.0 : 0.0, sum.net_cash);
+    }
+    if (sum.skipped_band || sum.skipped_price || sum.dropped)
+        printf("Skipped: %d within band, %d without a usable price, %d over the trade limit\n",
+               sum.skipped_band, sum.skipped_price, sum.dropped);
+
+    if (sum.ntrades > 0) {
+        printf("Apply these %d trades? (y/N): ", sum.ntrades);
+        if (get_line(line, sizeof(line)) && (line[0] == 'y' || line[0] == 'Y')) {
+            int applied = apply_trades(pf, tr, sum.ntrades, tg);
+            printf("Applied %d trades; %d positions now held.\n", applied, pf->count);
+        } else {
+            printf("No trades applied.\n");
+        }
+    }
+    pf_mem_free(tr);
+    pf_mem_free(tg);
+}
+
+/* ---------- Backtesting: strategy replay with parallel sweeps ---------- */
+
+#define BT_MAX_PARAMS 3
+#define BT_MAX_RUNS 100000
+#define BT_CURVE_BUDGET ((size_t)256 << 20)  /* bytes of equity curves kept */
+#define BT_EQUITY_FILE "backtest_equity.txt"
+
+/* Bump allocator: one per worker, reset between runs, so every run gets
+ * a fresh zeroed portfolio without touching malloc. */
+typedef struct {
+    char *base;
+    size_t used, cap;
+} Arena;
+
+static int arena_init(Arena *a, size_t cap) {
+    a->base = pf_mem_alloc(PF_MEM_ANALYTICS, cap);
+    a->used = 0;
+    a->cap = a->base ? cap : 0;
+    return a->base != NULL;
+}
+
+static void *arena_alloc(Arena *a, size_t n) {
+    n = (n + 15) & ~(size_t)15;
+    if (a->used + n > a->cap) return NULL;
+    void *p = a->base + a->used;
+    a->used += n;
+    memset(p, 0, n);
+    return p;
+}
+
+static void arena_reset(Arena *a) { a->used = 0; }
+
+static void arena_free(Arena *a) {
+    pf_mem_free(a->base);
+    memset(a, 0, sizeof(*a));
+}
+
+/* An isolated book over the history's symbols (one slot per column). */
+typedef struct {
+    double cash;
+    int *qty;
+    double *buy_price;  /* average cost */
+    long trades;
+} BtBook;
+
+typedef struct {
+    const History *h;
+    BtBook *book;
+    const double *params;
+    double fee_rate;
+    void *state;        /* strategy-owned, arena allocated and zeroed */
+} BtContext;
+
+/* A strategy is called once per day after the close is known and trades
+ * at that close through bt_order_target(). */
+typedef struct {
+    const char *name;
+    const char *about;
+    int nparams;
+    const char *param_names[BT_MAX_PARAMS];
+    double defaults[BT_MAX_PARAMS][3];  /* from, to, step */
+    size_t (*state_size)(int nsym);
+    void (*on_day)(BtContext *ctx, int day);
+} Strategy;
+
+static double bt_price(const BtContext *ctx, int day, int j) {
+    return ctx->h->prices[(size_t)day * ctx->h->nsym + j];
+}
+
+/* Move column j to `want` shares at today's close, the way buy()/sell()
+ * would: average cost on buys, no short sales, and buys limited by cash. */
+static void bt_order_target(BtContext *ctx, int day, int j, int want) {
+    BtBook *b = ctx->book;
+    double p = bt_price(ctx, day, j);
+    if (isnan(p) || want < 0) return;
+    int q = want - b->qty[j];
+    if (q > 0) {
+        int afford = (int)floor(b->cash / (p * (1.0 + ctx->fee_rate)));
+        if (q > afford) q = afford;
+        if (q <= 0) return;
+        double old_cost = (double)b->qty[j] * b->buy_price[j];
+        b->qty[j] += q;
+        b->buy_price[j] = (old_cost + (double)q * p) / b->qty[j];
+        b->cash -= (double)q * p * (1.0 + ctx->fee_rate);
+        b->trades++;
+    } else if (q < 0) {
+        b->qty[j] += q;
+        b->cash += (double)-q * p * (1.0 - ctx->fee_rate);
+        b->trades++;
+    }
+}
+
+static double bt_equity(const BtContext *ctx, int day) {
+    double e = ctx->book->cash;
+    const double *p = ctx->h->prices + (size_t)day * ctx->h->nsym;
+    for (int j = 0; j < ctx->h->nsym; ++j)
+        if (ctx->book->qty[j]) e += ctx->book->qty[j] * p[j];
+    return e;
+}
+
+/* equal-weight the picked columns at today's close; sells go first so
+ * their cash funds the buys */
+static void bt_hold_equal(BtContext *ctx, int day, const unsigned char *pick, int npick) {
+    int nsym = ctx->h->nsym;
+    double budget = npick > 0 ? bt_equity(ctx, day) / npick : 0.0;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int j = 0; j < nsym; ++j) {
+            double p = bt_price(ctx, day, j);
+            int want = (pick[j] && p > 0.0) ? (int)floor(budget / (p * (1.0 + ctx->fee_rate))) : 0;
+            if ((pass == 0) == (want < ctx->book->qty[j])) bt_order_target(ctx, day, j, want);
+        }
+    }
+}
+
+/* sma: hold (equal weight) every symbol whose fast SMA is above its slow SMA */
+typedef struct {
+    double *fast_sum, *slow_sum;
+    unsigned char *pick;
+} SmaState;
+
+static size_t sma_state_size(int nsym) {
+    return sizeof(SmaState) + (size_t)nsym * (2 * sizeof(double) + 1) + 64;
+}
+
+static void sma_on_day(BtContext *ctx, int day) {
+    const History *h = ctx->h;
+    SmaState *st = (SmaState *)ctx->state;
+    int fast = (int)ctx->params[0], slow = (int)ctx->params[1];
+    if (fast < 1 || slow <= fast) return;
+    if (st->pick == NULL) {  /* first day: carve arrays behind the header */
+        st->fast_sum = (double *)(st + 1);
+        st->slow_sum = st->fast_sum + h->nsym;
+        st->pick = (unsigned char *)(st->slow_sum + h->nsym);
+    }
+    int changed = 0, npick = 0;
+    for (int j = 0; j < h->nsym; ++j) {
+        double p = bt_price(ctx, day, j);
+        st->fast_sum[j] += isnan(p) ? 0.0 : p;
+        st->slow_sum[j] += isnan(p) ? 0.0 : p;
+        if (day >= fast) { double o = bt_price(ctx, day - fast, j); st->fast_sum[j] -= isnan(o) ? 0.0 : o; }
+        if (day >= slow) { double o = bt_price(ctx, day - slow, j); st->slow_sum[j] -= isnan(o) ? 0.0 : o; }
+        unsigned char want = 0;
+        if (day >= slow - 1 && !isnan(bt_price(ctx, day - slow + 1, j)))
+            want = st->fast_sum[j] / fast > st->slow_sum[j] / slow;
+        if (want != st->pick[j]) { st->pick[j] = want; changed = 1; }
+        npick += want;
+    }
+    if (changed) bt_hold_equal(ctx, day, st->pick, npick);
+}
+
+/* momentum: every `every` days hold the top N symbols by trailing return */
+typedef struct {
+    double *score, *scratch;
+    unsigned char *pick;
+} MomState;
+
+static size_t mom_state_size(int nsym) {
+    return sizeof(MomState) + (size_t)nsym * (2 * sizeof(double) + 1) + 64;
+}
+
+static void mom_on_day(BtContext *ctx, int day) {
+    const History *h = ctx->h;
+    MomState *st = (MomState *)ctx->state;
+    int look = (int)ctx->params[0], top = (int)ctx->params[1], every = (int)ctx->params[2];
+    if (look < 1 || top < 1 || every < 1 || day < look || (day - look) % every != 0) return;
+    if (st->pick == NULL) {
+        st->score = (double *)(st + 1);
+        st->scratch = st->score + h->nsym;
+        st->pick = (unsigned char *)(st->scratch + h->nsym);
+    }
+    int valid = 0;
+    for (int j = 0; j < h->nsym; ++j) {
+        double p0 = bt_price(ctx, day - look, j), p1 = bt_price(ctx, day, j);
+        st->score[j] = (isnan(p0) || isnan(p1)) ? -INFINITY : p1 / p0 - 1.0;
+        if (!isinf(st->score[j])) st->scratch[valid++] = -st->score[j];
+    }
+    int n = top < valid ? top : valid;
+    double cut = n > 0 ? -select_kth(st->scratch, valid, n - 1) : INFINITY;
+    int npick = 0;
+    for (int j = 0; j < h->nsym; ++j) {
+        st->pick[j] = npick < n && st->score[j] >= cut;
+        npick += st->pick[j];
+    }
+    bt_hold_equal(ctx, day, st->pick, npick);
+}
+
+static const Strategy strategies[] = {
+    { "sma", "moving-average crossover, equal weight across signals", 2,
+      { "fast window", "slow window", NULL },
+      { { 5, 50, 5 }, { 20, 200, 20 }, { 0, 0, 0 } },
+      sma_state_size, sma_on_day },
+    { "momentum", "hold the top N by trailing return, rebalanced periodically", 3,
+      { "lookback days", "top N", "rebalance every" },
+      { { 20, 120, 20 }, { 1, 10, 1 }, { 5, 20, 5 } },
+      mom_state_size, mom_on_day },
+};
+#define NUM_STRATEGIES ((int)(sizeof(strategies) / sizeof(strategies[0])))
+
+typedef struct {
+    double params[BT_MAX_PARAMS];
+    double final_equity, total_ret, ann_ret, ann_vol, sharpe, max_dd;
+    long trades;
+} BtResult;
+
+typedef struct {
+    const History *h;
+    const Strategy *st;
+    double cash, fee_rate;
+    double grid[BT_MAX_PARAMS][3];
+    int steps[BT_MAX_PARAMS];
+    BtResult *res;
+    double *curves;  /* runs x ndays, or NULL when over budget */
+} BtSweep;
+
+/* one worker: a private arena reused for each run in its range */
+static void bt_range(void *p, int r0, int r1) {
+    BtSweep *sw = (BtSweep *)p;
+    const History *h = sw->h;
+    Arena arena;
+    size_t need = sizeof(BtBook) + (size_t)h->nsym * (sizeof(int) + sizeof(double))
+                + sw->st->state_size(h->nsym) + 256;
+    int have_arena = arena_init(&arena, need);
+
+    for (int r = r0; r < r1; ++r) {
+        BtResult *res = &sw->res[r];
+        int rem = r;
+        for (int k = sw->st->nparams - 1; k >= 0; --k) {
+            res->params[k] = sw->grid[k][0] + (rem % sw->steps[k]) * sw->grid[k][2];
+            rem /= sw->steps[k];
+        }
+        res->final_equity = NAN;
+        if (!have_arena) continue;
+
+        arena_reset(&arena);
+        BtBook *book = arena_alloc(&arena, sizeof(BtBook));
+        book->qty = arena_alloc(&arena, (size_t)h->nsym * sizeof(int));
+        book->buy_price = arena_alloc(&arena, (size_t)h->nsym * sizeof(double));
+        book->cash = sw->cash;
+        BtContext ctx = { h, book, res->params, sw->fee_rate,
+                          arena_alloc(&arena, sw->st->state_size(h->nsym)) };
+
+        double *curve = sw->curves ? sw->curves + (size_t)r * h->ndays : NULL;
+        double prev = sw->cash, peak = sw->cash, sum = 0.0, sq = 0.0;
+        for (int d = 0; d < h->ndays; ++d) {
+            sw->st->on_day(&ctx, d);
+            double e = bt_equity(&ctx, d);
+            if (curve) curve[d] = e;
+            if (d > 0 && prev > 0.0) {
+                double ret = e / prev - 1.0;
+                sum += ret;
+                sq += ret * ret;
+            }
+            if (e > peak) peak = e;
+            if (peak > 0.0 && (peak - e) / peak > res->max_dd) res->max_dd = (peak - e) / peak;
+            prev = e;
+        }
+        int n = h->ndays - 1;
+        double mean = sum / n, var = n > 1 ? (sq - sum * mean) / (n - 1) : 0.0;
+        res->final_equity = prev;
+        res->total_ret = prev / sw->cash - 1.0;
+        res->ann_ret = mean * TRADING_DAYS;
+        res->ann_vol = sqrt(var > 0.0 ? var * TRADING_DAYS : 0.0);
+        res->sharpe = res->ann_vol > 0.0 ? res->ann_ret / res->ann_vol : 0.0;
+        res->trades = book->trades;
+    }
+    if (have_arena) arena_free(&arena);
+}
+
+static int cmp_result_sharpe(const void *a, const void *b) {
+    const BtResult *x = (const BtResult *)a, *y = (const BtResult *)b;
+    if (isnan(x->final_equity) != isnan(y->final_equity)) return isnan(x->final_equity) ? 1 : -1;
+    return (x->sharpe < y->sharpe) - (x->sharpe > y->sharpe);
+}
+
+void backtest() {
+    char line[LINE_BUF];
+    int choice;
+    BtSweep sw;
+    memset(&sw, 0, sizeof(sw));
+
+    for (int i = 0; i < NUM_STRATEGIES; ++i)
+        printf("%d) %-9s - %s\n", i + 1, strategies[i].name, strategies[i].about);
+    if (!prompt_int("Choose strategy (Enter for 1): ", 1, &choice)
+        || choice < 1 || choice > NUM_STRATEGIES) {
+        printf("Invalid strategy.\n"); return;
+    }
+    sw.st = &strategies[choice - 1];
+
+    int runs = 1;
+    for (int k = 0; k < sw.st->nparams; ++k) {
+        const double *d = sw.st->defaults[k];
+        printf("%s: from to step (Enter for %g %g %g): ", sw.st->param_names[k], d[0], d[1], d[2]);
+        if (!get_line(line, sizeof(line))) return;
+        double from = d[0], to = d[1], step = d[2];
+        int got = strlen(line) ? sscanf(line, "%lf %lf %lf", &from, &to, &step) : 3;
+        if (got == 1) { to = from; step = 1; }
+        if (got == 2) step = 1;
+        if (got < 1 || step <= 0.0 || to < from) { printf("Invalid range.\n"); return; }
+        sw.grid[k][0] = from; sw.grid[k][1] = to; sw.grid[k][2] = step;
+        sw.steps[k] = (int)floor((to - from) / step + 1e-9) + 1;
+        if ((long long)runs * sw.steps[k] > BT_MAX_RUNS) {
+            printf("Too many combinations (limit %d).\n", BT_MAX_RUNS); return;
+        }
+        runs *= sw.steps[k];
+    }
+    double fee_bps;
+    if (!prompt_double("Initial cash (Enter for 100000): ", 100000.0, &sw.cash) || sw.cash <= 0.0) {
+        printf("Invalid cash.\n"); return;
+    }
+    if (!prompt_double("Commission in bps (Enter for 5): ", 5.0, &fee_bps) || fee_bps < 0.0) {
+        printf("Invalid commission.\n"); return;
+    }
+    sw.fee_rate = fee_bps / 10000.0;
+
+    History h;
+    if (!load_history(&h, HISTORY_FILE)) return;
+    sw.h = &h;
+    sw.res = pf_mem_calloc(PF_MEM_ANALYTICS, (size_t)runs, sizeof(BtResult));
+    size_t curve_bytes = (size_t)runs * h.ndays * sizeof(double);
+    sw.curves = curve_bytes <= BT_CURVE_BUDGET ? pf_mem_alloc(PF_MEM_ANALYTICS, curve_bytes) : NULL;
+    if (!sw.res) { printf("Out of memory.\n"); pf_mem_free(sw.curves); free_history(&h); return; }
+
+    printf("Running %d combinations of %s over %d days x %d symbols on %d threads...\n",
+           runs, sw.st->name, h.ndays, h.nsym, num_threads());
+    double t0 = now_sec();
+    parallel_for(runs, 1, bt_range, &sw);
+    double dt = now_sec() - t0;
+    printf("Done in %.3f s (%.0f runs/s)\n", dt, dt > 0.0 ? runs / dt : 0.0);
+
+    BtResult *ranked = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)runs * sizeof(BtResult));
+    if (ranked) {
+        memcpy(ranked, sw.res, (size_t)runs * sizeof(BtResult));
+        qsort(ranked, (size_t)runs, sizeof(BtResult), cmp_result_sharpe);
+        int shown = runs < 10 ? runs : 10;
+        printf("\nTop %d by Sharpe:\n", shown);
+        for (int k = 0; k < sw.st->nparams; ++k) printf("%8.8s ", sw.st->param_names[k]);
+        printf("%9s %9s %9s %7s %7s %7s\n", "Return", "Ann.Ret", "Ann.Vol", "Sharpe", "MaxDD", "Trades");
+        for (int i = 0; i < shown && !isnan(ranked[i].final_equity); ++i) {
+            for (int k = 0; k < sw.st->nparams; ++k) printf("%8g ", ranked[i].params[k]);
+            printf("%8.2f%% %8.2f%% %8.2f%% %7.2f %6.1f%% %7ld\n", ranked[i].total_ret * 100.0,
+                   ranked[i].ann_ret * 100.0, ranked[i].ann_vol * 100.0, ranked[i].sharpe,
+                   ranked[i].max_dd * 100.0, ranked[i].trades);
+        }
+        pf_mem_free(ranked);
+    }
+
+    if (sw.curves) {
+        printf("Write equity curves to %s? (y/N): ", BT_EQUITY_FILE);
+        if (get_line(line, sizeof(line)) && (line[0] == 'y' || line[0] == 'Y')) {
+            FILE *f = fopen(BT_EQUITY_FILE, "w");
+            if (!f) {
+                perror("Failed to open equity file");
+            } else {
+                /* one run per line: parameters, then equity by day */
+                for (int r = 0; r < runs; ++r) {
+                    for (int k = 0; k < sw.st->nparams; ++k) fprintf(f, "%g ", sw.res[r].params[k]);
+                    for (int d = 0; d < h.ndays; ++d)
+                        fprintf(f, d + 1 < h.ndays ? "%.2f " : "%.2f\n", sw.curves[(size_t)r * h.ndays + d]);
+                }
+                fclose(f);
+                printf("Wrote %d equity curves to %s.\n", runs, BT_EQUITY_FILE);
+            }
+        }
+    } else {
+        printf("Equity curves not kept (over %zu MB); summary stats only.\n", BT_CURVE_BUDGET >> 20);
+    }
+    pf_mem_free(sw.res);
+    pf_mem_free(sw.curves);
+    free_history(&h);
+}
+
+/* ---------- Stress testing: batched scenario revaluation ---------- */
+
+#define SCENARIO_FILE "scenarios.txt"
+#define GROUPS_FILE "groups.txt"
+#define SCENARIO_OUT "scenario_results.txt"
+#define SCEN_BLOCK_BYTES ((size_t)32 << 20)  /* shock rows built per pass */
+#define SCEN_PRINT_MAX 50
+
+/* scenarios.txt: "NAME KEY=PCT KEY=PCT ..." where KEY is a symbol, a
+ * group from groups.txt ("SYMBOL GROUP" lines) or ALL; the most
+ * specific key wins. Example: "techcrash TECH=-20 ENERGY=+5 ALL=-2". */
+typedef struct {
+    int kind;      /* 0 = all positions, 1 = group, 2 = one position */
+    int id;
+    double shock;  /* fractional return */
+} ShockTerm;
+
+typedef struct {
+    char name[32];
+    int first, nterms;
+} Scenario;
+
+typedef struct {
+    int nscen, nterms, ngroups, unknown;
+    Scenario *scen;
+    ShockTerm *terms;
+    char (*groups)[SYMBOL_LEN];
+    int *pos_group;  /* per position, -1 if ungrouped */
+} ScenarioSet;
+
+static void free_scenarios(ScenarioSet *ss) {
+    pf_mem_free(ss->scen);
+    pf_mem_free(ss->terms);
+    pf_mem_free(ss->groups);
+    pf_mem_free(ss->pos_group);
+    memset(ss, 0, sizeof(*ss));
+}
+
+static int find_group(const ScenarioSet *ss, const char *name) {
+    for (int g = 0; g < ss->ngroups; ++g)
+        if (strcmp(ss->groups[g], name) == 0) return g;
+    return -1;
+}
+
+/* returns 1 on success (groups.txt is optional) */
+static int load_scenarios(const Portfolio *pf, ScenarioSet *ss) {
+    memset(ss, 0, sizeof(*ss));
+    FILE *f = fopen(SCENARIO_FILE, "r");
+    if (!f) { printf("No scenarios found (%s).\n", SCENARIO_FILE); return 0; }
+
+    SymRef *order = sorted_positions(pf);
+    ss->pos_group = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)(pf->count ? pf->count : 1) * sizeof(int));
+    if (!order || !ss->pos_group) { pf_mem_free(order); fclose(f); free_scenarios(ss); return 0; }
+    for (int i = 0; i < pf->count; ++i) ss->pos_group[i] = -1;
+
+    int gcap = 0, ok = 1;
+    FILE *gf = fopen(GROUPS_FILE, "r");
+    if (gf) {
+        char line[LINE_BUF], sym[SYMBOL_LEN], grp[SYMBOL_LEN];
+        while (ok && fgets(line, sizeof(line), gf) != NULL) {
+            if (sscanf(line, "%15s %15s", sym, grp) != 2 || sym[0] == '#') continue;
+            pf_symbol_upper(sym);
+            pf_symbol_upper(grp);
+            int g = find_group(ss, grp);
+            if (g < 0) {
+                if (ss->ngroups == gcap) {
+                    gcap = gcap ? gcap * 2 : 16;
+                    void *grown = pf_mem_realloc(PF_MEM_ANALYTICS, ss->groups, (size_t)gcap * sizeof(*ss->groups));
+                    if (!grown) { ok = 0; break; }
+                    ss->groups = grown;
+                }
+                g = ss->ngroups++;
+                memcpy(ss->groups[g], grp, SYMBOL_LEN);
+            }
+            int idx = lookup_sorted(order, pf->count, sym);
+            if (idx >= 0) ss->pos_group[idx] = g;
+        }
+        fclose(gf);
+    }
+
+    char *line = NULL;
+    size_t linecap = 0;
+    int scap = 0, tcap = 0;
+    while (ok && getline(&line, &linecap, f) != -1) {
+        char *p = line;
+        char *tok = next_token(&p);
+        if (tok == NULL || tok[0] == '#') continue;
+        if (ss->nscen == scap) {
+            scap = scap ? scap * 2 : 64;
+            void *grown = pf_mem_realloc(PF_MEM_ANALYTICS, ss->scen, (size_t)scap * sizeof(Scenario));
+            if (!grown) { ok = 0; break; }
+            ss->scen = grown;
+        }
+        Scenario *sc = &ss->scen[ss->nscen++];
+        snprintf(sc->name, sizeof(sc->name), "%s", tok);
+        sc->first = ss->nterms;
+        sc->nterms = 0;
+        while ((tok = next_token(&p)) != NULL) {
+            char *eq = strchr(tok, '=');
+            double pct;
+            if (!eq || !parse_double(eq + 1, &pct)) { ss->unknown++; continue; }
+            *eq = '\0';
+            pf_symbol_upper(tok);
+            ShockTerm t = { 0, 0, pct / 100.0 };
+            if (strcmp(tok, "ALL") != 0) {
+                int id = find_group(ss, tok);
+                if (id >= 0) { t.kind = 1; t.id = id; }
+                else if ((id = lookup_sorted(order, pf->count, tok)) >= 0) { t.kind = 2; t.id = id; }
+                else { ss->unknown++; continue; }
+            }
+            if (ss->nterms == tcap) {
+                tcap = tcap ? tcap * 2 : 256;
+                void *grown = pf_mem_realloc(PF_MEM_ANALYTICS, ss->terms, (size_t)tcap * sizeof(ShockTerm));
+                if (!grown) { ok = 0; break; }
+                ss->terms = grown;
+            }
+            ss->terms[ss->nterms++] = t;
+            sc->nterms++;
+        }
+    }
+    free(line);
+    pf_mem_free(order);
+    fclose(f);
+    if (!ok) { printf("Out of memory reading scenarios.\n"); free_scenarios(ss); }
+    return ok;
+}
+
+typedef struct {
+    const ScenarioSet *ss;
+    int npos;      /* row length */
+    int first;     /* scenario of row 0 */
+    double *rows;  /* block of shock rows, one column per position */
+} ShockFill;
+
+/* expand scenarios into dense shock rows: ALL, then groups, then symbols */
+static void fill_shocks(void *p, int r0, int r1) {
+    ShockFill *sf = (ShockFill *)p;
+    const ScenarioSet *ss = sf->ss;
+    for (int r = r0; r < r1; ++r) {
+        const Scenario *sc = &ss->scen[sf->first + r];
+        double *row = sf->rows + (size_t)r * sf->npos;
+        for (int i = 0; i < sf->npos; ++i) row[i] = 0.0;
+        for (int kind = 0; kind <= 2; ++kind) {
+            for (int t = sc->first; t < sc->first + sc->nterms; ++t) {
+                const ShockTerm *term = &ss->terms[t];
+                if (term->kind != kind) continue;
+                if (kind == 0) {
+                    for (int i = 0; i < sf->npos; ++i) row[i] = term->shock;
+                } else if (kind == 1) {
+                    for (int i = 0; i < sf->npos; ++i)
+                        if (ss->pos_group[i] == term->id) row[i] = term->shock;
+                } else {
+                    row[term->id] = term->shock;
+                }
+            }
+        }
+    }
+}
+
+void stress_test(Portfolio *pf) {
+    if (pf->count == 0) { printf("Portfolio is empty.\n"); return; }
+    ScenarioSet ss;
+    if (!load_scenarios(pf, &ss)) return;
+    if (ss.nscen == 0) { printf("No scenarios in %s.\n", SCENARIO_FILE); free_scenarios(&ss); return; }
+
+    int block = (int)(SCEN_BLOCK_BYTES / ((size_t)pf->count * sizeof(double)));
+    if (block < 1) block = 1;
+    if (block > ss.nscen) block = ss.nscen;
+    double *mv = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)pf->count * sizeof(double));
+    double *rows = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)block * pf->count * sizeof(double));
+    double *pl = pf_mem_alloc(PF_MEM_ANALYTICS, (size_t)block * sizeof(double));
+    FILE *out = fopen(SCENARIO_OUT, "w");
+    if (!mv || !rows || !pl || !out) {
+        printf(out ? "Out of memory.\n" : "Cannot write %s.\n", SCENARIO_OUT);
+        pf_mem_free(mv); pf_mem_free(rows); pf_mem_free(pl);
+        if (out) fclose(out);
+        free_scenarios(&ss);
+        return;
+    }
+
+    double book = 0.0;
+    for (int i = 0; i < pf->count; ++i) {
+        mv[i] = pf->items[i].cur_price * pf->items[i].qty * pf->fx.conv[pf->items[i].ccy];
+        book += mv[i];
+    }
+    int echo = ss.nscen <= SCEN_PRINT_MAX;
+    int worst = 0, best = 0;
+    double worst_pl = INFINITY, best_pl = -INFINITY;
+    if (ss.unknown) printf("Warning: %d shock terms matched no holding or group.\n", ss.unknown);
+    if (echo) printf("%-20s %14s %9s\n", "Scenario", "P/L", "P/L%");
+    fprintf(out, "# scenario pnl pnl_pct (book %.2f)\n", book);
+
+    double t0 = now_sec();
+    for (int s0 = 0; s0 < ss.nscen; s0 += block) {
+        int n = ss.nscen - s0 < block ? ss.nscen - s0 : block;
+        ShockFill sf = { &ss, pf->count, s0, rows };
+        parallel_for(n, 16, fill_shocks, &sf);
+        gemv(rows, n, pf->count, mv, pl);
+        /* stream this block out before building the next */
+        for (int r = 0; r < n; ++r) {
+            double pct = book > 0.0 ? pl[r] / book * 100.0 : 0.0;
+            fprintf(out, "%s %.2f %.4f\n", ss.scen[s0 + r].name, pl[r], pct);
+            if (echo) printf("%-20s %14.2f %8.2f%%\n", ss.scen[s0 + r].name, pl[r], pct);
+            if (pl[r] < worst_pl) { worst_pl = pl[r]; worst = s0 + r; }
+            if (pl[r] > best_pl) { best_pl = pl[r]; best = s0 + r; }
+        }
+    }
+    double dt = now_sec() - t0;
+    fclose(out);
+
+    printf("%d scenarios x %d positions in %.3f s (%.0f scenarios/s), results in %s\n",
+           ss.nscen, pf->count, dt, dt > 0.0 ? ss.nscen / dt : 0.0, SCENARIO_OUT);
+    printf("Worst: %s %.2f   Best: %s %.2f\n", ss.scen[worst].name, worst_pl,
+           ss.scen[best].name, best_pl);
+    pf_mem_free(mv); pf_mem_free(rows); pf_mem_free(pl);
+    free_scenarios(&ss);
+}
+
+/* ---------- Currencies: rates & reporting currency ---------- */
+
+void fx_menu(Portfolio *pf) {
+    char line[LINE_BUF], a[16], b[32];
+
+    pf_fx_aggregate(pf);
+    printf("%-4s %14s %14s %6s %16s\n", "Ccy", "Rate (pivot)", "To base", "Pos", "Value (base)");
+    for (int c = 0; c < pf->fx.n; ++c)
+        printf("%-4s %14.6g %14.6g %6d %16.2f\n", pf->fx.codes[c], pf->fx.rate[c], pf->fx.conv[c],
+               pf->fx.npos[c], pf->fx.mv[c] * pf->fx.conv[c]);
+    printf("Base currency: %s\n", pf->fx.codes[pf->fx.base]);
+    printf("Enter 'CCY RATE' to set a rate, 'BASE CCY' to change base, or Enter to return: ");
+    if (!get_line(line, sizeof(line)) || strlen(line) == 0) return;
+    if (sscanf(line, "%15s %31s", a, b) != 2) { printf("Invalid input.\n"); return; }
+    pf_symbol_upper(a);
+
+    if (strcmp(a, "BASE") == 0) {
+        if (pf_set_base(pf, b) != PF_OK) { printf("Invalid currency %s.\n", b); return; }
+        printf("Reporting in %s.\n", pf->fx.codes[pf->fx.base]);
+        pf_save_fx(pf, FX_FILE);
+        return;
+    }
+
+    double rate;
+    if (!parse_double(b, &rate) || rate <= 0.0) { printf("Rate must be > 0.\n"); return; }
+    int c = pf_ccy_id(pf, a);
+    if (c < 0) { printf("Invalid currency %s (or table full).\n", a); return; }
+    /* a rate change leaves the per-currency buckets valid: only c moves */
+    double before = pf->fx.mv[c] * pf->fx.conv[c];
+    pf_set_rate(pf, a, rate);
+    if (c == pf->fx.base) {
+        printf("Base rate changed; values in %s are unchanged.\n", pf->fx.codes[c]);
+    } else {
+        printf("Revalued %d %s positions: %+.2f %s\n", pf->fx.npos[c], pf->fx.codes[c],
+               pf->fx.mv[c] * pf->fx.conv[c] - before, pf->fx.codes[pf->fx.base]);
+    }
+    pf_status st = pf_save_fx(pf, FX_FILE);
+    if (st != PF_OK) printf("Failed to save FX rates: %s.\n", pf_strerror(st));
+}
+
+/* ---------- Live prices: shared-memory feed ---------- */
+
+#define FEED_NAME "portfolio-feed"
+
+/* Apply prices a feed handler (portfolio-feed) publishes: what is
+ * pending, or everything arriving for a number of seconds. */
+void live_prices(Portfolio *pf) {
+    char line[LINE_BUF], name[64];
+    int secs;
+
+    printf("Feed name (Enter for %s): ", FEED_NAME);
+    if (!get_line(line, sizeof(line))) return;
+    snprintf(name, sizeof(name), "%s", line[0] ? line : FEED_NAME);
+    if (!prompt_int("Seconds to follow (Enter for 0 = apply pending only): ", 0, &secs) || secs < 0) {
+        printf("Invalid duration.\n"); return;
+    }
+
+    pf_feed *feed;
+    pf_status st = pf_feed_attach(name, &feed);
+    if (st != PF_OK) {
+        printf("No feed %s (%s). Start one with portfolio-feed.\n", name, pf_strerror(st));
+        return;
+    }
+    long ticks = 0, applied = 0;
+    pf_feed_batch b;
+    double t0 = now_sec(), next = t0 + 1.0, end = t0 + secs;
+    for (;;) {
+        int got = pf_feed_poll(feed, pf, 0, &b);
+        ticks += b.ticks;
+        applied += b.applied;
+        double t = now_sec();
+        if (t >= end && (secs > 0 || got == 0)) break;
+        if (t >= next) {
+            printf("  %6.0f s  %ld ticks, %ld applied\n", t - t0, ticks, applied);
+            next += 1.0;
+        }
+        if (got == 0) {
+            struct timespec idle = {0, 1000000};
+            nanosleep(&idle, NULL);
+        }
+    }
+    pf_feed_close(feed);
+    printf("Applied %ld of %ld ticks from %s.\n", applied, ticks, name);
+}
+
+/* ---------- Latency stats ---------- */
+
+/* Per-operation latency recorded by the library since start-up (or the
+ * last reset): p50/p90/p99/p99.9/max of buy, sell, update, metrics, view,
+ * save and load, over the one call in PF_LATENCY_EVERY that is timed. */
+void latency_report(Portfolio *pf) {
+    char line[LINE_BUF];
+    if (!pf->lat) {
+        printf("Latency tracking is off (PF_LATENCY_EVERY=0, or built with PF_NO_LATENCY).\n");
+        return;
+    }
+    printf("\n");
+    pf_latency_write(pf, stdout);
+    printf("Reset counters? (y/N): ");
+    if (get_line(line, sizeof(line)) && (line[0] == 'y' || line[0] == 'Y')) {
+        pf_latency_reset(pf);
+        printf("Counters reset.\n");
+    }
+}
+
+/* Hardware counters (cycles, instructions, cache and branch misses) per
+ * operation. Off by default since each counted call costs two system
+ * calls; the first visit (or PF_COUNTERS=1) turns them on. */
+void counters_report(Portfolio *pf) {
+    char line[LINE_BUF];
+    if (!pf->counters) {
+        pf_status st = pf_counters_enable(pf);
+        if (st != PF_OK) {
+            printf("Hardware counters unavailable (%s).\n", pf_strerror(st));
+            return;
+        }
+        printf("Counting from now; choose this option again for the results.\n");
+        return;
+    }
+    printf("\n");
+    pf_counters_write(pf, stdout);
+    printf("Reset (r), turn off (o) or keep counting (Enter): ");
+    if (!get_line(line, sizeof(line))) return;
+    if (line[0] == 'r' || line[0] == 'R') {
+        pf_counters_reset(pf);
+        printf("Counters reset.\n");
+    } else if (line[0] == 'o' || line[0] == 'O') {
+        pf_counters_disable(pf);
+        printf("Counters off.\n");
+    }
+}
+
+/* Bytes held by each structure, per position, and the process RSS */
+void memory_report(const Portfolio *pf) {
+    printf("\n");
+    pf_mem_write(pf, stdout);
+}
+
+/* ---------- Person D: UI improvements ---------- */
+
+void ui_help() {
+    puts("\n=== Portfolio Simulator — Help & Tips ===");
+    puts("- Buy: provide symbol (letters/numbers), quantity (integer), buy price (float).");
+    puts("- Sell: provide symbol, quantity to sell, and sell price.");
+    puts("- Update Prices: enter a symbol to update one, a pattern to update the matches,");
+    puts("  or type ALL to update every holding.");
+    puts("- Save/Load: portfolio is saved to 'portfolio.txt' in the program directory.");
+    puts("- Symbols are case-insensitive and stored uppercase (e.g. AAPL).");
+    puts("- When updating prices, press Enter on an empty line to skip a holding.");
+    puts("- VaR: reads daily closes from 'history.txt' (header 'DATE SYM1 SYM2 ...',");
+    puts("  then one row per day) and revalues today's holdings under each day's returns.");
+    puts("- Covariance: built from 'history.txt' for your holdings; every 'update ALL'");
+    puts("  afterwards adds one more observation without rebuilding.");
+    puts("- Optimize: uses the covariance above and mean historical returns; returns and");
+    puts("  volatilities are annualized over 252 trading days.");
+    puts("- Rebalance: 'targets.txt' lines are 'SYMBOL WEIGHT [LOT [PRICE]]' with WEIGHT a");
+    puts("  fraction of market value; trades smaller than the drift band are skipped.");
+    puts("- Backtest: each parameter takes 'from to step'; every combination runs on its");
+    puts("  own simulated book in parallel and the best are ranked by Sharpe ratio.");
+    puts("- Stress test: 'scenarios.txt' lines look like 'crash TECH=-20 ENERGY=+5 ALL=-2';");
+    puts("  groups come from 'groups.txt' ('SYMBOL GROUP'), symbols override groups.");
+    puts("- Currencies: add a code after the buy price (e.g. '12.50 EUR') for a new holding;");
+    puts("  rates and the reporting currency live in 'fx.txt'.");
+    puts("- Live prices: run 'portfolio-feed portfolio-feed FILE' (or '--walk portfolio.txt')");
+    puts("  and its prices are applied here without typing them in.");
+    puts("- Latency stats: time spent inside each buy, sell, price update, metrics,");
+    puts("  view, save, load and lookup since start-up; build with -DPF_NO_LATENCY to remove it.");
+    puts("- Hardware counters: cycles, instructions, cache and branch misses per operation");
+    puts("  (Linux perf events; start with PF_COUNTERS=1 to count from start-up).");
+    puts("- Memory: live and peak bytes of holdings, indexes, history and the other");
+    puts("  structures, bytes per position, and resident memory now and at its peak.");
+    puts("- Sorted view: holdings by symbol, market value, P/L or P/L%, a page at a time;");
+    puts("  kept up to date on every trade and price once first used.");
+    puts("- Search: '*' matches any run of characters and '?' any one (BRK*, *.L, A?C*);");
+    puts("  Update Prices takes the same patterns to update only the matching holdings.");
+    puts("- Background save: a forked copy of the process writes portfolio.txt while you");
+    puts("  keep trading; Save status shows its progress and how long it took.");
+    puts("- Save changes: the first writes portfolio.txt as a base, later ones only the");
+    puts("  changed holdings to portfolio.txt.d1, .d2, ...; Load replays them, and every");
+    puts("  8 deltas are merged into a new base in the background. Exit saves this way too.");
+    puts("- Invalid numeric input will be rejected; re-run the operation to retry.");
+    puts("- Program auto-saves on exit.\n");
+}
+
+#define MENU_MAX 24
+
+/* trace span names, by menu choice */
+static const char *const command_names[MENU_MAX + 1] = {
+    "exit", "view", "buy", "sell", "update prices", "metrics", "save", "load", "help", "var",
+    "covariance", "optimize", "rebalance", "backtest", "stress test", "fx rates", "live prices",
+    "latency stats", "hardware counters", "memory", "sorted view", "search",
+    "background save", "save status", "save changes"
+};
+
+/* menu with help option; end of input counts as Exit */
+int menu() {
+    char line[LINE_BUF];
+    puts("\n========== Portfolio Simulator ==========");
+    puts("1) View holdings        - Show current holdings");
+    puts("2) Buy shares           - Add or increase holding");
+    puts("3) Sell shares          - Sell partial or all shares");
+    puts("4) Update Prices        - Update market prices (symbol or ALL)");
+    puts("5) Portfolio Metrics    - Cost, market value, unrealized P/L");
+    puts("6) Save portfolio       - Save to portfolio.txt");
+    puts("7) Load portfolio       - Load from portfolio.txt (overwrites current)");
+    puts("8) Help                 - Show usage tips and examples");
+    puts("9) Historical VaR       - VaR/ES from history.txt with bootstrap");
+    puts("10) Covariance matrix   - Return covariance/correlation of holdings");
+    puts("11) Optimize            - Min-variance, target return, efficient frontier");
+    puts("12) Rebalance           - Trade toward weights in targets.txt");
+    puts("13) Backtest            - Replay history.txt through a strategy sweep");
+    puts("14) Stress test         - P/L under each shock in scenarios.txt");
+    puts("15) FX rates            - Set exchange rates or reporting currency");
+    puts("16) Live prices         - Apply prices from a portfolio-feed process");
+    puts("17) Latency stats       - p50/p90/p99/p99.9/max per operation");
+    puts("18) Hardware counters   - Cycles, instructions, cache/branch misses per operation");
+    puts("19) Memory              - Bytes per structure and per position, peak RSS");
+    puts("20) Sorted view         - Holdings by value, P/L, P/L% or symbol (top/bottom N)");
+    puts("21) Search              - Holdings matching a symbol pattern (BRK*, *.L)");
+    puts("22) Background save     - Save to portfolio.txt without blocking the menu");
+    puts("23) Save status         - Progress and duration of the background save");
+    puts("24) Save changes        - Write only what changed since the last save");
+    puts("0) Exit                 - Save and quit");
+    printf("Enter choice (0-%d): ", MENU_MAX);
+    if (!get_line(line, sizeof(line))) return 0;
+    int c;
+    if (!parse_int(line, &c)) return -1;
+    if (c < 0 || c > MENU_MAX) return -1;
+    return c;
+}
+
+/* Session timings for --stats, so whole sessions can be benchmarked:
+ * start-up (FX + portfolio load), the command loop, and exit (auto-save). */
+typedef struct {
+    double t_main, t_ready, t_exit, t_done;
+    long commands;
+    long per_choice[MENU_MAX + 1];
+} SessionStats;
+
+static void write_session_stats(const char *fname, const SessionStats *st, int positions) {
+    FILE *f = fopen(fname, "w");
+    if (!f) { perror("Failed to write session stats"); return; }
+    double loop = st->t_exit - st->t_ready;
+    fprintf(f, "{\n");
+    fprintf(f, "  \"startup_sec\": %.9f,\n", st->t_ready - st->t_main);
+    fprintf(f, "  \"loop_sec\": %.9f,\n", loop);
+    fprintf(f, "  \"exit_sec\": %.9f,\n", st->t_done - st->t_exit);
+    fprintf(f, "  \"commands\": %ld,\n", st->commands);
+    fprintf(f, "  \"commands_per_sec\": %.3f,\n", loop > 0.0 ? st->commands / loop : 0.0);
+    fprintf(f, "  \"positions_at_exit\": %d,\n", positions);
+    fprintf(f, "  \"per_choice\": [");
+    for (int c = 0; c <= MENU_MAX; ++c) fprintf(f, "%s%ld", c ? ", " : "", st->per_choice[c]);
+    fprintf(f, "]\n}\n");
+    fclose(f);
+}
+
+/* --record: stdin becomes a stream over fd 0 that copies what it reads
+ * to the session's file, so every prompt's input is recorded without
+ * the readers knowing */
+static ssize_t record_read(void *cookie, char *buf, size_t n) {
+    Session *s = cookie;
+    ssize_t got;
+    while ((got = read(STDIN_FILENO, buf, n)) < 0 && errno == EINTR) { }
+    if (got > 0) fwrite(buf, 1, (size_t)got, s->record);
+    return got;
+}
+
+static int record_input(Session *s, const char *path) {
+    s->record = fopen(path, "w");
+    if (!s->record) return 0;
+    FILE *in = fopencookie(s, "r", (cookie_io_functions_t){ .read = record_read });
+    if (!in) return 0;
+    setvbuf(in, NULL, _IOLBF, BUFSIZ);  /* reading still flushes the prompts */
+    stdin = in;
+    return 1;
+}
+
+/* main loop */
+int main(int argc, char **argv) {
+    int choice;
+    SessionStats st = {0};
+    Session session = {0};
+    st.t_main = now_sec();
+    if (argc > 1 && strcmp(argv[1], "--bench-cov") == 0) return bench_cov(argc - 2, argv + 2);
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            if (!record_input(&session, argv[++i])) { perror("Failed to open record file"); return 1; }
+        } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            session.stats_file = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            if (pf_trace_start(argv[++i]) != PF_OK) { perror("Failed to open trace file"); return 1; }
+            pf_trace_thread_name("menu");
+        } else {
+            fprintf(stderr, "usage: %s [--record FILE] [--stats FILE] [--trace FILE] | --bench-cov [N...]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    Portfolio book;
+    pf_init(&book);
+    int every = getenv("PF_LATENCY_EVERY") ? atoi(getenv("PF_LATENCY_EVERY")) : LATENCY_EVERY;
+    if (every > 0) pf_latency_enable(&book, every);
+    if (getenv("PF_COUNTERS") && atoi(getenv("PF_COUNTERS")) > 0 && pf_counters_enable(&book) != PF_OK)
+        fprintf(stderr, "Hardware counters unavailable.\n");
+    book.compress = getenv("PF_COMPRESS") && atoi(getenv("PF_COMPRESS")) > 0;
+    /* Attempt to load FX rates and any saved portfolio at program start (non-fatal) */
+    pf_trace_begin("startup", "command");
+    pf_load_fx(&book, FX_FILE, NULL);
+    load_file_start(&book);
+    pf_trace_end("startup", "command");
+    st.t_ready = now_sec();
 
     while ((choice = menu()) != 0) {
+        st.commands++;
+        if (choice > 0) st.per_choice[choice]++;
+        const char *span = choice > 0 ? command_names[choice] : "invalid choice";
+        pf_trace_begin(span, "command");
+        load_file_finish(&book);
         switch (choice) {
-            case 1: view(); break;
-            case 2: buy(); break;
-            case 3: sell(); break;
-            case 4: update_prices(); break;
-            case 5: metrics(); break;
-            case 6: save_file(); break;
-            case 7: load_file(); break;
+            case 1: view(&book); break;
+            case 2: buy(&book); break;
+            case 3: sell(&book); break;
+            case 4: update_prices(&book); break;
+            case 5: metrics(&book); break;
+            case 6: save_file(&book); break;
+            case 7: load_file(&book); break;
             case 8: ui_help(); break;
+            case 9: var_report(&book); break;
+            case 10: covariance_report(&book); break;
+            case 11: optimize_report(&book); break;
+            case 12: rebalance(&book); break;
+            case 13: backtest(); break;
+            case 14: stress_test(&book); break;
+            case 15: fx_menu(&book); break;
+            case 16: live_prices(&book); break;
+            case 17: latency_report(&book); break;
+            case 18: counters_report(&book); break;
+            case 19: memory_report(&book); break;
+            case 20: sorted_view(&book); break;
+            case 21: search_view(&book); break;
+            case 22: bgsave_file(&book); break;
+            case 23: bgsave_status(&book); break;
+            case 24: save_changes(&book); break;
             default: printf("Invalid choice.\n"); break;
         }
+        pf_trace_end(span, "command");
+        bgsave_notice(&book, &session);
     }
+    st.t_exit = now_sec();
 
-    /* save on exit (best effort) */
-    save_file();
+    /* save on exit (best effort); a delta when the file is a chain */
+    pf_trace_begin("exit", "command");
+    load_file_finish(&book);
+    pf_delta_stats ds;
+    pf_delta_get(&book, &ds);
+    if (ds.chained) save_changes(&book);
+    else save_file(&book);
     printf("Goodbye!\n");
+    fflush(stdout);
+    pf_trace_end("exit", "command");
+    st.t_done = now_sec();
+    if (pf_trace_dropped() > 0) fprintf(stderr, "Trace dropped %ld events.\n", pf_trace_dropped());
+    pf_trace_stop();
+    if (session.stats_file) write_session_stats(session.stats_file, &st, book.count);
+    if (session.record) fclose(session.record);
+    pf_free(&book);
     return 0;
 }
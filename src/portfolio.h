@@ -0,0 +1,465 @@
+/* src/portfolio.h
+ * Portfolio engine: holdings, trades, prices, metrics, currencies and
+ * snapshots, usable from any C program (libportfolio.a / libportfolio.so).
+ *
+ * - No console I/O: every call reports through a pf_status code and
+ *   returns its results in caller-provided structs.
+ * - Symbols are matched as given; pf_symbol_upper() normalizes user input.
+ * - A Portfolio is self-contained, so separate books can be used from
+ *   separate threads. A single book is not locked.
+ */
+
+#ifndef PORTFOLIO_H
+#define PORTFOLIO_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PF_SYMBOL_LEN 16
+#define PF_MAX_CCY 64
+#define PF_CCY_LEN 4
+
+typedef enum {
+    PF_OK = 0,
+    PF_ERR_INVALID,     /* bad symbol, quantity, price or currency code */
+    PF_ERR_NOT_FOUND,   /* symbol not held */
+    PF_ERR_SHARES,      /* selling more shares than held */
+    PF_ERR_CURRENCY,    /* holding is in another currency, or FX table full */
+    PF_ERR_NOMEM,
+    PF_ERR_IO           /* file could not be opened or written */
+} pf_status;
+
+typedef struct {
+    char symbol[PF_SYMBOL_LEN];
+    int qty;
+    double buy_price;
+    double cur_price;
+    int ccy;            /* index into the FX table; prices are in this currency */
+} Stock;
+
+/* Dense rate table: rate[c] is the value of one unit of currency c in a
+ * common pivot, conv[c] converts c into the reporting (base) currency.
+ * Currency 0 is the implicit currency of older files. The per-currency
+ * sums are in local currency; holdings changes invalidate them, while an
+ * FX change only rescales, so revaluing costs O(currencies). */
+typedef struct {
+    char codes[PF_MAX_CCY][PF_CCY_LEN];
+    double rate[PF_MAX_CCY];
+    double conv[PF_MAX_CCY];
+    int n;
+    int base;
+    double cost[PF_MAX_CCY], mv[PF_MAX_CCY];
+    int npos[PF_MAX_CCY];
+    int agg_valid;
+} FxTable;
+
+/* Running covariance of daily returns for a fixed set of symbols.
+ * Owned by the book so it is freed with it; the analytics fill it in. */
+typedef struct {
+    int k;
+    long nobs;      /* observations folded in */
+    long streamed;  /* of which came from price updates */
+    char (*symbols)[PF_SYMBOL_LEN];
+    double *mean;   /* k */
+    double *m2;     /* k x k sums of (r_i - mean_i)(r_j - mean_j) */
+    double *last;   /* k prices at the last observation */
+    int *pos;       /* k position indices, NULL until resolved */
+    unsigned long pos_layout;   /* the book's layout they were resolved at */
+} CovState;
+
+/* One book: holdings plus the state derived from them. The fields may be
+ * read directly; change them through the calls below so the cached
+ * per-currency sums stay valid. */
+typedef struct {
+    Stock *items;
+    int count;
+    int capacity;
+    unsigned long layout;   /* bumped when positions are added, removed or moved */
+    FxTable fx;
+    CovState cov;
+    struct pf_latency *lat; /* per-operation timings, NULL when off */
+    struct pf_counters *counters;   /* hardware counters, NULL when off */
+    struct pf_views *views; /* sorted views, NULL until first used */
+    struct pf_bgsave *bgsave;       /* background save state, NULL until one runs */
+    struct pf_commit *commit;       /* group commit state, NULL until one is requested */
+    struct pf_delta *delta;         /* dirty rows and delta chain, NULL until one starts */
+    struct pf_bgload *bgload;       /* load still running, NULL once the rows are in */
+    int compress;           /* nonzero: saves write compressed blocks (see Compression) */
+} Portfolio;
+
+/* Totals in the base currency. */
+typedef struct {
+    double cost;
+    double market_value;
+    double unrealized;
+    double return_pct;
+    int positions;
+} pf_metrics;
+
+/* Position after a pf_buy() or pf_sell(). */
+typedef struct {
+    int index;          /* position index, -1 once sold out */
+    int qty;
+    double buy_price;   /* average cost */
+    double cur_price;
+    int created;        /* buy opened a new position */
+    int removed;        /* sell closed the position */
+} pf_position;
+
+const char *pf_strerror(pf_status st);
+
+/* ---------- Book ---------- */
+
+void pf_init(Portfolio *pf);        /* empty book reporting in USD */
+void pf_free(Portfolio *pf);
+void pf_cov_free(CovState *c);      /* drop the covariance, keep the book */
+pf_status pf_reserve(Portfolio *pf, int n);
+void pf_symbol_upper(char *s);
+int pf_find(Portfolio *pf, const char *sym);  /* index or -1 */
+
+/* ---------- Trades & prices ---------- */
+
+/* Buy qty shares at price. ccy (a 3-letter code, may be NULL) applies to
+ * a new position and must match an existing one. A buy that would take
+ * the position past INT_MAX shares is PF_ERR_INVALID. */
+pf_status pf_buy(Portfolio *pf, const char *sym, int qty, double price, const char *ccy,
+                 pf_position *out);
+pf_status pf_sell(Portfolio *pf, const char *sym, int qty, double price, pf_position *out);
+pf_status pf_update_price(Portfolio *pf, const char *sym, double price);
+pf_status pf_set_price(Portfolio *pf, int idx, double price);
+pf_status pf_get_metrics(Portfolio *pf, pf_metrics *out);
+
+/* Unchecked cores for batches (rebalancing): pf_add_shares() appends sym
+ * when idx < 0 and returns the index or -1; pf_remove_shares() returns 1
+ * when the position empties, leaving it for pf_compact() if keep_empty. */
+int pf_add_shares(Portfolio *pf, int idx, const char *sym, int q, double p, int ccy);
+int pf_remove_shares(Portfolio *pf, int idx, int q, double p, int keep_empty);
+void pf_compact(Portfolio *pf);
+void pf_holdings_changed(Portfolio *pf);    /* after editing items directly */
+void pf_row_changed(Portfolio *pf, int idx);  /* after editing one row's qty or prices */
+
+/* ---------- Currencies ---------- */
+
+int pf_ccy_id(Portfolio *pf, const char *code);    /* registers new codes at rate 1 */
+pf_status pf_set_rate(Portfolio *pf, const char *code, double rate);
+pf_status pf_set_base(Portfolio *pf, const char *code);
+void pf_fx_aggregate(Portfolio *pf);               /* fill fx.cost/mv/npos */
+
+/* ---------- Files ---------- */
+
+/* the menu's holdings table */
+pf_status pf_write_view(Portfolio *pf, FILE *out);
+/* "SYMBOL QTY BUY CUR [CCY]" per line. pf_load() replaces the holdings;
+ * loaded and skipped may be NULL. */
+pf_status pf_save(Portfolio *pf, const char *path);  /* PF_SYNC_FULL */
+pf_status pf_load(Portfolio *pf, const char *path, int *loaded, int *skipped);
+/* "CCY RATE" lines and "BASE CCY" */
+pf_status pf_save_fx(const Portfolio *pf, const char *path);
+
+/* Every save writes PATH.tmp and renames it over PATH, so a crash leaves
+ * the old file or the new one, never a truncated mix. The level says how
+ * much of that survives a power cut as well. */
+typedef enum {
+    PF_SYNC_NONE,       /* rename only: the kernel writes it back when it likes */
+    PF_SYNC_DATA,       /* fdatasync() PATH.tmp before the rename */
+    PF_SYNC_FULL        /* and fsync() the directory, so the rename is on disk */
+} pf_sync;
+
+pf_status pf_save_durable(Portfolio *pf, const char *path, pf_sync level);
+
+/* Group commit: many callers that each want a durable save get one
+ * PF_SYNC_FULL save between them. pf_commit_request() hands out a ticket;
+ * pf_commit_poll() saves once the oldest waiting request is window_us
+ * old (0: on the next poll) and sets *settled to the highest ticket a
+ * save has covered; it returns that save's status. *wait_us is how long
+ * until the next poll is due, -1 with nothing waiting. While a
+ * background save runs the requests stay waiting, so the poll never
+ * blocks on it; they are saved on the first poll after it is reaped. A
+ * request for a different path first saves for the waiting ones. */
+pf_status pf_commit_request(Portfolio *pf, const char *path, unsigned long *ticket);
+pf_status pf_commit_poll(Portfolio *pf, long window_us, unsigned long *settled, long *wait_us);
+pf_status pf_load_fx(Portfolio *pf, const char *path, int *loaded);
+
+/* ---------- Background saves ---------- */
+
+/* pf_save() from a forked child, like Redis BGSAVE: the child writes its
+ * copy-on-write image of the book to PATH.tmp and renames it over PATH
+ * while the caller carries on trading. The caller pauses only for fork()
+ * to copy the page tables; pages it writes afterwards are copied on
+ * demand. One background save per book at a time; pf_save() and
+ * pf_free() wait for a running one, so an older image never lands on
+ * top of a newer one. Call pf_bgsave_poll() now and then to reap the
+ * child. */
+typedef struct {
+    int running;
+    long rows_done, rows_total;
+    double elapsed_sec;     /* so far, or start to finish of the last save */
+    double write_sec;       /* the child's time writing the last save */
+    double fork_ms;         /* the caller's pause in fork() */
+    long saves;             /* finished */
+    pf_status last;         /* outcome of the last finished save */
+    char path[512];
+} pf_bgsave_stats;
+
+/* PF_ERR_INVALID while one runs, PF_ERR_NOMEM if fork() fails */
+pf_status pf_bgsave_start(Portfolio *pf, const char *path);
+pf_status pf_bgsave_poll(Portfolio *pf, pf_bgsave_stats *out);   /* out may be NULL */
+pf_status pf_bgsave_wait(const Portfolio *pf);  /* outcome of the last save */
+
+/* ---------- Background loads ---------- */
+
+/* pf_load() on a thread, so a program can show its prompt before the
+ * book is read: pf_load_start() only checks that PATH can be opened and
+ * starts the thread, which decodes into a private book. pf_load_wait()
+ * joins it and moves the rows (and any delta chain) into pf, mapping
+ * currencies onto pf's FX table; codes that no longer fit count as
+ * skipped. The load counts as one PF_OP_LOAD of pf's, timed from start
+ * to join, with the loader thread's hardware counts. Every call that
+ * reads or writes pf's rows (lookups, trades, prices, metrics, views,
+ * searches, saves, loads, pf_feed_poll(), pf_free()) joins the load
+ * first, so none sees the empty book in between; only the FX, timing
+ * and counter calls run alongside it. Call pf_load_wait() yourself for
+ * the counts and the load's status, which a join inside another call
+ * drops. */
+pf_status pf_load_start(Portfolio *pf, const char *path);
+pf_status pf_load_wait(Portfolio *pf, int *loaded, int *skipped);  /* PF_OK if none ran */
+
+/* ---------- Delta snapshots ---------- */
+
+/* Saves that write only what changed. The first pf_save_delta() to a
+ * path writes a whole base ("#PF base ID SEQ" on top, which older
+ * loaders skip); from then on buys, sells and price updates set a bit
+ * per row, and each pf_save_delta() writes just those rows and the
+ * symbols sold out to PATH.dN, one more link in the chain. pf_load()
+ * replays the chain onto the base. Once the chain is PF_DELTA_CHAIN
+ * long, a background save (see above) folds it into a new base, and the
+ * merged deltas are removed when it lands. pf_compact(), loads of a
+ * plain file, pf_holdings_changed(), and pf_save() or pf_bgsave_start()
+ * to the same path end the chain: the next delta save writes a base,
+ * after waiting for a background save still running. */
+#define PF_DELTA_CHAIN 8
+
+typedef struct {
+    int chained;            /* the next delta save appends to path */
+    char path[512];
+    int length;             /* deltas on top of the base */
+    int last;               /* N of the newest PATH.dN */
+    int dirty_rows;         /* changed since the last save */
+    int removed_rows;       /* sold out since the last save */
+    int merging;            /* a background merge is running */
+    long deltas, bases, merges;     /* written or finished since pf_init() */
+} pf_delta_stats;
+
+/* *rows (may be NULL): rows written, all of them for a base */
+pf_status pf_save_delta(Portfolio *pf, const char *path, int *rows);
+pf_status pf_delta_get(const Portfolio *pf, pf_delta_stats *out);
+
+/* ---------- Compression ---------- */
+
+/* With pf->compress set, pf_save(), background saves, delta saves and
+ * merges write "PFZ1" files: the rows in columns, transformed so they
+ * repeat (prices as XOR deltas split into byte planes, quantities as
+ * varint deltas, symbols front-coded, currencies as indexes into the
+ * file's code table) and LZ-compressed in blocks of 16384 rows.
+ * pf_load() reads either kind, whatever pf->compress says. */
+
+/* the LZ block coder underneath, usable on any bytes: compress returns
+ * the compressed size, 0 if dst (pf_lz_bound(n) is always enough) is too
+ * small; decompress the size, -1 if src is corrupt or dst too small */
+size_t pf_lz_bound(size_t n);
+size_t pf_lz_compress(const void *src, size_t n, void *dst, size_t cap);
+long pf_lz_decompress(const void *src, size_t n, void *dst, size_t cap);
+
+/* ---------- Sorted views ---------- */
+
+/* Holdings ordered by symbol or by a metric in the base currency, one
+ * treap with subtree sizes per ordering. Built on first use in
+ * O(n log n); from then on a buy, sell or price update moves its row in
+ * O(log n), and a page of k rows from any rank costs O(log n + k).
+ * Closing a position costs O(n), as it does for the holdings array.
+ * Loads, pf_compact(), FX changes and pf_holdings_changed() rebuild the
+ * views on their next use. Equal keys are ordered by symbol. */
+typedef enum {
+    PF_VIEW_SYMBOL,
+    PF_VIEW_VALUE,      /* market value */
+    PF_VIEW_PL,         /* unrealized P/L */
+    PF_VIEW_PL_PCT,     /* unrealized P/L % of cost */
+    PF_VIEW_COUNT
+} pf_view;
+
+pf_status pf_view_enable(Portfolio *pf);        /* build now instead of on first use */
+void pf_view_disable(Portfolio *pf);            /* free them and stop maintaining them */
+const char *pf_view_name(pf_view v);
+/* up to n position indices in view order from rank first, ascending or
+ * (desc) descending; *got is how many were filled in */
+pf_status pf_view_range(Portfolio *pf, pf_view v, int desc, int first, int n, int *idx, int *got);
+/* the same range as pf_write_view() rows */
+pf_status pf_write_view_sorted(Portfolio *pf, pf_view v, int desc, int first, int n, FILE *out);
+
+/* Positions whose symbol matches pattern (case-insensitive): '*' matches
+ * any run of characters and '?' any one. The literal text before the
+ * first wildcard ("BRK*") or after the last ("*.L") is a rank range in
+ * the symbol tree above or in a reversed-symbol tree; the smaller range
+ * is walked and filtered, so a search costs O(log n + candidates). Up to
+ * max indices go to idx in symbol order; *matched counts every match,
+ * and a NULL idx or max 0 only counts. */
+pf_status pf_search(Portfolio *pf, const char *pattern, int *idx, int max, int *matched);
+/* pf_write_view() rows for the matches */
+pf_status pf_write_view_matching(Portfolio *pf, const char *pattern, FILE *out);
+
+/* ---------- Latency ---------- */
+
+/* With timing enabled, the calls below are timed with the cycle counter
+ * and counted in a log-linear histogram per operation (32 sub-buckets per
+ * power of two, so values are within about 3%). A timed call costs two
+ * counter reads and one increment. Timing one call in `every` cuts that
+ * where the counter is slow to read (it traps in some VMs). With timing
+ * off the cost is one branch, and building with -DPF_NO_LATENCY removes
+ * even that. Counts are of timed calls. */
+typedef enum {
+    PF_OP_BUY,          /* pf_buy */
+    PF_OP_SELL,         /* pf_sell */
+    PF_OP_UPDATE,       /* pf_update_price, pf_set_price */
+    PF_OP_METRICS,      /* pf_get_metrics */
+    PF_OP_VIEW,         /* pf_write_view */
+    PF_OP_SAVE,         /* pf_save, pf_save_durable(PF_SYNC_FULL) */
+    PF_OP_SAVE_DATA,    /* pf_save_durable(PF_SYNC_DATA) */
+    PF_OP_SAVE_RENAME,  /* pf_save_durable(PF_SYNC_NONE) */
+    PF_OP_COMMIT,       /* pf_commit_request() until the save that covers it */
+    PF_OP_SAVE_DELTA,   /* pf_save_delta */
+    PF_OP_LOAD,         /* pf_load */
+    PF_OP_FIND,         /* pf_find */
+    PF_OP_COUNT
+} pf_op;
+
+typedef struct {
+    unsigned long long count;
+    double mean_ns;
+    double p50_ns, p90_ns, p99_ns, p999_ns;
+    double max_ns;
+} pf_latency_stats;
+
+/* every >= 1; PF_ERR_INVALID when built with PF_NO_LATENCY. The first
+ * enable measures the counter's rate, spinning for about 2 ms; reports
+ * reuse it. */
+pf_status pf_latency_enable(Portfolio *pf, int every);
+void pf_latency_disable(Portfolio *pf);
+void pf_latency_reset(Portfolio *pf);
+const char *pf_op_name(pf_op op);
+/* PF_ERR_INVALID when timing is off */
+pf_status pf_latency_get(const Portfolio *pf, pf_op op, pf_latency_stats *out);
+/* table of count, mean and percentiles per operation */
+pf_status pf_latency_write(const Portfolio *pf, FILE *out);
+
+/* ---------- Hardware counters ---------- */
+
+/* Optional perf_event_open() counters around the same operations, for
+ * the user-space work of the thread that enabled them. Each counted call
+ * costs two read() system calls, so leave them off when timing latency.
+ * Events the CPU or VM does not expose are reported as unavailable. */
+typedef enum {
+    PF_CNT_CYCLES,
+    PF_CNT_INSTRUCTIONS,
+    PF_CNT_CACHE_MISSES,    /* last-level cache */
+    PF_CNT_BRANCH_MISSES,
+    PF_CNT_TASK_CLOCK,      /* ns on the CPU incl. the counter reads; needs no PMU */
+    PF_CNT_COUNT
+} pf_counter;
+
+typedef struct {
+    unsigned long long calls;
+    unsigned long long total[PF_CNT_COUNT];
+    int available[PF_CNT_COUNT];
+} pf_counter_stats;
+
+/* PF_ERR_IO when no event can be opened (see perf_event_paranoid),
+ * PF_ERR_INVALID off Linux or when built with PF_NO_COUNTERS */
+pf_status pf_counters_enable(Portfolio *pf);
+void pf_counters_disable(Portfolio *pf);
+void pf_counters_reset(Portfolio *pf);
+const char *pf_counter_name(pf_counter e);
+pf_status pf_counters_get(const Portfolio *pf, pf_op op, pf_counter_stats *out);
+/* per-call averages and IPC per operation */
+pf_status pf_counters_write(const Portfolio *pf, FILE *out);
+
+/* ---------- Memory ---------- */
+
+/* Tracking allocator used for everything the library and its programs
+ * keep. Each block has a 16-byte header with its size and category, so
+ * live and peak bytes per category cost one atomic add to keep. Blocks
+ * must be freed with pf_mem_free(). */
+typedef enum {
+    PF_MEM_HOLDINGS,        /* Portfolio.items */
+    PF_MEM_INDEX,           /* feed symbol index, sorted views */
+    PF_MEM_HISTORY,         /* price history for VaR, backtests, covariance */
+    PF_MEM_COVARIANCE,      /* CovState */
+    PF_MEM_ANALYTICS,       /* scratch of VaR, optimizer, rebalance, backtest, stress */
+    PF_MEM_INSTRUMENTATION, /* latency histograms, counters, trace rings */
+    PF_MEM_BUFFERS,         /* I/O and connection buffers */
+    PF_MEM_COUNT
+} pf_mem_category;
+
+typedef struct {
+    long long live;         /* bytes */
+    long long peak;
+    long long blocks;
+    long long allocs;       /* allocations and growths so far */
+} pf_mem_stats;
+
+void *pf_mem_alloc(pf_mem_category cat, size_t n);
+void *pf_mem_calloc(pf_mem_category cat, size_t count, size_t size);
+void *pf_mem_realloc(pf_mem_category cat, void *p, size_t n);
+void pf_mem_free(void *p);
+const char *pf_mem_name(pf_mem_category cat);
+pf_status pf_mem_get(pf_mem_category cat, pf_mem_stats *out);
+long pf_mem_rss_kb(void);       /* resident set now, -1 if unknown */
+long pf_mem_peak_rss_kb(void);
+/* table per category, bytes per position of pf (may be NULL), RSS */
+pf_status pf_mem_write(const Portfolio *pf, FILE *out);
+
+/* ---------- Tracing ---------- */
+
+/* Chrome trace JSON (load in chrome://tracing or ui.perfetto.dev) of
+ * begin/end spans from every thread, one trace per process. The library
+ * spans each operation above as lookup, update, compute, render or io.
+ * Callers add their own spans. name and cat are stored by pointer, so
+ * they must be string literals or otherwise outlive the trace. When no
+ * trace is running, a span costs one load and one branch. */
+pf_status pf_trace_start(const char *path);     /* PF_ERR_IO if path cannot be created */
+pf_status pf_trace_stop(void);                  /* flush and close the file */
+void pf_trace_begin(const char *name, const char *cat);
+void pf_trace_end(const char *name, const char *cat);
+void pf_trace_thread_name(const char *name);
+long pf_trace_dropped(void);    /* events lost to full rings */
+
+/* ---------- Live price feed ---------- */
+
+/* A single-producer/single-consumer ring of ticks in POSIX shared memory.
+ * A feed handler process creates and publishes; the book's process
+ * attaches and polls. Neither side makes a system call per tick. */
+typedef struct pf_feed pf_feed;
+
+typedef struct {
+    int ticks;              /* consumed from the ring */
+    int applied;            /* of which matched a holding */
+    double lag_max_ns;      /* publish-to-apply delay of the oldest tick */
+    double lag_sum_ns;
+} pf_feed_batch;
+
+/* slots is rounded up to a power of two */
+pf_status pf_feed_create(const char *name, int slots, pf_feed **out);
+pf_status pf_feed_attach(const char *name, pf_feed **out);
+int pf_feed_publish(pf_feed *f, const char *sym, double price);    /* 0 if full */
+/* apply up to max pending ticks to pf; returns the number consumed */
+int pf_feed_poll(pf_feed *f, Portfolio *pf, int max, pf_feed_batch *out);
+long pf_feed_pending(const pf_feed *f);
+void pf_feed_close(pf_feed *f);     /* the creator also removes the ring */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
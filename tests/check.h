@@ -0,0 +1,52 @@
+/* tests/check.h
+ * What every check shares: CHECK() reports a failed condition and counts
+ * it, check_done() is main()'s result, and first_difference() compares
+ * two books row by row. Define CHECK_NAME before including it.
+ */
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "portfolio.h"
+
+static int failures;
+
+#define CHECK(cond, ...)                                  \
+    do {                                                  \
+        if (!(cond)) {                                    \
+            fprintf(stderr, CHECK_NAME ": " __VA_ARGS__); \
+            fputc('\n', stderr);                          \
+            ++failures;                                   \
+        }                                                 \
+    } while (0)
+
+static inline int check_done(void) {
+    if (failures) return 1;
+    printf(CHECK_NAME ": ok\n");
+    return 0;
+}
+
+/* prices within a relative tol: text files keep 10 significant digits,
+ * so 1e-9 for those and 0 where the bits must survive */
+static inline int near(double a, double b, double tol) {
+    return a == b || fabs(a - b) <= tol * fabs(a);
+}
+
+/* -1 when b holds a's rows in a's order (currencies by code, as the FX
+ * tables may number them differently); else the first row that differs,
+ * or the shorter count */
+static inline int first_difference(const Portfolio *a, const Portfolio *b, double tol) {
+    for (int i = 0; i < a->count && i < b->count; ++i) {
+        const Stock *x = &a->items[i], *y = &b->items[i];
+        if (strcmp(x->symbol, y->symbol) || x->qty != y->qty || !near(x->buy_price, y->buy_price, tol) ||
+            !near(x->cur_price, y->cur_price, tol) || strcmp(a->fx.codes[x->ccy], b->fx.codes[y->ccy]))
+            return i;
+    }
+    return a->count == b->count ? -1 : (a->count < b->count ? a->count : b->count);
+}
+
+#endif
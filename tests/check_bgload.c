@@ -0,0 +1,107 @@
+/* tests/check_bgload.c
+ * pf_load_start()/pf_load_wait() against pf_load() on the same delta
+ * chain, into a book whose FX table numbers the currencies differently;
+ * calls on the rows joining a load still running; the load timed for
+ * the caller.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK_NAME "check_bgload"
+#include "check.h"
+
+/* the loads decode the same file, so every bit should match */
+static void same_rows(const Portfolio *a, const Portfolio *b, const char *what) {
+    int r = first_difference(a, b, 0);
+    CHECK(r < 0, "%s: row %d differs (%d rows, want %d)", what, r, b->count, a->count);
+}
+
+static void chain(const char *dir, int compress) {
+    static const char *const ccy[] = { "EUR", "GBP", "JPY", "USD" };
+    char path[512], other[512];
+    snprintf(path, sizeof(path), "%s/check_bgload.txt", dir);
+    snprintf(other, sizeof(other), "%s/check_bgload.other", dir);
+    Portfolio a;
+    pf_init(&a);
+    a.compress = compress;
+    for (int i = 0; i < 20000; ++i) {
+        char sym[PF_SYMBOL_LEN];
+        snprintf(sym, sizeof(sym), "S%d", i);
+        pf_add_shares(&a, -1, sym, 1 + i % 7, 10 + i % 13, pf_ccy_id(&a, ccy[i % 4]));
+    }
+    CHECK(pf_save_delta(&a, path, NULL) == PF_OK, "base");
+    for (int i = 0; i < 300; ++i) pf_set_price(&a, i * 7, 99);
+    pf_sell(&a, "S5", 6, 1, NULL);
+    pf_buy(&a, "NEW", 3, 2, "CHF", NULL);
+    CHECK(pf_save_delta(&a, path, NULL) == PF_OK, "delta");
+
+    Portfolio b, c;
+    pf_init(&b);
+    pf_init(&c);
+    int timed = pf_latency_enable(&c, 1) == PF_OK;    /* not with make LATENCY=0 */
+    pf_ccy_id(&c, "JPY");       /* other ids than the file's */
+    pf_ccy_id(&c, "SEK");
+    int loaded = 0, skipped = -1;
+    CHECK(pf_load(&b, path, NULL, NULL) == PF_OK, "pf_load");
+    CHECK(pf_load_start(&c, path) == PF_OK, "pf_load_start");
+    CHECK(pf_load_wait(&c, &loaded, &skipped) == PF_OK, "pf_load_wait");
+    CHECK(loaded == a.count && skipped == 0, "loaded %d skipped %d", loaded, skipped);
+    same_rows(&a, &b, "pf_load");
+    same_rows(&a, &c, "pf_load_start");
+    pf_latency_stats ls;
+    CHECK(!timed || (pf_latency_get(&c, PF_OP_LOAD, &ls) == PF_OK && ls.count == 1), "load not timed");
+
+    pf_delta_stats ds;
+    pf_delta_get(&c, &ds);
+    CHECK(ds.chained && ds.length == 1, "chain after the load: chained %d length %d", ds.chained, ds.length);
+    int rows = 0;
+    pf_set_price(&c, 3, 1234);
+    CHECK(pf_save_delta(&c, path, &rows) == PF_OK && rows == 1, "delta after the load: %d rows", rows);
+    pf_free(&b);
+    pf_init(&b);
+    pf_load(&b, path, NULL, NULL);
+    same_rows(&c, &b, "reload");
+
+    /* each of these sees the whole book, not the empty one before the join */
+    Portfolio d;
+    pf_init(&d);
+    pf_metrics m;
+    int matched = 0;
+    CHECK(pf_load_start(&d, path) == PF_OK && pf_find(&d, "S7") == 6 && !d.bgload, "pf_find while loading");
+    CHECK(pf_load_start(&d, path) == PF_OK && pf_get_metrics(&d, &m) == PF_OK && m.positions == c.count,
+          "pf_get_metrics while loading");
+    CHECK(pf_load_start(&d, path) == PF_OK && pf_search(&d, "S1999?", NULL, 0, &matched) == PF_OK &&
+          matched == 10, "pf_search while loading: %d", matched);
+    CHECK(pf_load_start(&d, path) == PF_OK && pf_set_price(&d, 0, 5) == PF_OK, "pf_set_price while loading");
+    CHECK(pf_load_start(&d, path) == PF_OK && pf_save(&d, other) == PF_OK, "pf_save while loading");
+    pf_free(&b);
+    pf_init(&b);
+    pf_load(&b, other, NULL, NULL);
+    same_rows(&c, &b, "saved while loading");
+    remove(other);
+    pf_free(&d);
+
+    pf_free(&b);
+    pf_init(&b);
+    CHECK(pf_load_start(&b, other) == PF_ERR_IO, "missing file");
+    CHECK(pf_load_start(&b, path) == PF_OK, "second start");
+    pf_free(&b);    /* joins the loader */
+
+    pf_delta_get(&c, &ds);
+    for (int k = 1; k <= ds.last; ++k) {
+        snprintf(other, sizeof(other), "%s.d%d", path, k);
+        remove(other);
+    }
+    remove(path);
+    pf_free(&a);
+    pf_free(&c);
+}
+
+int main(int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : ".";
+    chain(dir, 0);
+    chain(dir, 1);
+    return check_done();
+}
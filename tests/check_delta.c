@@ -0,0 +1,132 @@
+/* tests/check_delta.c
+ * Delta chains against the book that wrote them: random buys, sells and
+ * price changes with a delta save after each round, reloaded and compared
+ * at every step, through merges, plain and compressed. Also checks that a
+ * new base sweeps delta files it will never replay, and that one which
+ * fails to land keeps the chain's dirty rows.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHECK_NAME "check_delta"
+#include "check.h"
+
+static void touch(const char *name) {
+    FILE *f = fopen(name, "w");
+    if (f) fclose(f);
+}
+
+static void remove_chain(const char *path) {
+    char name[600];
+    for (int k = 1; k <= 64; ++k) {
+        snprintf(name, sizeof(name), "%s.d%d", path, k);
+        remove(name);
+    }
+    remove(path);
+}
+
+static void random_chain(const char *dir, int compress) {
+    static const char *const ccy[] = { "USD", "EUR", "GBP" };
+    char path[512];
+    snprintf(path, sizeof(path), "%s/check_delta.txt", dir);
+    remove_chain(path);
+    Portfolio pf;
+    pf_init(&pf);
+    pf.compress = compress;
+    srand(48 + compress);
+    for (int round = 0; round < 30; ++round) {
+        for (int op = 0; op < 200; ++op) {
+            char sym[PF_SYMBOL_LEN];
+            snprintf(sym, sizeof(sym), "S%d", rand() % 1500);
+            int r = rand() % 10, idx = pf_find(&pf, sym);
+            if (r < 5) {
+                pf_buy(&pf, sym, 1 + rand() % 50, 1 + rand() % 500 / 7.0,
+                       idx < 0 ? ccy[rand() % 3] : pf.fx.codes[pf.items[idx].ccy], NULL);
+            } else if (r < 8 && idx >= 0) {
+                int q = pf.items[idx].qty;
+                pf_sell(&pf, sym, rand() % 3 == 0 ? q : 1 + rand() % q, 1.0, NULL);
+            } else if (idx >= 0) {
+                pf_set_price(&pf, idx, 1 + rand() % 900 / 3.0);
+            }
+        }
+        if (round == 12) pf_compact(&pf);
+        CHECK(pf_save_delta(&pf, path, NULL) == PF_OK, "delta save, round %d", round);
+        pf_bgsave_wait(&pf);
+        pf_bgsave_poll(&pf, NULL);
+
+        Portfolio back;
+        pf_init(&back);
+        int loaded = 0;
+        CHECK(pf_load(&back, path, &loaded, NULL) == PF_OK, "load, round %d", round);
+        int r = first_difference(&pf, &back, 1e-9);    /* replay keeps the row order */
+        CHECK(r < 0, "round %d (%s): reload differs at row %d (%d rows, book %d)", round,
+              compress ? "compressed" : "plain", r, back.count, pf.count);
+        pf_free(&back);
+    }
+    pf_delta_stats ds;
+    pf_delta_get(&pf, &ds);
+    CHECK(ds.merges > 0, "30 deltas and no merge");
+    pf_free(&pf);
+    remove_chain(path);
+}
+
+/* a new base leaves no PATH.dN behind, and only those go */
+static void sweep(const char *dir) {
+    char path[512], name[600];
+    snprintf(path, sizeof(path), "%s/check_sweep.txt", dir);
+    static const char *const stale[] = { ".d1", ".d7", ".d12" };
+    static const char *const kept[] = { ".dx", ".d3.tmp", "x.d2" };
+    for (int k = 0; k < 3; ++k) {
+        snprintf(name, sizeof(name), "%s%s", path, stale[k]);
+        touch(name);
+        snprintf(name, sizeof(name), "%s%s", path, kept[k]);
+        touch(name);
+    }
+    Portfolio pf;
+    pf_init(&pf);
+    pf_buy(&pf, "AAA", 1, 1.0, NULL, NULL);
+    CHECK(pf_save_delta(&pf, path, NULL) == PF_OK, "base");
+    for (int k = 0; k < 3; ++k) {
+        snprintf(name, sizeof(name), "%s%s", path, stale[k]);
+        CHECK(access(name, F_OK) != 0, "%s left behind", name);
+        snprintf(name, sizeof(name), "%s%s", path, kept[k]);
+        CHECK(access(name, F_OK) == 0, "%s removed", name);
+        remove(name);
+    }
+    pf_free(&pf);
+    remove(path);
+}
+
+/* a base that fails to land elsewhere leaves the chain's dirty rows */
+static void failed_base(const char *dir) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/check_failed.txt", dir);
+    remove_chain(path);
+    Portfolio pf, back;
+    pf_init(&pf);
+    pf_init(&back);
+    pf_buy(&pf, "AAA", 1, 1.0, NULL, NULL);
+    CHECK(pf_save_delta(&pf, path, NULL) == PF_OK, "base");
+    pf_update_price(&pf, "AAA", 5.0);
+    CHECK(pf_save_delta(&pf, "/nonexistent/check_failed.txt", NULL) != PF_OK, "save to a missing directory");
+    int rows = 0;
+    CHECK(pf_save_delta(&pf, path, &rows) == PF_OK && rows == 1, "delta after the failure: %d rows", rows);
+    pf_load(&back, path, NULL, NULL);
+    CHECK(first_difference(&pf, &back, 1e-9) < 0, "reload after the failure: cur %.2f, want 5.00",
+          back.count ? back.items[0].cur_price : 0.0);
+    pf_free(&pf);
+    pf_free(&back);
+    remove_chain(path);
+}
+
+int main(int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : ".";
+    random_chain(dir, 0);
+    random_chain(dir, 1);
+    sweep(dir);
+    failed_base(dir);
+    return check_done();
+}
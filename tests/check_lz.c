@@ -0,0 +1,84 @@
+/* tests/check_lz.c
+ * The LZ coder on random, repetitive and corrupted inputs; a book saved
+ * compressed and loaded back; and a compressed writer whose writes fail
+ * (/dev/full) past the first block.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK_NAME "check_lz"
+#include "check.h"
+#include "pf_internal.h"    /* the compressed writer */
+
+static void lz_round_trips(void) {
+    enum { MAX = 1 << 16 };
+    unsigned char *src = malloc(MAX), *dst = malloc(pf_lz_bound(MAX)), *back = malloc(MAX);
+    for (int iter = 0; iter < 400; ++iter) {
+        size_t n = (size_t)rand() % MAX;
+        int alphabet = 1 + rand() % 255;
+        for (size_t i = 0; i < n; ++i) {    /* runs and back references, some noise */
+            if (i > 8 && rand() % 4 == 0) src[i] = src[i - 1 - (size_t)rand() % 8];
+            else src[i] = (unsigned char)(rand() % alphabet);
+        }
+        size_t c = pf_lz_compress(src, n, dst, pf_lz_bound(n));
+        CHECK(c > 0 || n == 0, "compress of %zu bytes failed", n);
+        long d = pf_lz_decompress(dst, c, back, MAX);
+        CHECK(d == (long)n && memcmp(src, back, n) == 0, "round trip of %zu bytes: got %ld", n, d);
+        if (c > 0) {    /* corrupt input must fail or decode within bounds, never overrun */
+            dst[(size_t)rand() % c] ^= (unsigned char)(1 + rand() % 255);
+            d = pf_lz_decompress(dst, c, back, n);
+            CHECK(d <= (long)n, "corrupt input decoded to %ld bytes into %zu", d, n);
+            CHECK(pf_lz_decompress(dst, c / 2, back, MAX) <= MAX, "truncated input");
+        }
+    }
+    free(src);
+    free(dst);
+    free(back);
+}
+
+static void book_round_trip(const char *dir) {
+    static const char *const ccy[] = { "USD", "EUR", "GBP", "JPY" };
+    char path[512];
+    snprintf(path, sizeof(path), "%s/check_lz.txt", dir);
+    Portfolio a, b;
+    pf_init(&a);
+    pf_init(&b);
+    for (int i = 0; i < 40000; ++i) {     /* more than two blocks */
+        char sym[PF_SYMBOL_LEN];
+        snprintf(sym, sizeof(sym), "S%05d.%c", (i * 7919) % 40000, 'A' + i % 26);
+        pf_add_shares(&a, -1, sym, 1 + rand() % 100000, rand() / 97.0, pf_ccy_id(&a, ccy[i % 4]));
+        a.items[a.count - 1].cur_price = i % 3 ? rand() / 13.0 : a.items[a.count - 1].buy_price;
+    }
+    a.compress = 1;
+    CHECK(pf_save(&a, path) == PF_OK, "save %s", path);
+    int loaded = 0;
+    CHECK(pf_load(&b, path, &loaded, NULL) == PF_OK && loaded == a.count, "load: %d rows", loaded);
+    int r = first_difference(&a, &b, 0);
+    CHECK(r < 0, "row %d differs after the round trip", r);
+    remove(path);
+    pf_free(&a);
+    pf_free(&b);
+}
+
+/* rows after a failed block write used to run past the block buffer */
+static void failed_writes(void) {
+    FILE *f = fopen("/dev/full", "w");
+    if (!f) return;
+    setvbuf(f, NULL, _IONBF, 0);
+    const char codes[1][PF_CCY_LEN] = { "USD" };
+    struct pf_zwriter *z = pf_zwriter_open(f, NULL, codes, 1);
+    Stock s = { "X", 1, 1.0, 1.0, 0 };
+    for (int i = 0; z && i < 100000; ++i) pf_zwriter_row(z, &s, 0);
+    CHECK(z && pf_zwriter_close(z) != 0, "writes to /dev/full did not fail");
+    fclose(f);
+}
+
+int main(int argc, char **argv) {
+    srand(49);
+    lz_round_trips();
+    book_round_trip(argc > 1 ? argv[1] : ".");
+    failed_writes();
+    return check_done();
+}
@@ -0,0 +1,71 @@
+/* tests/check_search.c
+ * pf_search() against a brute-force scan: patterns whose prefix range is
+ * the smaller one and patterns whose suffix range is, each with an index
+ * buffer and count-only (NULL idx, max 0).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK_NAME "check_search"
+#include "check.h"
+
+static int glob(const char *p, const char *s) {
+    if (*p == '\0') return *s == '\0';
+    if (*p == '*') return glob(p + 1, s) || (*s && glob(p, s + 1));
+    return *s && (*p == '?' || *p == *s) && glob(p + 1, s + 1);
+}
+
+static int by_symbol(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+int main(void) {
+    static const char *const fixed[] = { "BRK.A", "BRK.B", "BRKX", "BRK.L", "VOD.L", "BP.L", "AAPL", "ABPL" };
+    static const char *const patterns[] = { "BRK*", "*.L", "B*.L", "A?PL", "*", "ZZZ*", "*Q", "brk.?" };
+    Portfolio pf;
+    pf_init(&pf);
+    srand(45);
+    for (int i = 0; i < 5000; ++i) {
+        char sym[PF_SYMBOL_LEN];
+        int len = 2 + rand() % 5;
+        for (int k = 0; k < len; ++k) sym[k] = "ABKLQRVX.O"[rand() % 10];
+        sym[len] = '\0';
+        pf_buy(&pf, sym, 1, 1.0, NULL, NULL);
+    }
+    for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); ++i) pf_buy(&pf, fixed[i], 1, 1.0, NULL, NULL);
+
+    int *idx = malloc((size_t)pf.count * sizeof(int));
+    const char **want = malloc((size_t)pf.count * sizeof(char *));
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); ++p) {
+        char pat[32];
+        snprintf(pat, sizeof(pat), "%s", patterns[p]);
+        pf_symbol_upper(pat);
+        int n = 0;
+        for (int i = 0; i < pf.count; ++i)
+            if (glob(pat, pf.items[i].symbol)) want[n++] = pf.items[i].symbol;
+        qsort(want, (size_t)n, sizeof(*want), by_symbol);
+
+        int matched = -1;
+        pf_status st = pf_search(&pf, patterns[p], NULL, 0, &matched);
+        CHECK(st == PF_OK && matched == n, "%s count-only: %s, %d matches, want %d", patterns[p],
+              pf_strerror(st), matched, n);
+        st = pf_search(&pf, patterns[p], idx, pf.count, &matched);
+        CHECK(st == PF_OK && matched == n, "%s: %s, %d matches, want %d", patterns[p], pf_strerror(st),
+              matched, n);
+        for (int j = 0; st == PF_OK && j < n && j < matched; ++j)
+            CHECK(strcmp(pf.items[idx[j]].symbol, want[j]) == 0, "%s: match %d is %s, want %s", patterns[p],
+                  j, pf.items[idx[j]].symbol, want[j]);
+        int cut = n < 3 ? n : 3;
+        st = pf_search(&pf, patterns[p], idx, cut, &matched);
+        CHECK(st == PF_OK && matched == n, "%s with max %d: %d matches", patterns[p], cut, matched);
+        for (int j = 0; st == PF_OK && j < cut; ++j)
+            CHECK(strcmp(pf.items[idx[j]].symbol, want[j]) == 0, "%s with max %d: match %d is %s", patterns[p],
+                  cut, j, pf.items[idx[j]].symbol);
+    }
+    free(want);
+    free(idx);
+    pf_free(&pf);
+    return check_done();
+}